@@ -0,0 +1,101 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <new>
+
+Arena::Arena(size_t blockSize): blockSize_(blockSize), head_(nullptr), cur_(nullptr), large_(nullptr),
+    begin_(nullptr), ptr_(nullptr), end_(nullptr), used_(0), reserved_(0) {
+    assert(blockSize_ >= 64);
+}
+
+Arena::~Arena() {
+    Reset();
+    while(head_) {
+        Block* block = head_;
+        head_ = block->next;
+        free(block);
+    }
+}
+
+
+void Arena::Use_(Block* block) {
+    cur_ = block;
+    begin_ = ptr_ = block->Data();
+    end_ = block->Data() + block->cap;
+}
+
+// 大块单独申请；否则当前块剩下的空间放弃，换到链上的下一块，链走到头才申请新块
+char* Arena::AllocateSlow_(size_t len) {
+    if(len > blockSize_ / 4) {
+        Block* block = static_cast<Block*>(malloc(sizeof(Block) + len));
+        if(!block) {
+            throw std::bad_alloc();
+        }
+        block->cap = len;
+        block->next = large_;
+        large_ = block;
+        reserved_ += len;
+        used_ += len;
+        return block->Data();
+    }
+    Block* next = cur_ ? cur_->next : head_;
+    if(!next) {
+        next = static_cast<Block*>(malloc(sizeof(Block) + blockSize_));
+        if(!next) {
+            throw std::bad_alloc();
+        }
+        next->cap = blockSize_;
+        next->next = nullptr;
+        if(cur_) {
+            cur_->next = next;
+        }
+        else {
+            head_ = next;
+        }
+        reserved_ += blockSize_;
+    }
+    used_ += static_cast<size_t>(ptr_ - begin_);
+    Use_(next);
+    char* p = ptr_;
+    ptr_ += len;
+    return p;
+}
+
+void* Arena::AllocateAligned(size_t len, size_t align) {
+    assert(align > 0 && (align & (align - 1)) == 0);
+    size_t pad = (0 - reinterpret_cast<uintptr_t>(ptr_)) & (align - 1);
+    if(static_cast<size_t>(end_ - ptr_) >= pad + len) {
+        ptr_ += pad;
+        char* p = ptr_;
+        ptr_ += len;
+        return p;
+    }
+    uintptr_t p = reinterpret_cast<uintptr_t>(AllocateSlow_(len + align - 1));
+    return reinterpret_cast<void*>((p + align - 1) & ~(static_cast<uintptr_t>(align) - 1));
+}
+
+std::string_view Arena::Copy(std::string_view str) {
+    if(str.empty()) {
+        return std::string_view();
+    }
+    char* p = Allocate(str.size());
+    memcpy(p, str.data(), str.size());
+    return std::string_view(p, str.size());
+}
+
+// 标准块全部保留，只把指针拨回第一块；只有用过大块时才需要逐个释放
+void Arena::Reset() {
+    while(large_) {
+        Block* block = large_;
+        large_ = block->next;
+        reserved_ -= block->cap;
+        free(block);
+    }
+    used_ = 0;
+    if(head_) {
+        Use_(head_);
+    }
+}
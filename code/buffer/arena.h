@@ -0,0 +1,62 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <string_view>
+
+/*请求级的bump指针分配器
+一个请求解析出的字符串（解码后的表单字段、改写后的路径等）都从这里顺序分配，不单独释放，
+请求结束时Reset一次性收回：标准块保留在链上供下一个请求复用，Reset只是把指针拨回第一块；
+超过块大小四分之一的分配单独malloc，挂在large_链上，Reset时释放，不让一次大表单的内存一直挂着。
+第一块在第一次分配时才申请，不需要分配的请求（普通GET）完全不碰堆。
+不是线程安全的，随所属的请求对象一起使用*/
+
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 4096);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    //分配len字节的字符空间，不对齐
+    char* Allocate(size_t len) {
+        if(static_cast<size_t>(end_ - ptr_) >= len) {
+            char* p = ptr_;
+            ptr_ += len;
+            return p;
+        }
+        return AllocateSlow_(len);
+    }
+    //分配按align对齐的空间，align须为2的幂
+    void* AllocateAligned(size_t len, size_t align = alignof(max_align_t));
+    //拷贝一份字符串，返回指向拷贝的视图
+    std::string_view Copy(std::string_view str);
+
+    //收回全部分配，之前得到的指针和视图都失效
+    void Reset();
+
+    size_t Used() const { return used_ + static_cast<size_t>(ptr_ - begin_); }   //已分配的字节数
+    size_t Reserved() const { return reserved_; }   //当前向系统申请的总字节数
+
+private:
+    struct Block {
+        Block* next;
+        size_t cap;
+        char* Data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    char* AllocateSlow_(size_t len);
+    void Use_(Block* block);
+
+    size_t blockSize_;
+    Block* head_;   // 标准块链，Reset后从头复用
+    Block* cur_;    // 当前分配所在的标准块
+    Block* large_;  // 单独分配的大块，Reset时释放
+    char* begin_;   // 当前块的数据起点
+    char* ptr_;
+    char* end_;
+    size_t used_;   // 之前各块（含大块）已分配的字节数
+    size_t reserved_;
+};
+
+#endif // ARENA_H
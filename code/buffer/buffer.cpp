@@ -1,26 +1,179 @@
 #include "buffer.h"
 
-//读写位置初始化为0
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+#include <errno.h>
+#include <stdlib.h>
+#include <new>
+#include <algorithm>
+
+namespace {
+
+//线程本地的空闲块链表：只有标准大小的块进链表；线程退出时由BlockReaper释放，之后还回来的块直接free
+struct BlockPool {
+    Buffer::Block* head;
+    size_t count;
+    bool closed;
+};
+thread_local BlockPool tPool = { nullptr, 0, false };
+
+struct BlockReaper {
+    bool armed = false;
+    ~BlockReaper() {
+        while(tPool.head) {
+            Buffer::Block* block = tPool.head;
+            tPool.head = block->next;
+            free(block);
+        }
+        tPool.count = 0;
+        tPool.closed = true;
+    }
+};
+thread_local BlockReaper tReaper;
+
+}
+
+//块在第一次写入时才分配
+Buffer::Buffer(int) : head_(nullptr), tail_(nullptr), size_(0) {}
+
+Buffer::~Buffer() {
+    Release();
+}
+
+
+Buffer::Block* Buffer::Acquire_(size_t minCap) {
+    Block* block = nullptr;
+    if(minCap <= BLOCK_DATA && tPool.head) {
+        block = tPool.head;
+        tPool.head = block->next;
+        tPool.count--;
+    }
+    else {
+        size_t cap = minCap <= BLOCK_DATA ? BLOCK_DATA : minCap;
+        block = static_cast<Block*>(malloc(sizeof(Block) + cap));
+        if(!block) {
+            throw std::bad_alloc();
+        }
+        block->cap = cap;
+    }
+    block->next = nullptr;
+    block->read = 0;
+    block->write = 0;
+    return block;
+}
+
+void Buffer::Recycle_(Block* block) {
+    if(block->cap != BLOCK_DATA || tPool.closed || tPool.count >= POOL_MAX_BLOCKS) {
+        free(block);
+        return;
+    }
+    tReaper.armed = true;   //本线程第一次缓存块时构造，保证线程退出时释放
+    block->next = tPool.head;
+    tPool.head = block;
+    tPool.count++;
+}
+
+size_t Buffer::PooledBlocks() {
+    return tPool.count;
+}
+
+
+void Buffer::PushBlock_(Block* block) const {
+    if(tail_) {
+        tail_->next = block;
+    }
+    else {
+        head_ = block;
+    }
+    tail_ = block;
+}
+
+Buffer::Block* Buffer::First_() const {
+    Block* block = head_;
+    while(block && block != tail_ && block->read == block->write) {
+        block = block->next;
+    }
+    return block;
+}
+
+// 已取走的块在写入前才回收：取走之后、写入之前，解析出的视图仍指向它们
+// 全部取完时尾块从头复用，超大块还回去，不让一次大请求的内存一直挂在连接上
+void Buffer::Reclaim_() {
+    while(head_ && head_ != tail_ && head_->read == head_->write) {
+        Block* block = head_;
+        head_ = block->next;
+        Recycle_(block);
+    }
+    if(head_ && size_ == 0) {
+        if(head_->cap != BLOCK_DATA) {
+            Recycle_(head_);
+            head_ = tail_ = nullptr;
+        }
+        else {
+            head_->read = head_->write = 0;
+        }
+    }
+}
+
+void Buffer::Release() {
+    while(head_) {
+        Block* block = head_;
+        head_ = block->next;
+        Recycle_(block);
+    }
+    tail_ = nullptr;
+    size_ = 0;
+}
+
 
 size_t Buffer::ReadableBytes() const {
-    return writePos_ - readPos_;
+    return size_;
 }
 
 size_t Buffer::WritableBytes() const {
-    return buffer_.size() - writePos_;
+    return tail_ ? tail_->cap - tail_->write : 0;
 }
 
 size_t Buffer::RecyclableBytes() const {
-    return readPos_;
+    return head_ ? head_->read : 0;
+}
+
+// 可读数据跨块时合并到一个块中；超过一块的数据按两倍分配，继续读入的数据落在同一块的空闲部分，
+// 大请求体分多次到达时不会每次都重新合并
+void Buffer::Linearize_() const {
+    Block* first = First_();
+    if(!first || first->write - first->read == size_) {
+        return;
+    }
+    size_t cap = size_ <= BLOCK_DATA ? BLOCK_DATA : (size_ * 2 + sizeof(Block) + BLOCK_BYTES - 1) / BLOCK_BYTES * BLOCK_BYTES - sizeof(Block);
+    Block* merged = Acquire_(cap);
+    for(Block* block = first; block; block = block->next) {
+        memcpy(merged->Data() + merged->write, block->Data() + block->read, block->write - block->read);
+        merged->write += block->write - block->read;
+    }
+    while(head_) {
+        Block* block = head_;
+        head_ = block->next;
+        Recycle_(block);
+    }
+    head_ = tail_ = merged;
 }
 
 const char* Buffer::Peek() const {
-    return &buffer_[readPos_];
+    if(size_ == 0) {
+        return tail_ ? tail_->Data() + tail_->write : "";
+    }
+    Linearize_();
+    Block* first = First_();
+    return first->Data() + first->read;
 }
 
 void Buffer::Retrieve(size_t len) {
-    readPos_ += len;
+    assert(len <= size_);
+    size_ -= len;
+    for(Block* block = head_; len > 0; block = block->next) {
+        size_t n = std::min(len, block->write - block->read);
+        block->read += n;
+        len -= n;
+    }
 }
 
 void Buffer::RetrieveUntil(const char* end) {
@@ -28,46 +181,102 @@ void Buffer::RetrieveUntil(const char* end) {
     Retrieve(end - Peek()); //Peek()返回的是const char*，所以这里需要减去const char*类型
 }
 
+// 只移动读位置，不清零也不释放块
 void Buffer::RetrieveAll(){
-    bzero(&buffer_[0], buffer_.size()); //将buffer_中的数据全部置为0
-    readPos_ = 0;
-    writePos_ = 0;
+    for(Block* block = head_; block; block = block->next) {
+        block->read = block->write;
+    }
+    size_ = 0;
 }
 
 std::string Buffer::RetrieveAllToStr(){
-    std::string str(Peek(), ReadableBytes());
+    std::string str;
+    CopyTo(0, size_, str);
     RetrieveAll();
     return str;
 }
 
+
+void Buffer::Slices(size_t offset, size_t len, std::vector<struct iovec>& out) const {
+    assert(offset + len <= size_);
+    for(Block* block = First_(); len > 0; block = block->next) {
+        size_t avail = block->write - block->read;
+        if(offset >= avail) {
+            offset -= avail;
+            continue;
+        }
+        char* data = block->Data() + block->read + offset;
+        size_t n = std::min(len, avail - offset);
+        offset = 0;
+        len -= n;
+        if(!out.empty() && static_cast<char*>(out.back().iov_base) + out.back().iov_len == data) {
+            out.back().iov_len += n;
+        }
+        else {
+            out.push_back({ data, n });
+        }
+    }
+}
+
+void Buffer::CopyTo(size_t offset, size_t len, std::string& out) const {
+    assert(offset + len <= size_);
+    out.reserve(out.size() + len);
+    for(Block* block = First_(); len > 0; block = block->next) {
+        size_t avail = block->write - block->read;
+        if(offset >= avail) {
+            offset -= avail;
+            continue;
+        }
+        size_t n = std::min(len, avail - offset);
+        out.append(block->Data() + block->read + offset, n);
+        offset = 0;
+        len -= n;
+    }
+}
+
+
 const char* Buffer::BeginWritePtr() const {
-    return &buffer_[writePos_]; 
+    return tail_ ? tail_->Data() + tail_->write : nullptr;
 }
 
 char* Buffer::BeginWrite() {
-    return &buffer_[writePos_]; 
+    EnsureWritableBytes(1);
+    return tail_->Data() + tail_->write;
 }
 
 void Buffer::HasWritten(size_t len) {
-    writePos_ += len;
+    assert(len <= WritableBytes());
+    tail_->write += len;
+    size_ += len;
 }
 
 void Buffer::EnsureWritableBytes(size_t len) {
+    Reclaim_();
     if(len > WritableBytes()) {
-        MakeSpace_(len);
+        PushBlock_(Acquire_(len));
     }
     assert(len <= WritableBytes());
 }
 
+// 先填满尾块，再按需接新块，已有的数据不移动
 void Buffer::Append(const char* str, size_t len) {
-    assert(str);
-    EnsureWritableBytes(len);
-    std::copy(str, str + len, BeginWrite());
-    HasWritten(len);
+    assert(str || len == 0);
+    Reclaim_();
+    while(len > 0) {
+        if(WritableBytes() == 0) {
+            PushBlock_(Acquire_(BLOCK_DATA));
+        }
+        size_t n = std::min(len, WritableBytes());
+        memcpy(tail_->Data() + tail_->write, str, n);
+        tail_->write += n;
+        size_ += n;
+        str += n;
+        len -= n;
+    }
 }
 
 void Buffer::Append(const std::string& str) {
-    Append(str.c_str(), str.size());
+    Append(str.data(), str.size());
 }
 
 void Buffer::Append(const void* data, size_t len) {
@@ -75,33 +284,60 @@ void Buffer::Append(const void* data, size_t len) {
 }
 
 void Buffer::Append(const Buffer& buff) {
-    Append(buff.Peek(), buff.ReadableBytes());
+    for(Block* block = buff.First_(); block; block = block->next) {
+        Append(block->Data() + block->read, block->write - block->read);
+    }
 }
 
-//将fd中的数据读入buffer_中
+// 读进尾块的空闲部分和READ_BLOCKS个新块，用上的新块接到链尾，没用上的还回空闲链表
 ssize_t Buffer::ReadFd(int fd, int* Errno){
-    char buff[65535];  //65535是Linux系统默认的缓冲区大小
-    struct iovec iov[2];  //iovec是Linux系统定义的一个结构体，用于描述一个缓冲区
-    size_t writable = WritableBytes(); //获取buffer_中可写的大小
-    iov[0].iov_base = BeginWrite();  //第一块：iov_base指向缓冲区的起始地址
-    iov[0].iov_len = writable;  //iov_len指向缓冲区的长度
-    iov[1].iov_base = buff;    //第二块：iov_base指向一个临时的缓冲区
-    iov[1].iov_len = sizeof(buff);   //iov_len指向临时的缓冲区的长度
-
-    ssize_t len = readv(fd, iov, 2);  //将fd中的数据读入iov中
+    Reclaim_();
+    struct iovec iov[READ_BLOCKS + 1];
+    Block* fresh[READ_BLOCKS];
+    int cnt = 0;
+    size_t writable = WritableBytes();
+    if(writable > 0) {
+        iov[cnt++] = { tail_->Data() + tail_->write, writable };
+    }
+    for(int i = 0; i < READ_BLOCKS; i++) {
+        fresh[i] = Acquire_(BLOCK_DATA);
+        iov[cnt++] = { fresh[i]->Data(), fresh[i]->cap };
+    }
+
+    ssize_t len = readv(fd, iov, cnt);
     if(len < 0) {
         *Errno = errno;
-    }else if(static_cast<size_t>(len) <= writable) {  //如果读入的数据小于等于buffer_中可写的大小
-        writePos_ += len;  //将写位置向后移动len个字节
-    }else {  //如果读入的数据大于buffer_中可写的大小
-        writePos_ = buffer_.size();  //将写位置置为buffer_的末尾
-        Append(buff,static_cast<size_t>(len) - writable);  //将读入的数据中剩余的部分追加到buffer_中
+    }
+    size_t left = len > 0 ? static_cast<size_t>(len) : 0;
+    size_ += left;
+    if(writable > 0) {
+        size_t n = std::min(left, writable);
+        tail_->write += n;
+        left -= n;
+    }
+    for(int i = 0; i < READ_BLOCKS; i++) {
+        if(left > 0) {
+            fresh[i]->write = std::min(left, fresh[i]->cap);
+            left -= fresh[i]->write;
+            PushBlock_(fresh[i]);
+        }
+        else {
+            Recycle_(fresh[i]);
+        }
     }
     return len;
 }
 
+// 各块的数据片一次writev发出
 ssize_t Buffer::WriteFd(int fd, int* Errno) {
-    ssize_t len = write(fd, Peek(), ReadableBytes());
+    struct iovec iov[16];
+    int cnt = 0;
+    for(Block* block = First_(); block && cnt < 16; block = block->next) {
+        if(block->write > block->read) {
+            iov[cnt++] = { block->Data() + block->read, block->write - block->read };
+        }
+    }
+    ssize_t len = writev(fd, iov, cnt);
     if(len < 0) {
         *Errno = errno;
         return len;
@@ -109,24 +345,3 @@ ssize_t Buffer::WriteFd(int fd, int* Errno) {
     Retrieve(len);
     return len;
 }
-
-char* Buffer::BeginPtr_() {
-    return &buffer_[0];
-}
-
-const char* Buffer::BeginPtr_() const {
-    return &buffer_[0];
-}
-
-//扩展buffer_的大小
-void Buffer::MakeSpace_(size_t len) {
-    if(WritableBytes() + RecyclableBytes() < len) {//如果buffer_中可写的大小加上可回收的大小小于len，则扩展buffer_的大小
-        buffer_.resize(writePos_ + len + 1);
-    }else { //如果buffer_中可写的大小加上可回收的大小大于等于len，则将可读的数据移动到buffer_的开头
-        size_t readable = ReadableBytes();
-        std::copy(BeginPtr_() + readPos_,BeginPtr_() + writePos_, BeginPtr_());  //将可读的数据移动到buffer_的开头
-        readPos_ = 0;
-        writePos_ = readable;
-        assert(readable == ReadableBytes());
-    }
-}
\ No newline at end of file
@@ -2,29 +2,37 @@
 #define BUFFER_H
 
 #include <cstring>
-#include <iostream>
+#include <string>
+#include <vector>
 #include <unistd.h>
 #include <sys/uio.h>
-#include <vector>
-#include <atomic>
 #include <assert.h>
 
+/*分块缓冲区
+数据存放在一串固定大小的块中，块来自线程本地的空闲链表，用完还回去，不再整体扩容、搬移或清零：
+追加只写尾块的空闲部分，写满再接一个新块，已写入的数据不会移动；
+ReadFd用readv直接读进尾块的空闲部分和几个新块，不经过栈上的临时数组；
+发送时按块取出数据片交给writev，不需要先拼成一段。
+Peek需要连续的数据（解析器在缓冲区上原地解析），只有可读数据跨块时才把它们合并到一个块中。
+已取走的数据所在的块在下一次写入时才回收，取走之后、下一次写入之前，之前得到的视图仍然有效*/
 
 class Buffer
-{ 
+{
 public:
-    Buffer(int initBufSize = 1024);
-    ~Buffer() = default;
+    Buffer(int initBufSize = 1024);   // 块在第一次写入时才分配，initBufSize只为兼容旧接口
+    ~Buffer();
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
-    //返回可写空间大小 
+    //返回尾块中连续可写空间的大小
     size_t WritableBytes() const;
-    //返回可读空间大小
+    //返回可读数据的总大小
     size_t ReadableBytes() const;
-    //返回可回收空间大小
+    //返回首块中已取走的空间大小
     size_t RecyclableBytes() const;
 
     /*数据读取操作*/
-    //返回当前可读数据的起始指针
+    //返回当前可读数据的起始指针，可读数据跨块时先合并为连续的一段
     const char* Peek() const;
     //读取len个字节的数据
     void Retrieve(size_t len);
@@ -34,6 +42,13 @@ public:
     void RetrieveAll();
     //将所有可读数据转换为字符串，并清空缓冲区
     std::string RetrieveAllToStr();
+    //丢弃全部数据并把块还给空闲链表，之前得到的视图和指针全部失效
+    void Release();
+
+    //把从offset开始的len字节可读数据按块追加到out中，与out末尾相邻的合并为一段
+    void Slices(size_t offset, size_t len, std::vector<struct iovec>& out) const;
+    //把从offset开始的len字节可读数据追加到out
+    void CopyTo(size_t offset, size_t len, std::string& out) const;
 
     /*数据写入操作*/
     //返回当前可写数据的起始指针
@@ -49,22 +64,41 @@ public:
     void Append(const Buffer& buf);
     //通知已写入指定长度数据，移动写指针
     void HasWritten(size_t len);
-    //确保可写空间大小，如果不足则扩容
+    //确保尾块中有len字节连续的可写空间，不足时接一个新块
     void EnsureWritableBytes(size_t len);
 
     ssize_t ReadFd(int fd, int* Errno);
     ssize_t WriteFd(int fd, int* Errno);
 
+    static const size_t BLOCK_BYTES = 4096;   // 块的分配大小（含块头），更大的连续空间单独分配，不进空闲链表
+    static const size_t POOL_MAX_BLOCKS = 256;   // 每个线程最多缓存的空闲块数
+    static const int READ_BLOCKS = 4;   // ReadFd一次最多读进的新块数
+    static size_t PooledBlocks();   // 本线程空闲链表中的块数
+
+    struct Block {
+        Block* next;
+        size_t cap;     // 数据区大小
+        size_t read;    // 可读数据的起点
+        size_t write;   // 可读数据的终点，也是可写空间的起点
+        char* Data() { return reinterpret_cast<char*>(this + 1); }
+    };
+    static const size_t BLOCK_DATA = BLOCK_BYTES - sizeof(Block);
+
 private:
-    char* BeginPtr_();
-    const char* BeginPtr_() const;
-    void MakeSpace_(size_t len);
+    static Block* Acquire_(size_t minCap);
+    static void Recycle_(Block* block);
+
+    Block* First_() const;   // 第一个有可读数据的块，没有时为尾块
+    void Reclaim_();   // 写入前回收已取走的块
+    void PushBlock_(Block* block) const;
+    void Linearize_() const;
 
-    std::vector<char> buffer_;
-    std::atomic<size_t> readPos_; //当前可读数据的起始指针
-    std::atomic<size_t> writePos_;  //当前可写数据的起始指针
+    //Peek合并跨块的数据不改变内容，只换块，所以块链在const函数中也可以调整
+    mutable Block* head_;
+    mutable Block* tail_;
+    size_t size_;   // 可读数据的总大小
 };
 
 
 
-#endif // !BUFFER_H
\ No newline at end of file
+#endif // !BUFFER_H
@@ -0,0 +1,310 @@
+#include "filecache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <chrono>
+
+#include "resourcepack.h"
+#include "../log/log.h"
+
+using namespace std;
+
+
+CachedFile::~CachedFile() {
+    if(borrowed) {
+        return;
+    }
+    if(data) {
+        munmap(data, Size());
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+
+FileCache::FileCache(): maxBytes_(64 * 1024 * 1024), maxEntries_(1024), revalidateMS_(1000), bytes_(0),
+    epoch_(0), hits_(0), misses_(0), invalidations_(0) {}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+void FileCache::Init(size_t maxBytes, size_t maxEntries, int revalidateMS) {
+    lock_guard<mutex> locker(mtx_);
+    maxBytes_ = maxBytes;
+    maxEntries_ = maxEntries;
+    revalidateMS_ = revalidateMS;
+    while(!lru_.empty() && (bytes_ > maxBytes_ || index_.size() > maxEntries_)) {
+        Erase_(index_.find(lru_.back().path));
+    }
+}
+
+
+int64_t FileCache::NowMS_() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool FileCache::SameFile_(const struct stat& a, const struct stat& b) {
+    return a.st_ino == b.st_ino && a.st_dev == b.st_dev && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+
+// 线程本地视图：弱引用共享表中的条目，epoch_变化（有条目被失效）时整个丢弃
+// 命中时只有一次本地哈希查找和一次原子读，不加锁；过期、失效或条目已被释放时再查共享表
+FileCache::LocalView& FileCache::Local_() {
+    thread_local LocalView local;
+    uint64_t epoch = epoch_.load(memory_order_acquire);
+    if(local.epoch != epoch) {
+        local.files.clear();
+        local.epoch = epoch;
+    }
+    return local;
+}
+
+void FileCache::Remember_(LocalView& local, const string& path, const FileRef& file, int err, int64_t checked, int64_t now) {
+    if(local.files.size() >= LOCAL_MAX_ENTRIES) {
+        local.files.clear();
+    }
+    // 至少每LOCAL_REFRESH_MS回共享表一次，让共享表的LRU知道哪些文件仍然热门
+    int64_t expires = checked + revalidateMS_;
+    if(expires > now + LOCAL_REFRESH_MS) {
+        expires = now + LOCAL_REFRESH_MS;
+    }
+    local.files[path] = { file, err, expires };
+}
+
+
+FileRef FileCache::Get(const string& path, int* err) {
+    int64_t now = NowMS_();
+    LocalView& local = Local_();
+    auto lit = local.files.find(path);
+    if(lit != local.files.end() && now < lit->second.expires) {
+        if(lit->second.err) {
+            hits_.fetch_add(1, memory_order_relaxed);
+            *err = lit->second.err;
+            return nullptr;
+        }
+        FileRef file = lit->second.file.lock();
+        if(file) {
+            hits_.fetch_add(1, memory_order_relaxed);
+            return file;
+        }
+    }
+    int64_t checked = now;
+    FileRef file = GetShared_(path, err, now, &checked);
+    Remember_(local, path, file, file ? 0 : *err, checked, now);
+    return file;
+}
+
+
+// 命中且未到复查时间：只有一次哈希查找；到了复查时间：stat一次，文件未变则继续使用
+// 失败的条目到了复查时间直接重新打开
+// open在锁外进行，先记下epoch_：打开期间有失效发生时，打开的可能是变化前的文件，照常返回但不缓存
+FileRef FileCache::GetShared_(const string& path, int* err, int64_t now, int64_t* checked) {
+    uint64_t epoch = epoch_.load(memory_order_acquire);
+    FileRef cached;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(pack_) {
+            return FindPacked_(path, err);
+        }
+        auto it = index_.find(path);
+        if(it != index_.end()) {
+            Entry& entry = *it->second;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            if(now - entry.checked < revalidateMS_) {
+                hits_.fetch_add(1, memory_order_relaxed);
+                *checked = entry.checked;
+                if(!entry.file) {
+                    *err = entry.err;
+                }
+                return entry.file;
+            }
+            cached = entry.file;
+        }
+    }
+
+    struct stat st;
+    if(cached && stat(path.c_str(), &st) == 0 && SameFile_(st, cached->st) && (st.st_mode & S_IROTH)) {
+        lock_guard<mutex> locker(mtx_);
+        auto it = index_.find(path);
+        if(it != index_.end() && it->second->file == cached) {
+            it->second->checked = now;
+        }
+        hits_.fetch_add(1, memory_order_relaxed);
+        return cached;
+    }
+
+    misses_.fetch_add(1, memory_order_relaxed);
+    FileRef file = Open_(path, err);
+    Insert_(path, file, file ? 0 : *err, now, epoch);
+    return file;
+}
+
+
+// 条件请求先用它取校验信息，304时完全不需要打开文件；未到复查时间的条目直接返回其stat
+bool FileCache::Stat(const string& path, struct stat* st) {
+    int64_t now = NowMS_();
+    LocalView& local = Local_();
+    auto lit = local.files.find(path);
+    if(lit != local.files.end() && now < lit->second.expires) {
+        if(lit->second.err) {
+            return false;
+        }
+        FileRef file = lit->second.file.lock();
+        if(file) {
+            *st = file->st;
+            return true;
+        }
+    }
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(pack_) {
+            int err = 0;
+            FileRef file = FindPacked_(path, &err);
+            if(file) {
+                *st = file->st;
+            }
+            return file != nullptr;
+        }
+        auto it = index_.find(path);
+        if(it != index_.end() && now - it->second->checked < revalidateMS_) {
+            if(!it->second->file) {
+                return false;
+            }
+            *st = it->second->file->st;
+            return true;
+        }
+    }
+    return stat(path.c_str(), st) == 0 && S_ISREG(st->st_mode) && (st->st_mode & S_IROTH);
+}
+
+
+// 打开并映射一个可读的普通文件；以打开后的fstat为准，避免stat与open之间文件被替换
+FileRef FileCache::Open_(const string& path, int* err) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        *err = errno;
+        return nullptr;
+    }
+    shared_ptr<CachedFile> file = make_shared<CachedFile>();
+    file->path = path;
+    file->fd = fd;
+    if(fstat(fd, &file->st) < 0) {
+        *err = errno;
+        return nullptr;
+    }
+    if(S_ISDIR(file->st.st_mode) || !S_ISREG(file->st.st_mode)) {
+        *err = EISDIR;
+        return nullptr;
+    }
+    if(!(file->st.st_mode & S_IROTH)) {   //与原先一致：其他用户不可读的文件返回403
+        *err = EACCES;
+        return nullptr;
+    }
+    if(file->Size() > 0) {
+        void* mm = mmap(nullptr, file->Size(), PROT_READ, MAP_SHARED, fd, 0);
+        if(mm == MAP_FAILED) {
+            *err = errno;
+            LOG_ERROR("mmap %s failed, errno: %d", path.c_str(), errno);
+            return nullptr;
+        }
+        file->data = static_cast<char*>(mm);
+    }
+    return file;
+}
+
+
+void FileCache::Insert_(const string& path, const FileRef& file, int err, int64_t now, uint64_t epoch) {
+    lock_guard<mutex> locker(mtx_);
+    if(epoch_.load(memory_order_relaxed) != epoch) {
+        return;   //打开之后有失效，这次的结果不一定是最新的
+    }
+    auto it = index_.find(path);
+    if(it != index_.end()) {
+        Erase_(it);
+    }
+    size_t size = file ? file->Size() : 0;
+    if(size > maxBytes_ || maxEntries_ == 0) {
+        return;   //超过容量的文件照常返回给调用方，只是不缓存
+    }
+    while(!lru_.empty() && (bytes_ + size > maxBytes_ || index_.size() >= maxEntries_)) {
+        Erase_(index_.find(lru_.back().path));   //淘汰最久未使用的条目
+    }
+    lru_.push_front({ path, file, err, now });
+    index_.emplace(path, lru_.begin());
+    bytes_ += size;
+}
+
+void FileCache::Erase_(unordered_map<string, LruList::iterator>::iterator it) {
+    bytes_ -= it->second->file ? it->second->file->Size() : 0;
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+
+// 先删共享表中的条目再推进epoch_：各线程的本地视图在下次访问时丢弃，之后只能查到新的共享表
+void FileCache::Invalidate(const string& path) {
+    lock_guard<mutex> locker(mtx_);
+    auto it = index_.find(path);
+    if(it != index_.end()) {
+        Erase_(it);
+    }
+    invalidations_.fetch_add(1, memory_order_relaxed);
+    epoch_.fetch_add(1, memory_order_release);
+}
+
+// 资源包中的条目常驻内存，不进LRU；找不到的路径一律按不存在处理
+FileRef FileCache::FindPacked_(const string& path, int* err) {
+    FileRef file;
+    if(path.compare(0, packRoot_.size(), packRoot_) == 0) {
+        file = pack_->Find(string_view(path).substr(packRoot_.size()));
+    }
+    if(!file) {
+        misses_.fetch_add(1, memory_order_relaxed);
+        *err = ENOENT;
+    }
+    else if(!(file->st.st_mode & S_IROTH)) {
+        *err = EACCES;
+        return nullptr;
+    }
+    else {
+        hits_.fetch_add(1, memory_order_relaxed);
+    }
+    return file;
+}
+
+void FileCache::SetPack(const string& root, shared_ptr<const ResourcePack> pack) {
+    lock_guard<mutex> locker(mtx_);
+    packRoot_ = root;
+    pack_ = std::move(pack);
+    index_.clear();
+    lru_.clear();
+    bytes_ = 0;
+    invalidations_.fetch_add(1, memory_order_relaxed);
+    epoch_.fetch_add(1, memory_order_release);
+}
+
+void FileCache::Clear() {
+    lock_guard<mutex> locker(mtx_);
+    index_.clear();
+    lru_.clear();
+    bytes_ = 0;
+    invalidations_.fetch_add(1, memory_order_relaxed);
+    epoch_.fetch_add(1, memory_order_release);
+}
+
+size_t FileCache::Count() {
+    lock_guard<mutex> locker(mtx_);
+    return index_.size();
+}
+
+size_t FileCache::Bytes() {
+    lock_guard<mutex> locker(mtx_);
+    return bytes_;
+}
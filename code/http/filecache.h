@@ -0,0 +1,116 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <stdint.h>
+
+/*进程级的静态文件缓存
+按完整路径缓存已打开的fd、struct stat和只读共享映射，同一个文件的所有请求共用一份映射，
+不再每个请求open+mmap+munmap。条目由shared_ptr引用计数：被淘汰或文件变化后，
+正在发送的响应仍持有旧条目，最后一个引用释放时才munmap和close。
+超过revalidateMS的条目在下次访问时重新stat一次，文件被修改或替换则重新加载。
+打开失败的路径也缓存同样长的时间（如不存在的预压缩文件），期间重复访问不再open。
+共享表由互斥锁保护，每个线程另有一份弱引用的本地视图，命中时不加锁；
+Invalidate/Clear推进epoch，本地视图随之作废（ResourceWatcher据inotify事件调用）*/
+
+struct CachedFile {
+    std::string path;
+    int fd;
+    struct stat st;
+    char* data;    // 只读共享映射，空文件为nullptr
+    off_t base;    // data对应fd中的偏移，sendfile用；资源包中的文件不为0
+    bool borrowed; // fd和映射属于资源包，不由本对象释放
+
+    size_t Size() const { return static_cast<size_t>(st.st_size); }
+
+    CachedFile(): fd(-1), st(), data(nullptr), base(0), borrowed(false) {}
+    ~CachedFile();
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+};
+
+typedef std::shared_ptr<const CachedFile> FileRef;
+
+class ResourcePack;
+
+class FileCache {
+public:
+    static FileCache* Instance();
+
+    void Init(size_t maxBytes, size_t maxEntries, int revalidateMS = 1000);
+
+    //打开path对应的普通文件；失败返回nullptr，err为ENOENT、EISDIR或EACCES（其他用户不可读）等
+    FileRef Get(const std::string& path, int* err);
+    //只取元数据，不打开也不映射；文件不是其他用户可读的普通文件时返回false
+    bool Stat(const std::string& path, struct stat* st);
+    void Invalidate(const std::string& path);
+    void Clear();
+    //资源包模式：root下的路径全部由资源包提供，不再访问文件系统；pack为空时恢复按文件缓存
+    void SetPack(const std::string& root, std::shared_ptr<const ResourcePack> pack);
+
+    size_t Count();
+    size_t Bytes();
+    uint64_t Hits() const { return hits_; }
+    uint64_t Misses() const { return misses_; }
+    uint64_t Invalidations() const { return invalidations_; }
+
+private:
+    FileCache();
+    ~FileCache() = default;
+
+    struct Entry {
+        std::string path;
+        FileRef file;      // 为空表示打开失败，err为失败原因
+        int err;
+        int64_t checked;   // 上次确认文件未变化的时刻（毫秒）
+    };
+    typedef std::list<Entry> LruList;   // 表头为最近使用
+
+    struct LocalEntry {
+        std::weak_ptr<const CachedFile> file;
+        int err;
+        int64_t expires;   // 过期后回共享表查询
+    };
+    struct LocalView {
+        uint64_t epoch = UINT64_MAX;
+        std::unordered_map<std::string, LocalEntry> files;
+    };
+    static const size_t LOCAL_MAX_ENTRIES = 4096;   // 本地视图的条目上限，超过时清空
+    static const int64_t LOCAL_REFRESH_MS = 1000;
+
+    LocalView& Local_();
+    void Remember_(LocalView& local, const std::string& path, const FileRef& file, int err, int64_t checked, int64_t now);
+    FileRef GetShared_(const std::string& path, int* err, int64_t now, int64_t* checked);
+    FileRef FindPacked_(const std::string& path, int* err);   //调用时须持有mtx_
+
+    static int64_t NowMS_();
+    static bool SameFile_(const struct stat& a, const struct stat& b);
+    static FileRef Open_(const std::string& path, int* err);
+    void Insert_(const std::string& path, const FileRef& file, int err, int64_t now, uint64_t epoch);   //epoch为打开前的epoch_，已变化时不缓存
+    void Erase_(std::unordered_map<std::string, LruList::iterator>::iterator it);
+
+    size_t maxBytes_;
+    size_t maxEntries_;
+    int revalidateMS_;
+
+    std::mutex mtx_;
+    LruList lru_;
+    std::unordered_map<std::string, LruList::iterator> index_;
+    size_t bytes_;
+
+    std::string packRoot_;
+    std::shared_ptr<const ResourcePack> pack_;
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> invalidations_;
+};
+
+#endif // FILE_CACHE_H
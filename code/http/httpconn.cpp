@@ -1,15 +1,78 @@
 #include "httpconn.h"
+
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 using namespace std;
 
 
+//用sendfile发送的文件段：iov中的对应段仍指向文件映射，发送进度即iov_base相对映射起点的偏移，
+//EAGAIN后从该偏移续发；io_uring等只认iovec的后端照常通过映射发送
+struct SendfileSeg {
+    size_t index;    //在iov中的下标
+    const CachedFile* file;
+};
+
+//一次请求/响应期间才需要的状态，连接空闲时整体还回线程本地的空闲链表，容量都保留给下一个连接
+struct HttpExchange {
+    HttpRequest request;  //http请求
+    HttpResponse response;  //http响应
+    Buffer writeBuffer;  //写缓冲区，存放响应头
+    Buffer heldInput;  //held_期间由Feed收到的数据，暂存于此以免readBuffer_扩容使视图失效
+
+    std::vector<struct iovec> iov;  //待发送的数据段：writeBuffer中的响应头与缓存文件的映射交替排列
+    size_t iovHead = 0;    //第一个未发完的数据段
+    std::vector<FileRef> files;  //本批响应引用的缓存文件，发送完成后释放
+    std::vector<ResponseRef> cached;  //本批响应引用的整包缓存
+    std::vector<SendfileSeg> sendfiles;
+    size_t sendfileHead = 0;  //第一个未发完的sendfile段
+
+    HttpExchange* next = nullptr;  //空闲链表
+};
+
+namespace {
+
+//线程本地的空闲链表，线程退出时由ExchangeReaper释放，之后还回来的直接delete
+struct ExchangePool {
+    HttpExchange* head;
+    size_t count;
+    bool closed;
+};
+thread_local ExchangePool tExchanges = { nullptr, 0, false };
+
+struct ExchangeReaper {
+    bool armed = false;
+    ~ExchangeReaper() {
+        while(tExchanges.head) {
+            HttpExchange* ex = tExchanges.head;
+            tExchanges.head = ex->next;
+            delete ex;
+        }
+        tExchanges.count = 0;
+        tExchanges.closed = true;
+    }
+};
+thread_local ExchangeReaper tExchangeReaper;
+
+}
+
+
 const char* HttpConn::SrcDir;
 std::atomic<int> HttpConn::UserCount;
 bool HttpConn::isET;
+size_t HttpConn::SendfileMin = 0;
 
 HttpConn::HttpConn(){
     fd_ = -1;
     addr_ = {0};
+    gen_ = 0;
+    timerNode_.data = this;
     isClose_ = true;
+    keepAlive_ = false;
+    toWrite_ = 0;
+    notifier_ = nullptr;
+    suspended_ = false;
+    held_ = false;
+    ex_ = nullptr;
 }
 
 HttpConn::~HttpConn(){
@@ -17,22 +80,31 @@ HttpConn::~HttpConn(){
 }
 
 //初始化连接
-void HttpConn::Init(int fd, const sockaddr_in& addr){
+void HttpConn::Init(int fd, const sockaddr_in& addr, SqlNotifier* notifier){
     assert(fd > 0);
     UserCount++;
     fd_ = fd;
     addr_ = addr;
-    writeBuffer_.RetrieveAll();
-    readBuffer_.RetrieveAll();
+    gen_++;
+    notifier_ = notifier;
+    suspended_ = false;
+    held_ = false;
+    Shrink_();   //请求/响应状态等收到数据后再取
+    keepAlive_ = false;
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)UserCount);
 }
 
 //关闭连接
 void HttpConn::Close(){
-    response_.UnmapFile(); //关闭文件映射
+    toWrite_ = 0;
+    suspended_ = false;
+    held_ = false;
+    readBuffer_.RetrieveAll();
+    Shrink_();   //连同文件映射的引用一起还回去
     if(isClose_ == false){
         isClose_ = true;
+        gen_++;    //旧连接上的事件和定时器从此失效
         UserCount--;
         close(fd_);
         LOG_INFO("Client[%d](%s:%d) close, userCount:%d", fd_, GetIP(), GetPort(), (int)UserCount);
@@ -82,69 +154,283 @@ ssize_t HttpConn::Read(int* saveErrno){
 }
 
 
-// 将数据从iov_中写入文件描述符fd_
+// 将iov中的数据写入文件描述符fd_，流水线中的多个响应一次writev发出
+// 大文件段改用sendfile，之前的响应头带MSG_MORE发出，和文件开头合并成满的报文段
+// 一直写到发完或出错，EAGAIN时返回-1，由调用方注册EPOLLOUT后继续
 ssize_t HttpConn::Write(int* saveErrno){
     ssize_t len = -1;
     do{
-        len = writev(fd_, iov_, iovCnt_);   //将iov_中的数据写入文件描述符fd_
+        HttpExchange* ex = ex_;
+        while(ex->sendfileHead < ex->sendfiles.size() && ex->sendfiles[ex->sendfileHead].index < ex->iovHead){
+            ex->sendfileHead++;
+        }
+        int cnt = WriteIovCnt();
+        bool more = false;
+        if(ex->sendfileHead < ex->sendfiles.size() && ex->sendfiles[ex->sendfileHead].index - ex->iovHead <= static_cast<size_t>(cnt)){
+            cnt = static_cast<int>(ex->sendfiles[ex->sendfileHead].index - ex->iovHead);
+            more = true;
+        }
+        if(cnt == 0){
+            len = SendFile_(ex->iov[ex->iovHead], ex->sendfiles[ex->sendfileHead].file);
+        }
+        else if(more){
+            struct msghdr msg = {};
+            msg.msg_iov = const_cast<struct iovec*>(WriteIov());
+            msg.msg_iovlen = cnt;
+            len = sendmsg(fd_, &msg, MSG_MORE);
+        }
+        else{
+            len = writev(fd_, WriteIov(), cnt);   //将iov中的数据写入文件描述符fd_
+        }
         if(len <= 0){
-            *saveErrno = errno;
+            *saveErrno = len == 0 ? EIO : errno;   //sendfile返回0说明文件在发送途中被截断
+            len = -1;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len == 0){    //传输完成
+        HasSent(len);
+    }while(ToWriteBytes() > 0);
+    return len;
+}
+
+// 从映射中的当前位置推算文件偏移（资源包中的文件再加上它在包中的起点），内核直接从页缓存发送，不经过用户态映射
+ssize_t HttpConn::SendFile_(const struct iovec& v, const CachedFile* file){
+    off_t offset = file->base + (static_cast<const char*>(v.iov_base) - file->data);
+    return sendfile(fd_, file->fd, &offset, v.iov_len);
+}
+
+const struct iovec* HttpConn::WriteIov() const{
+    assert(ex_);
+    return ex_->iov.data() + ex_->iovHead;
+}
+
+int HttpConn::WriteIovCnt() const{
+    if(!ex_){
+        return 0;
+    }
+    size_t cnt = ex_->iov.size() - ex_->iovHead;
+    return cnt > IOV_MAX ? IOV_MAX : static_cast<int>(cnt);
+}
+
+// 已发送len字节，跳过已发完的数据段；整批发完后释放writeBuffer和文件引用，没有后续数据时连接转入空闲
+void HttpConn::HasSent(size_t len){
+    assert(len <= toWrite_);
+    toWrite_ -= len;
+    std::vector<struct iovec>& iov = ex_->iov;
+    while(len > 0 && ex_->iovHead < iov.size()){
+        struct iovec& v = iov[ex_->iovHead];
+        if(len >= v.iov_len){
+            len -= v.iov_len;
+            v.iov_len = 0;
+            ex_->iovHead++;
+        }
+        else{
+            v.iov_base = (uint8_t*)v.iov_base + len;
+            v.iov_len -= len;
+            len = 0;
+        }
+    }
+    if(toWrite_ == 0){
+        ResetWrite_();
+        Shrink_();
+    }
+}
+
+void HttpConn::ResetWrite_(){
+    ex_->files.clear();
+    ex_->cached.clear();
+    ex_->sendfiles.clear();
+    ex_->sendfileHead = 0;
+    ex_->iov.clear();   //保留容量，下一批不再分配
+    ex_->iovHead = 0;
+    ex_->writeBuffer.Release();   //块还给线程的空闲链表
+}
+
+// 读缓冲区中还有数据（流水线请求或不完整的请求）、请求被挂起或响应未发完时不能还
+void HttpConn::Shrink_(){
+    if(toWrite_ > 0 || suspended_ || held_ || readBuffer_.ReadableBytes() > 0){
+        return;
+    }
+    readBuffer_.Release();
+    if(ex_){
+        ResetWrite_();
+        RecycleExchange_(ex_);
+        ex_ = nullptr;
+    }
+}
+
+HttpExchange* HttpConn::AcquireExchange_(){
+    HttpExchange* ex = tExchanges.head;
+    if(ex){
+        tExchanges.head = ex->next;
+        tExchanges.count--;
+        ex->next = nullptr;
+    }
+    else{
+        ex = new HttpExchange;
+    }
+    ex->request.Init();
+    return ex;
+}
+
+void HttpConn::RecycleExchange_(HttpExchange* ex){
+    ex->response.UnmapFile();
+    ex->heldInput.Release();
+    if(tExchanges.closed || tExchanges.count >= POOL_MAX_EXCHANGES){
+        delete ex;
+        return;
+    }
+    tExchangeReaper.armed = true;   //本线程第一次缓存时构造，保证线程退出时释放
+    ex->next = tExchanges.head;
+    tExchanges.head = ex;
+    tExchanges.count++;
+}
+
+size_t HttpConn::PooledExchanges(){
+    return tExchanges.count;
+}
+
+// 追加由后端直接收到的数据
+void HttpConn::Feed(const char* data, size_t len){
+    (held_ ? ex_->heldInput : readBuffer_).Append(data, len);
+}
+
+// 处理连接：依次解析读缓冲区中的完整请求并生成响应，遇到不完整的请求或非长连接请求为止
+// 登录/注册请求需要查询数据库：前面已有响应时先把它们发出去，否则提交查询并挂起连接
+bool HttpConn::Process(){
+    assert(toWrite_ == 0);
+    if(suspended_){
+        return false;
+    }
+    if(!ex_){
+        if(readBuffer_.ReadableBytes() == 0){
+            Shrink_();   //读到的数据已处理完（或本来就没有读到），块不再挂在连接上
+            return false;
+        }
+        ex_ = AcquireExchange_();
+    }
+    HttpRequest& request = ex_->request;
+    HttpResponse& response = ex_->response;
+    Buffer& writeBuffer = ex_->writeBuffer;
+    int handled = 0;
+    while(handled < MAX_PIPELINE){
+        HttpParser::Status status = HttpParser::PARSE_OK;
+        if(!held_){
+            if(readBuffer_.ReadableBytes() == 0){
+                break;
+            }
+            status = request.parse(readBuffer_);
+        }
+        // 请求不完整，已读的数据和解析进度都保留在request和readBuffer_中，等待更多数据
+        if(status == HttpParser::PARSE_AGAIN){
             break;
         }
-        else if(static_cast<size_t>(len) > iov_[0].iov_len){      //iov_[0]传输完成
-            iov_[1].iov_base = (uint8_t*)iov_[1].iov_base + (len - iov_[0].iov_len);    //更新iov_[1]的iov_base指针
-            iov_[1].iov_len -= (len - iov_[0].iov_len);    //更新iov_[1]的iov_len
-            if(iov_[0].iov_len){
-                writeBuffer_.RetrieveAll();    //将iov_[0]中的数据从writeBuffer_中移除
-                iov_[0].iov_len = 0;
+        if(status == HttpParser::PARSE_OK && request.NeedsVerify()){
+            held_ = true;
+            if(handled > 0 || Verify_()){
+                break;
             }
         }
+        // 如果request解析成功，初始化response
+        if(status == HttpParser::PARSE_OK){
+            LOG_DEBUG("%.*s", (int)request.path().size(), request.path().data());
+            keepAlive_ = request.IsKeepAlive();
+            response.Init(SrcDir, request.path(), keepAlive_, 200);
+            response.SetRequest(&request);
+        }
+        // 如果request解析失败，初始化response，状态码为400
         else{
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len;    //更新iov_[0]的iov_base指针
-            iov_[0].iov_len -= len;    //更新iov_[0]的iov_len
-            writeBuffer_.Retrieve(len);    //将iov_[0]中的数据从writeBuffer_中移除
+            keepAlive_ = false;
+            response.Init(SrcDir, request.path(), false, 400);
         }
-    }while(isET || ToWriteBytes() > 10240);
-    return len;
+        ResponseRef cached = response.CachedResponse();
+        if(cached){
+            AppendCached_(std::move(cached));   //整包缓存命中，直接发送
+        }
+        else{
+            // 生成response的响应，响应头追加在writeBuffer中
+            size_t before = writeBuffer.ReadableBytes();
+            response.MakeResponse(writeBuffer);
+            size_t headLen = writeBuffer.ReadableBytes() - before;
+            response.CacheResponse(writeBuffer, before, headLen);
+            AppendResponse_(before, headLen);
+        }
+        Release_();
+        handled++;
+        if(!keepAlive_){    //连接将在发送后关闭，后面的请求不再处理
+            break;
+        }
+    }
+    if(handled == 0){
+        Shrink_();
+        return false;
+    }
+
+    LOG_DEBUG("%d responses, %d iovecs, %d bytes to write", handled, (int)ex_->iov.size(), (int)ToWriteBytes());
+    return true;
 }
 
-// 处理连接
-bool HttpConn::Process(){
-    // 初始化request_
-    request_.Init();
-    // 如果readBuffer_中没有可读字节，返回false
-    if(readBuffer_.ReadableBytes() <= 0){
+// 用户缓存命中时当场得出结果；有SqlNotifier时连接挂起，由调用方SubmitVerify交给数据库线程；否则在当前线程阻塞查询
+bool HttpConn::Verify_(){
+    bool ok;
+    if(UserCache::Instance()->Lookup(ex_->request.GetPost("username"), ex_->request.GetPost("password"), ex_->request.IsLogin(), &ok)){
+        ex_->request.SetVerified(ok);
         return false;
     }
-    // 如果request_解析成功，初始化response_
-    else if(request_.parse(readBuffer_)){
-        LOG_DEBUG("%s",request_.path().c_str());
-        response_.Init(SrcDir, request_.path(), request_.IsKeepAlive(), 200);
-    }
-    // 如果request_解析失败，初始化response_，状态码为400
-    else{
-        response_.Init(SrcDir, request_.path(), false, 400);
+    if(notifier_ && SqlAsync::Instance()->IsOpen()){
+        suspended_ = true;
+        LOG_DEBUG("Client[%d] suspended for verification", fd_);
+        return true;
     }
+    ex_->request.SetVerified(HttpRequest::UserVerify(ex_->request.GetPost("username"), ex_->request.GetPost("password"), ex_->request.IsLogin()));
+    return false;
+}
+
+// 结果以连接Key（代数<<32 | fd）投递，连接关闭或fd被复用后到达的结果由事件循环丢弃
+void HttpConn::SubmitVerify(){
+    assert(suspended_);
+    uint64_t key = (static_cast<uint64_t>(gen_) << 32) | static_cast<uint32_t>(fd_);
+    SqlAsync::Instance()->Verify(ex_->request.GetPost("username"), ex_->request.GetPost("password"), ex_->request.IsLogin(), notifier_, key);
+}
 
-    // 生成response_的响应
-    response_.MakeResponse(writeBuffer_);  
-    // 将writeBuffer_中的数据放入iov_中
-    iov_[0].iov_base = const_cast<char*>(writeBuffer_.Peek());
-    iov_[0].iov_len = writeBuffer_.ReadableBytes();
-    iovCnt_ = 1;
+bool HttpConn::Resume(bool ok){
+    assert(suspended_ && held_ && toWrite_ == 0);
+    suspended_ = false;
+    ex_->request.SetVerified(ok);
+    return Process();
+}
 
-    // 如果response_中有文件，将文件放入iov_中
-    if(response_.FileLen() > 0 && response_.File()){
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+void HttpConn::Release_(){
+    if(held_){
+        held_ = false;
+        Buffer& heldInput = ex_->heldInput;
+        if(heldInput.ReadableBytes() > 0){
+            readBuffer_.Append(heldInput);
+            heldInput.Release();
+        }
     }
+}
 
+void HttpConn::AppendCached_(ResponseRef response){
+    ex_->iov.push_back({ const_cast<char*>(response->data()), response->size() });
+    toWrite_ += response->size();
+    ex_->cached.push_back(std::move(response));
+}
 
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    // 返回true
-    return true;
+// writeBuffer追加时已写入的数据不会移动，响应头直接按块取出数据片，与前一个响应头相邻时合并为一段
+// 连接持有缓存文件的引用直到发送完成
+void HttpConn::AppendResponse_(size_t offset, size_t headLen){
+    HttpExchange* ex = ex_;
+    if(headLen > 0){
+        ex->writeBuffer.Slices(offset, headLen, ex->iov);
+        toWrite_ += headLen;
+    }
+    if(ex->response.FileLen() > 0 && ex->response.File()){
+        size_t fileLen = ex->response.FileLen();
+        ex->iov.push_back({ const_cast<char*>(ex->response.File()), fileLen });
+        ex->files.push_back(ex->response.DetachFile());
+        if(SendfileMin > 0 && fileLen >= SendfileMin){
+            ex->sendfiles.push_back({ ex->iov.size() - 1, ex->files.back().get() });
+        }
+        toWrite_ += fileLen;
+    }
 }
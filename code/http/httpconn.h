@@ -6,58 +6,109 @@
 #include <arpa/inet.h>   // 引入inet_ntoa函数,将网络地址转换为点分十进制字符串
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <vector>
 
 #include "../log/log.h"
 #include "../buffer/buffer.h"
+#include "../timer/timingwheel.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "../pool/sqlasync.h"
 
-/*进行读写数据并调用httprequest 来解析数据以及httpresponse来生成响应*/
+struct HttpExchange;  //一次请求/响应期间才需要的状态，定义在httpconn.cpp中
+
+/*进行读写数据并调用httprequest 来解析数据以及httpresponse来生成响应
+连接分为常驻的小部分和按需取用的HttpExchange：请求、响应、写缓冲区和待发送队列都在HttpExchange中，
+从线程本地的空闲链表取出，一批响应发完且读缓冲区中没有后续数据时连同缓冲区的块一起还回去*/
 
 class HttpConn{
 public:
     HttpConn();
     ~HttpConn();
 
-    void Init(int sockFd, const sockaddr_in& addr);  //sockaddr_in结构体用于存储网络地址
+    //sockaddr_in结构体用于存储网络地址；notifier非空时登录/注册异步查询数据库，结果投递到notifier
+    void Init(int sockFd, const sockaddr_in& addr, SqlNotifier* notifier = nullptr);
     ssize_t Read(int* saveErrno);
     ssize_t Write(int* saveErrno);
     void Close();
     int GetFd() const;
+    uint32_t GetGen() const { return gen_; }  //连接代数，每次Init/Close加一，用于识别过期的事件和定时器
     int GetPort() const;
     const char* GetIP() const;
     sockaddr_in GetAddr() const;
+    //处理读缓冲区中所有完整的请求（HTTP/1.1流水线），响应依次排入待发送队列，一次writev发出
+    //生成了至少一个响应时返回true，请求不完整或没有数据时返回false；只能在上一批响应发送完之后调用
     bool Process();
+    //登录/注册请求需要异步查询数据库，连接挂起：结果到达前Process不再处理请求，调用方也不应再读入数据
+    bool IsSuspended() const { return suspended_; }
+    //把挂起的查询提交给数据库线程。结果可能立即到达并在别的线程Resume，调用方须在不再访问本连接后调用
+    void SubmitVerify();
+    //数据库结果到达，完成被挂起的请求并继续处理其后的流水线请求，返回值同Process
+    bool Resume(bool ok);
+
+    /*供io_uring等完成式后端使用：数据由后端收发，HttpConn只负责缓冲和记账*/
+    void Feed(const char* data, size_t len);  //追加已收到的数据到读缓冲区
+    const struct iovec* WriteIov() const;  //待发送的数据，只在ToWriteBytes()大于0时有效
+    int WriteIovCnt() const;
+    void HasSent(size_t len);  //已发送len字节，更新iov_，全部发完后释放本批响应
     
     //获取待写数据长度
-    int ToWriteBytes() const{
-        return iov_[0].iov_len + iov_[1].iov_len;
+    size_t ToWriteBytes() const{
+        return toWrite_;
+    }
+
+    //嵌入的超时定时器节点，data指向本连接
+    WheelNode* TimerNode(){
+        return &timerNode_;
     }
 
-    // 判断是否保持连接
+    // 判断是否保持连接，取决于本批最后一个响应
     bool IsKeepAlive() const{
-        // 调用request_对象的IsKeepAlive()方法
-        return request_.IsKeepAlive();
+        return keepAlive_;
+    }
+
+    //连接空闲：没有待发送的响应、未解析完的请求和挂起的查询，请求/响应状态和缓冲区的块都已还回空闲链表
+    bool IsIdle() const{
+        return ex_ == nullptr && readBuffer_.ReadableBytes() == 0;
     }
 
+    static const int MAX_PIPELINE = 16;  //一次Process最多处理的流水线请求数
+    static const size_t POOL_MAX_EXCHANGES = 64;  //每个线程最多缓存的空闲请求/响应状态
+    static size_t PooledExchanges();  //本线程空闲链表中的请求/响应状态数
+
     static bool isET;  //是否为ET模式
+    static size_t SendfileMin;  //不小于该字节数的文件在epoll模式下用sendfile发送，0表示全部走writev
     static const char* SrcDir;  //源文件目录
     static std::atomic<int> UserCount;  //用户连接数,使用原子操作
 
 private:
+    void AppendResponse_(size_t offset, size_t headLen);  //把response的响应头（writeBuffer中从offset开始）和文件追加到待发送队列
+    void AppendCached_(ResponseRef response);  //把整包缓存中的响应追加到待发送队列
+    void ResetWrite_();   //释放已发送完的一批响应
+    void Shrink_();   //连接空闲时把请求/响应状态和读缓冲区的块还回去
+    ssize_t SendFile_(const struct iovec& v, const CachedFile* file);  //用sendfile发送iov中的一个文件段
+    bool Verify_();   //校验request中的登录/注册表单，需要异步查询时挂起并返回true
+    void Release_();  //request不再被挂起，把期间收到的数据接回读缓冲区
+
+    static HttpExchange* AcquireExchange_();
+    static void RecycleExchange_(HttpExchange* ex);
+
+    /*常驻部分：空闲的长连接只占这些*/
     int fd_;
     struct sockaddr_in addr_;
+    std::atomic<uint32_t> gen_;  //连接代数
+    WheelNode timerNode_;  //空闲超时定时器节点
 
     bool isClose_;
+    bool keepAlive_;
+    bool suspended_;   //等待数据库结果
+    bool held_;        //request中留有一个已解析、尚未响应的登录/注册请求，它的视图指向readBuffer_
+    size_t toWrite_;    //待发送的总字节数
+    SqlNotifier* notifier_;  //数据库结果的投递通道，为空时同步查询
 
-    int iovCnt_;
-    struct iovec iov_[2];  //iovec结构体用于存储读写数据
-
-    Buffer readBuffer_;  //读缓冲区
-    Buffer writeBuffer_; //写缓冲区
-
-    HttpRequest request_;  //http请求
-    HttpResponse response_;  //http响应
+    Buffer readBuffer_;  //读缓冲区，没有数据时不占块
+    HttpExchange* ex_;   //请求/响应状态，处理请求时取出，响应发完且没有后续数据时还回去
 };
 
 
@@ -0,0 +1,332 @@
+#include "httpparser.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "httpscan.h"
+
+using namespace std;
+
+
+namespace {
+
+struct NameId {
+    string_view name;
+    int id;
+};
+
+const NameId METHODS[] = {
+    { "GET", HttpParser::METHOD_GET },
+    { "HEAD", HttpParser::METHOD_HEAD },
+    { "POST", HttpParser::METHOD_POST },
+    { "PUT", HttpParser::METHOD_PUT },
+    { "DELETE", HttpParser::METHOD_DELETE },
+    { "OPTIONS", HttpParser::METHOD_OPTIONS },
+    { "PATCH", HttpParser::METHOD_PATCH },
+    { "TRACE", HttpParser::METHOD_TRACE },
+    { "CONNECT", HttpParser::METHOD_CONNECT },
+};
+
+const NameId HEADERS[] = {
+    { "Host", HttpParser::HEADER_HOST },
+    { "Connection", HttpParser::HEADER_CONNECTION },
+    { "Content-Length", HttpParser::HEADER_CONTENT_LENGTH },
+    { "Content-Type", HttpParser::HEADER_CONTENT_TYPE },
+    { "Transfer-Encoding", HttpParser::HEADER_TRANSFER_ENCODING },
+    { "Accept-Encoding", HttpParser::HEADER_ACCEPT_ENCODING },
+    { "Range", HttpParser::HEADER_RANGE },
+    { "If-Range", HttpParser::HEADER_IF_RANGE },
+    { "If-None-Match", HttpParser::HEADER_IF_NONE_MATCH },
+    { "If-Modified-Since", HttpParser::HEADER_IF_MODIFIED_SINCE },
+    { "Cookie", HttpParser::HEADER_COOKIE },
+    { "User-Agent", HttpParser::HEADER_USER_AGENT },
+};
+
+inline string_view Trim(const char* begin, const char* end) {
+    while(begin < end && (*begin == ' ' || *begin == '\t')) {
+        begin++;
+    }
+    while(end > begin && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    return string_view(begin, end - begin);
+}
+
+}
+
+
+void HttpParser::Reset() {
+    state_ = STATE_REQUEST_LINE;
+    base_ = nullptr;
+    parsed_ = 0;
+    method_ = METHOD_UNKNOWN;
+    methodStr_ = path_ = query_ = version_ = body_ = string_view();
+    headers_.clear();   // 保留容量，连接复用时不再分配
+    for(int i = 0; i < HEADER_KNOWN_COUNT; i++) {
+        known_[i] = string_view();
+    }
+    contentLength_ = 0;
+    consumed_ = 0;
+}
+
+
+// 逐行解析：请求行 -> 请求头 -> 空行 -> Content-Length字节的请求体
+// 每一行只扫描一遍，扫描内核在找分隔符的同时校验字符；只有完整的行才推进parsed_
+HttpParser::Status HttpParser::Parse(const char* begin, const char* end) {
+    if(state_ == STATE_DONE) {
+        return PARSE_OK;
+    }
+    if(base_ != begin) {
+        Rebase_(begin);
+    }
+    const char* p = begin + parsed_;
+    Status status = PARSE_OK;
+    if(state_ == STATE_REQUEST_LINE) {
+        while(p < end && (*p == '\r' || *p == '\n')) {   // 忽略请求之前多余的空行
+            p++;
+        }
+        status = ParseRequestLine_(p, end);
+        if(status == PARSE_OK) {
+            state_ = STATE_HEADERS;
+            parsed_ = p - begin;
+        }
+    }
+    while(status == PARSE_OK && state_ == STATE_HEADERS) {
+        if(p < end && (*p == '\r' || *p == '\n')) {
+            status = ParseLineEnd_(p, end);   // 空行，请求头结束
+            if(status == PARSE_OK) {
+                if(!HeadersDone_()) {
+                    return PARSE_ERROR;
+                }
+                state_ = STATE_BODY;
+                parsed_ = p - begin;
+            }
+            break;
+        }
+        status = ParseHeader_(p, end);
+        if(status == PARSE_OK) {
+            parsed_ = p - begin;
+        }
+    }
+    if(status == PARSE_AGAIN && state_ != STATE_BODY && static_cast<size_t>(end - begin) > MAX_HEAD_SIZE) {
+        return PARSE_ERROR;   // 请求头过大
+    }
+    if(status != PARSE_OK) {
+        return status;
+    }
+    p = begin + parsed_;
+    if(static_cast<size_t>(end - p) < contentLength_) {
+        return PARSE_AGAIN;   // 请求体还没收齐
+    }
+    body_ = string_view(p, contentLength_);
+    consumed_ = parsed_ + contentLength_;
+    state_ = STATE_DONE;
+    return PARSE_OK;
+}
+
+
+void HttpParser::Rebase_(const char* begin) {
+    if(base_ != nullptr) {
+        auto shift = [this, begin](string_view& v) {
+            if(v.data() != nullptr) {
+                v = string_view(begin + (reinterpret_cast<uintptr_t>(v.data()) - reinterpret_cast<uintptr_t>(base_)), v.size());
+            }
+        };
+        shift(methodStr_);
+        shift(path_);
+        shift(query_);
+        shift(version_);
+        for(Header& h : headers_) {
+            shift(h.name);
+            shift(h.value);
+        }
+        for(int i = 0; i < HEADER_KNOWN_COUNT; i++) {
+            shift(known_[i]);
+        }
+    }
+    base_ = begin;
+}
+
+
+// 行尾：CRLF或单独的LF，成功时p移到下一行开头
+HttpParser::Status HttpParser::ParseLineEnd_(const char*& p, const char* end) {
+    if(p == end) {
+        return PARSE_AGAIN;
+    }
+    if(*p == '\r') {
+        if(end - p < 2) {
+            return PARSE_AGAIN;
+        }
+        if(p[1] != '\n') {
+            return PARSE_ERROR;
+        }
+        p += 2;
+        return PARSE_OK;
+    }
+    if(*p == '\n') {
+        p++;
+        return PARSE_OK;
+    }
+    return PARSE_ERROR;
+}
+
+
+// 请求行：method SP request-target SP HTTP/x.y CRLF
+HttpParser::Status HttpParser::ParseRequestLine_(const char*& p, const char* end) {
+    const char* line = p;
+    const char* sp = HttpScan::FindTokenEnd(line, end);
+    if(sp == end) {
+        return PARSE_AGAIN;
+    }
+    if(sp == line || *sp != ' ') {
+        return PARSE_ERROR;
+    }
+    methodStr_ = string_view(line, sp - line);
+    method_ = LookupMethod(methodStr_);
+
+    const char* target = sp + 1;
+    sp = HttpScan::FindTargetEnd(target, end);
+    if(sp == end) {
+        return PARSE_AGAIN;
+    }
+    if(sp == target || *sp != ' ') {
+        return PARSE_ERROR;
+    }
+    const char* question = static_cast<const char*>(memchr(target, '?', sp - target));
+    if(question) {
+        path_ = string_view(target, question - target);
+        query_ = string_view(question + 1, sp - question - 1);
+    }
+    else {
+        path_ = string_view(target, sp - target);
+    }
+
+    const char* ver = sp + 1;
+    if(end - ver < 8) {
+        return memcmp(ver, "HTTP/", std::min<size_t>(end - ver, 5)) == 0 ? PARSE_AGAIN : PARSE_ERROR;
+    }
+    if(memcmp(ver, "HTTP/", 5) != 0 || ver[5] < '0' || ver[5] > '9' || ver[6] != '.' || ver[7] < '0' || ver[7] > '9') {
+        return PARSE_ERROR;
+    }
+    version_ = string_view(ver + 5, 3);
+    p = ver + 8;
+    return ParseLineEnd_(p, end);
+}
+
+
+// 请求头：field-name ":" OWS field-value OWS CRLF
+HttpParser::Status HttpParser::ParseHeader_(const char*& p, const char* end) {
+    if(headers_.size() >= MAX_HEADERS) {
+        return PARSE_ERROR;
+    }
+    const char* line = p;
+    const char* colon = HttpScan::FindTokenEnd(line, end);
+    if(colon == end) {
+        return PARSE_AGAIN;
+    }
+    if(colon == line || *colon != ':') {   // 名字为空、含非法字符或名字与冒号间有空白
+        return PARSE_ERROR;
+    }
+    const char* valueEnd = HttpScan::FindValueEnd(colon + 1, end);
+    p = valueEnd;
+    Status status = ParseLineEnd_(p, end);
+    if(status != PARSE_OK) {
+        return status;
+    }
+    string_view name(line, colon - line);
+    string_view value = Trim(colon + 1, valueEnd);
+    HeaderId id = LookupHeader(name);
+    if(id < HEADER_KNOWN_COUNT) {
+        if(id == HEADER_CONTENT_LENGTH && !known_[id].empty() && known_[id] != value) {
+            return PARSE_ERROR;   // 多个不一致的Content-Length
+        }
+        known_[id] = value;
+    }
+    headers_.push_back({ name, value, id });
+    return PARSE_OK;
+}
+
+
+bool HttpParser::HeadersDone_() {
+    if(!known_[HEADER_TRANSFER_ENCODING].empty()) {
+        return false;   // 不支持分块传输的请求体
+    }
+    string_view len = known_[HEADER_CONTENT_LENGTH];
+    if(len.empty()) {
+        return true;
+    }
+    size_t n = 0;
+    for(char ch : len) {
+        if(ch < '0' || ch > '9' || n > (SIZE_MAX - 9) / 10) {
+            return false;
+        }
+        n = n * 10 + (ch - '0');
+    }
+    if(n > MAX_BODY_SIZE) {
+        return false;
+    }
+    contentLength_ = n;
+    return true;
+}
+
+
+// HTTP/1.1默认长连接，除非Connection: close；HTTP/1.0需要显式的Connection: keep-alive
+bool HttpParser::IsKeepAlive() const {
+    string_view conn = known_[HEADER_CONNECTION];
+    if(version_ == "1.1") {
+        return !HasToken(conn, "close");
+    }
+    return HasToken(conn, "keep-alive");
+}
+
+
+string_view HttpParser::GetHeader(string_view name) const {
+    HeaderId id = LookupHeader(name);
+    if(id < HEADER_KNOWN_COUNT) {
+        return known_[id];
+    }
+    for(const Header& h : headers_) {
+        if(EqualsIgnoreCase(h.name, name)) {
+            return h.value;
+        }
+    }
+    return string_view();
+}
+
+
+HttpParser::Method HttpParser::LookupMethod(string_view name) {
+    for(const NameId& m : METHODS) {
+        if(m.name == name) {   // 方法名区分大小写
+            return static_cast<Method>(m.id);
+        }
+    }
+    return METHOD_UNKNOWN;
+}
+
+HttpParser::HeaderId HttpParser::LookupHeader(string_view name) {
+    for(const NameId& h : HEADERS) {
+        if(h.name.size() == name.size() && EqualsIgnoreCase(h.name, name)) {
+            return static_cast<HeaderId>(h.id);
+        }
+    }
+    return HEADER_OTHER;
+}
+
+bool HttpParser::EqualsIgnoreCase(string_view a, string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+bool HttpParser::HasToken(string_view list, string_view token) {
+    size_t start = 0;
+    while(start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if(comma == string_view::npos) {
+            comma = list.size();
+        }
+        if(EqualsIgnoreCase(Trim(list.data() + start, list.data() + comma), token)) {
+            return true;
+        }
+        start = comma + 1;
+    }
+    return false;
+}
@@ -0,0 +1,119 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <string_view>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/*零拷贝的HTTP/1.1请求解析器
+手写状态机直接扫描缓冲区中的字节，不使用正则，也不把每一行拷贝成string，
+分隔符查找和字符校验由HttpScan的SIMD内核在同一遍中完成：
+方法、路径、版本、请求头的名字和值都是指向原缓冲区的string_view。
+方法和常用请求头解析时即转换为枚举，常用请求头可以按HeaderId直接取值。
+解析可以跨多次读入续接：每次只提交完整的行，不完整时返回PARSE_AGAIN并记住进度，
+下次从同一请求的起始位置再调用即可（缓冲区被移动过也没关系，已有视图会重新定位）。
+请求体要收齐Content-Length个字节才算完整。视图只在原缓冲区被改写之前有效*/
+
+class HttpParser {
+public:
+    enum Method {
+        METHOD_UNKNOWN,
+        METHOD_GET,
+        METHOD_HEAD,
+        METHOD_POST,
+        METHOD_PUT,
+        METHOD_DELETE,
+        METHOD_OPTIONS,
+        METHOD_PATCH,
+        METHOD_TRACE,
+        METHOD_CONNECT
+    };
+
+    enum HeaderId {
+        HEADER_HOST,
+        HEADER_CONNECTION,
+        HEADER_CONTENT_LENGTH,
+        HEADER_CONTENT_TYPE,
+        HEADER_TRANSFER_ENCODING,
+        HEADER_ACCEPT_ENCODING,
+        HEADER_RANGE,
+        HEADER_IF_RANGE,
+        HEADER_IF_NONE_MATCH,
+        HEADER_IF_MODIFIED_SINCE,
+        HEADER_COOKIE,
+        HEADER_USER_AGENT,
+        HEADER_KNOWN_COUNT,      // 常用请求头的个数
+        HEADER_OTHER = HEADER_KNOWN_COUNT
+    };
+
+    enum Status {
+        PARSE_OK,       // 解析出一个完整请求
+        PARSE_AGAIN,    // 数据不完整
+        PARSE_ERROR     // 请求格式错误
+    };
+
+    struct Header {
+        std::string_view name;
+        std::string_view value;
+        HeaderId id;
+    };
+
+    enum State {
+        STATE_REQUEST_LINE,   // 解析请求行
+        STATE_HEADERS,        // 解析请求头
+        STATE_BODY,           // 等待请求体
+        STATE_DONE            // 解析完成
+    };
+
+    static const size_t MAX_HEADERS = 64;   // 单个请求最多的请求头数
+    static const size_t MAX_HEAD_SIZE = 64 * 1024;   // 请求行加请求头的最大字节数
+    static const size_t MAX_BODY_SIZE = 1024 * 1024;   // 请求体的最大字节数
+
+    HttpParser() { Reset(); }
+
+    void Reset();
+    Status Parse(const char* begin, const char* end);   // 解析从begin开始的请求，续接上次的进度
+    State GetState() const { return state_; }
+    bool Done() const { return state_ == STATE_DONE; }
+    size_t Consumed() const { return consumed_; }   // 已解析请求占用的字节数（含请求体）
+
+    Method GetMethod() const { return method_; }
+    std::string_view MethodStr() const { return methodStr_; }
+    std::string_view Path() const { return path_; }        // 不含查询串
+    std::string_view Query() const { return query_; }      // '?'之后的部分
+    std::string_view Version() const { return version_; }  // 如"1.1"
+    std::string_view Body() const { return body_; }
+    size_t ContentLength() const { return contentLength_; }
+    bool IsKeepAlive() const;
+
+    const std::vector<Header>& Headers() const { return headers_; }
+    std::string_view GetHeader(HeaderId id) const { return id < HEADER_KNOWN_COUNT ? known_[id] : std::string_view(); }
+    std::string_view GetHeader(std::string_view name) const;   // 名字不区分大小写
+
+    static Method LookupMethod(std::string_view name);
+    static HeaderId LookupHeader(std::string_view name);
+    static bool EqualsIgnoreCase(std::string_view a, std::string_view b);
+    static bool HasToken(std::string_view list, std::string_view token);   // 逗号分隔的列表中是否有token（不区分大小写）
+
+private:
+    //解析成功时p前进到下一行开头
+    Status ParseRequestLine_(const char*& p, const char* end);
+    Status ParseHeader_(const char*& p, const char* end);
+    static Status ParseLineEnd_(const char*& p, const char* end);
+    bool HeadersDone_();
+    void Rebase_(const char* begin);   //缓冲区移动后把已有视图平移到新位置
+
+    State state_;
+    const char* base_;   // 上次解析时请求的起始地址
+    size_t parsed_;      // 已完整解析的字节数（相对请求起始）
+
+    Method method_;
+    std::string_view methodStr_, path_, query_, version_, body_;
+    std::vector<Header> headers_;
+    std::string_view known_[HEADER_KNOWN_COUNT];
+    size_t contentLength_;
+    size_t consumed_;
+};
+
+#endif // HTTP_PARSER_H
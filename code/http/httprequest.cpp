@@ -4,82 +4,57 @@ using namespace std;
 
 
 //网页名称，和一般的前端跳转不同，这里需要将请求信息封装成http请求，发送给服务器，再上传给前端
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
+const unordered_set<string_view> HttpRequest::DEFAULT_HTML{
     "/index", "/register", "/login", "/welcome", "/video", "/picture"
 };
 
 //登录注册页面
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG{
+const unordered_map<string_view, int> HttpRequest::DEFAULT_HTML_TAG{
     {"/register.html", 0}, {"/login.html", 1}
 };
 
 
 //初始化
 void HttpRequest::Init() {
-    state_ = REQUEST_LINE;
-    method_ = path_ = version_ = body_ = "";
-    header_.clear();
-    post_.clear();
+    parser_.Reset();
+    path_ = string_view();
+    arena_.Reset();
+    post_.clear();   //保留容量
+    verifyTag_ = -1;
 }
 
-//解析http请求
-bool HttpRequest::parse(Buffer& buff){
-    const char END[] = "\r\n";
-    if(buff.ReadableBytes() == 0)  //如果缓冲区为空，则返回false
+//解析http请求：请求行、请求头和请求体都由parser_在缓冲区上原地解析，不拷贝
+//请求完整之前不从缓冲区取走任何字节，下一次从同一起始位置续接
+HttpParser::Status HttpRequest::parse(Buffer& buff){
+    if(parser_.Done())  //上一个请求已经处理完，开始解析新的请求
     {
-        return false;
+        Init();
     }
-    while(buff.ReadableBytes() && state_ != FINISH)
+    if(buff.ReadableBytes() == 0)  //如果缓冲区为空，等待数据
     {
-        // 从buff中的读指针开始到读指针结束，这块区域是未读取得数据并去处"\r\n"，返回有效数据得行末指针
-        const char* line_end = search(buff.Peek(), buff.BeginWritePtr(), END, END + 2);  //
-        string line(buff.Peek(), line_end);
-        switch (state_)
-        {
-        case REQUEST_LINE:
-            if(!ParseRequestLine(line)){
-                return false;
-            }
-            ParsePath();    //解析路径
-            break;
-        case HEADERS:
-            ParseHeader(line);
-            if(buff.ReadableBytes() <= 2)     //如果缓冲区中只剩下"\r\n"，则说明是get请求，直接结束，get可以没有请求体
-            {
-                state_ = FINISH;
-            }
-            break;
-        case BODY:
-            ParseBody(line);
-            break;
-        default:
-            break;
-        }
-        if(line_end == buff.BeginWritePtr())  //如果line_end == buff.BeginWritePtr()，说明没有找到"\r\n"，则读完了
-        {
-            buff.RetrieveAll();
-            break;
-        }
-        buff.RetrieveUntil(line_end + 2);  //跳过回车换行
+        return HttpParser::PARSE_AGAIN;
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
-}
-
-//解析请求行
-bool HttpRequest::ParseRequestLine(const string& line) {
-    regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");  //在匹配规则中，以括号括起来的部分，就是匹配结果
-    smatch Match;    //匹配结果
-    if(regex_match(line, Match, pattern))  //匹配成功
+    const char* begin = buff.Peek();   //请求跨块时Peek先把它合并成连续的一段，解析器据此平移已有视图
+    HttpParser::Status status = parser_.Parse(begin, begin + buff.ReadableBytes());
+    if(status == HttpParser::PARSE_AGAIN)
     {
-        method_ = Match[1];
-        path_ = Match[2];
-        version_ = Match[3];
-        state_ = HEADERS;
-        return true;
+        LOG_DEBUG("Request incomplete, %d bytes buffered", (int)buff.ReadableBytes());
+        return status;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    if(status == HttpParser::PARSE_ERROR)
+    {
+        LOG_ERROR("Request Error");
+        buff.RetrieveAll();
+        return status;
+    }
+    path_ = parser_.Path();
+    ParsePath();    //解析路径
+    ParsePost();
+    // 只移动读指针，不清空数据，视图在下一次读入前仍然有效
+    buff.Retrieve(parser_.Consumed());
+    LOG_DEBUG("[%.*s], [%.*s], [%.*s]", (int)parser_.MethodStr().size(), parser_.MethodStr().data(),
+              (int)path_.size(), path_.data(), (int)parser_.Version().size(), parser_.Version().data());
+    return HttpParser::PARSE_OK;
 }
 
 
@@ -91,62 +66,42 @@ void HttpRequest::ParsePath() {
     }
     else if(DEFAULT_HTML.count(path_))  //如果路径在默认网页中，则加上.html后缀
     {
-        path_ += ".html";
+        char* p = arena_.Allocate(path_.size() + 5);
+        memcpy(p, path_.data(), path_.size());
+        memcpy(p + path_.size(), ".html", 5);
+        path_ = string_view(p, path_.size() + 5);
     }
 }
 
 
-
-//解析请求头
-void HttpRequest::ParseHeader(const string& line) {
-    regex pattern("^([^:]*): ?(.*)$");
-    smatch Match;
-    if(regex_match(line, Match, pattern))
-    {
-        header_[Match[1]] = Match[2];
-    }
-    else    //如果匹配失败，说明已经读到请求体了
-    {
-        state_ = BODY;
-    }
-}
-
-
-//解析请求体
-void HttpRequest::ParseBody(const string& line) {
-    body_ = line;
-    ParsePost();
-    state_ = FINISH;
-    LOG_DEBUG("Body: %s, len = %d", body_.c_str(), body_.size());
-}
-
 //解析post请求体
 void HttpRequest::ParsePost() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded")
+    string_view type = parser_.GetHeader(HttpParser::HEADER_CONTENT_TYPE);
+    type = type.substr(0, type.find(';'));   //忽略charset等参数
+    if(parser_.GetMethod() == HttpParser::METHOD_POST && HttpParser::EqualsIgnoreCase(type, "application/x-www-form-urlencoded"))
     {
+        LOG_DEBUG("Body: %.*s, len = %d", (int)parser_.Body().size(), parser_.Body().data(), (int)parser_.Body().size());
         ParseFromUrlencoded();  //Post请求，且请求头中Content-Type为application/x-www-form-urlencoded，则解析请求体
-        if(DEFAULT_HTML_TAG.count(path_))  //如果请求路径在为登录/注册
+        auto it = DEFAULT_HTML_TAG.find(path_);
+        if(it != DEFAULT_HTML_TAG.end())  //如果请求路径在为登录/注册
         {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1)
-            {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin))
-                {
-                    path_ = "/welcome.html";
-                }
-                else
-                {
-                    path_ = "/error.html";
-                }
-            }
+            verifyTag_ = it->second;   //登录/注册，查询数据库之后再决定路径
+            LOG_DEBUG("Tag:%d", verifyTag_);
         }
     }
 }
 
-//16进制转10进制
+void HttpRequest::SetVerified(bool ok) {
+    path_ = ok ? "/welcome.html" : "/error.html";
+    verifyTag_ = -1;
+}
+
+//16进制转10进制，不是16进制字符返回-1
 int HttpRequest::ConverHex(char ch) {
+    if(ch >= '0' && ch <= '9')
+    {
+        return ch - '0';
+    }
     if(ch >= 'a' && ch <= 'f')
     {
         return ch - 'a' + 10;
@@ -155,180 +110,315 @@ int HttpRequest::ConverHex(char ch) {
     {
         return ch - 'A' + 10;
     }
-    return ch;
+    return -1;
 }
 
 
-//解析url编码
+//解析url编码：key1=value1&key2=value2，'+'为空格，%XX为转义字节
+// 解码后的字段不会比原文长，一次从arena_中取出与请求体等长的空间，键和值依次解码进去
 void HttpRequest::ParseFromUrlencoded() {
-    if(body_.size() == 0)
+    string_view body = parser_.Body();
+    if(body.size() == 0)
     {
         return;
     }
-    string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-    for(; i < n; i++)
+    char* out = arena_.Allocate(body.size());
+    char* start = out;   //当前键或值的起点
+    string_view key;
+    bool inKey = true;
+    size_t n = body.size();
+    for(size_t i = 0; i <= n; i++)
     {
-        char ch = body_[i];
+        if(i == n || body[i] == '&')
+        {
+            string_view cur(start, out - start);
+            if(inKey)
+            {
+                key = cur;
+                cur = string_view();
+            }
+            if(!key.empty())
+            {
+                LOG_DEBUG("%.*s = %.*s", (int)key.size(), key.data(), (int)cur.size(), cur.data());
+                post_.emplace_back(key, cur);
+            }
+            start = out;
+            inKey = true;
+            continue;
+        }
+        char ch = body[i];
         switch(ch)    //根据不同的字符进行不同的处理
         {
         case '=':
-            key = body_.substr(j, i - j);
-            j = i + 1;
+            if(inKey)
+            {
+                key = string_view(start, out - start);
+                start = out;
+                inKey = false;
+            }
+            else
+            {
+                *out++ = ch;
+            }
             break;
         case '+':
-            body_[i] = ' ';  //将+替换为空格
+            *out++ = ' ';  //将+替换为空格
             break;
         case '%':
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
-            break;
-        case '&':
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
+            if(i + 2 < n && ConverHex(body[i + 1]) >= 0 && ConverHex(body[i + 2]) >= 0)
+            {
+                *out++ = static_cast<char>(ConverHex(body[i + 1]) * 16 + ConverHex(body[i + 2]));
+                i += 2;
+            }
+            else
+            {
+                *out++ = ch;
+            }
             break;
         default:
+            *out++ = ch;
             break;
         }
     }
-    assert(j <= i);
-    if(post_.count(key) == 0 && j < i)
-    {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
-        LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-    }
 }
 
-// 用户验证
+// 用户验证：语句在每条连接上只预编译一次，用户名和密码作为参数绑定执行，不拼接SQL
 bool HttpRequest::UserVerify(const string& name, const string& pwd, bool isLogin) {
     if(name == "" || pwd == "")
     {
         return false;
     }
-    LOG_INFO("Verify name = %s, pwd = %s", name.c_str(), pwd.c_str());
+    LOG_INFO("Verify name = %s", name.c_str());
+    SqlConnPool* pool = SqlConnPool::Instance();
     MYSQL* sql;
-    LOG_INFO("开始获取数据库连接");
-    SqlConnRAII(SqlConnPool::Instance(),&sql);
-    LOG_INFO("获取数据库连接完成,sql指针: %p", sql);
+    SqlConnRAII guard(pool, &sql);   //持有连接直到函数返回
     if(sql == nullptr) {
         LOG_ERROR("数据库连接获取失败");
         return false;
     }
-    LOG_INFO("数据库连接验证成功");
-    assert(sql);
-
-    bool flag = false;
-    char order[256] = {0};
-    MYSQL_FIELD* fields = nullptr;  //字段
-    MYSQL_RES* res_ptr = nullptr;   //结果集
 
-    if(!isLogin) flag = true;  //注册
-    //查询用户名是否存在
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());   //查询语句的含义是：在user表中，查询username为name的用户，且只返回一条记录
-    LOG_DEBUG("%s", order);
-
-    if(mysql_query(sql, order))  //执行查询语句，如果失败，则返回非零值
-    {
-        LOG_ERROR("SQL查询执行失败: %s", mysql_error(sql));
-        mysql_free_result(res_ptr);  //释放结果集
-        LOG_ERROR("Query Error: %s", mysql_error(sql));
-        return false;
-    }
-    res_ptr = mysql_store_result(sql);  //将查询结果存储到结果集中
-    fields = mysql_fetch_fields(res_ptr);  //获取结果集中的字段
-
-    while(MYSQL_ROW row = mysql_fetch_row(res_ptr))  //遍历结果集中的每一行
+    UserCache* cache = UserCache::Instance();
+    UserStmtBind bind;
+    bool found = false, match = false;
+    //查询用户名是否存在；连接断开时重连并重新预编译，再试一次。注册时Bloom过滤器确定不存在则跳过
+    bool skipSelect = !isLogin && !cache->MayExist(name);
+    for(int retry = 0; !skipSelect; retry++)
     {
-        LOG_DEBUG("username = %s, password = %s", row[0], row[1]);
-        string password(row[1]);
-        //登录行为，验证密码是否正确
-        if(isLogin)
+        MYSQL_STMT* stmt = pool->GetStmt(sql, STMT_SELECT_USER);
+        if(!stmt)
+        {
+            return false;
+        }
+        if(bind.BindParams(stmt, name, nullptr) && mysql_stmt_execute(stmt) == 0 && mysql_stmt_store_result(stmt) == 0)
         {
-            if(pwd == password)
+            match = bind.FetchUser(stmt, pwd, &found);
+            if(bind.pwdValid)
             {
-                flag = true;
+                cache->Put(name, bind.pwd, bind.pwdLen);
             }
-            else
+            else if(!found)
             {
-                flag = false;
-                LOG_INFO("Password is not correct");
+                cache->Erase(name);
             }
+            break;
         }
-        else
+        LOG_ERROR("Query Error: %s", mysql_stmt_error(stmt));
+        if(retry > 0 || !SqlConnPool::IsStmtLost(mysql_stmt_errno(stmt)))
         {
-            flag = false;
-            LOG_INFO("User already exists");
+            return false;
         }
-
+        pool->ResetStmts(sql);
     }
-    mysql_free_result(res_ptr);  //释放结果集
 
-    if(!isLogin && flag == true)  //注册行为，且用户名不存在,将用户名和密码插入到数据库中
+    if(isLogin)
     {
-        LOG_DEBUG("Regirster!");
-        bzero(order, 256);
-        snprintf(order, 256, "INSERT INTO user(username, password) VALUES('%s', '%s')", name.c_str(), pwd.c_str());
-        if(mysql_query(sql, order))
+        if(!match)
         {
-            LOG_ERROR("Insert Error: %s", mysql_error(sql));
-            flag = false;
-        }
-        else
-        {
-            flag = true;
+            LOG_INFO("Password is not correct");
         }
+        return match;
     }
-    LOG_INFO("UserVerify success");
-    return flag;
+    if(found)
+    {
+        LOG_INFO("User already exists");
+        return false;
+    }
+    //注册：只在用户名不存在时插入；插入不重试，连接断开时无法确定是否已经插入
+    LOG_DEBUG("Regirster!");
+    MYSQL_STMT* stmt = pool->GetStmt(sql, STMT_INSERT_USER);
+    if(!stmt)
+    {
+        return false;
+    }
+    if(!bind.BindParams(stmt, name, &pwd) || mysql_stmt_execute(stmt) != 0)
+    {
+        LOG_ERROR("Insert Error: %s", mysql_stmt_error(stmt));
+        return false;
+    }
+    if(mysql_stmt_affected_rows(stmt) != 1)
+    {
+        LOG_INFO("User already exists");
+        return false;
+    }
+    cache->Put(name, pwd.data(), pwd.size());   //写穿
+    return true;
 }
 
-string HttpRequest::path() const{
+string_view HttpRequest::path() const{
     return path_;
 }
 
-string& HttpRequest::path(){
-    return path_;
+string_view HttpRequest::method() const{
+    return parser_.MethodStr();
 }
 
-string HttpRequest::method() const{
-    return method_;
+string_view HttpRequest::version() const{
+    return parser_.Version();
 }
 
-string HttpRequest::version() const{
-    return version_;
+string_view HttpRequest::PostView(string_view key) const{
+    for(auto it = post_.rbegin(); it != post_.rend(); ++it)
+    {
+        if(it->first == key)
+        {
+            return it->second;
+        }
+    }
+    return string_view();
 }
 
 string HttpRequest::GetPost(const string& key) const{
     assert(key != "");
-    if(post_.count(key) == 1)
-    {
-        return post_.find(key)->second;
-    }
-    return "";
+    return string(PostView(key));
 }
 
 string HttpRequest::GetPost(const char* key) const{
     assert(key != nullptr);
-    if(post_.count(key) == 1)
+    return string(PostView(key));
+}
+
+bool HttpRequest::IsKeepAlive() const{
+    return parser_.IsKeepAlive();
+}
+
+bool HttpRequest::IsConditional() const{
+    return !parser_.GetHeader(HttpParser::HEADER_IF_NONE_MATCH).empty() ||
+           !parser_.GetHeader(HttpParser::HEADER_IF_MODIFIED_SINCE).empty();
+}
+
+bool HttpRequest::IsNotModified(string_view etag, time_t mtime) const{
+    string_view noneMatch = parser_.GetHeader(HttpParser::HEADER_IF_NONE_MATCH);
+    if(!noneMatch.empty())
+    {
+        return MatchETag(noneMatch, etag);   //有If-None-Match时忽略If-Modified-Since
+    }
+    HttpParser::Method method = parser_.GetMethod();
+    string_view since = parser_.GetHeader(HttpParser::HEADER_IF_MODIFIED_SINCE);
+    time_t t = 0;
+    if((method != HttpParser::METHOD_GET && method != HttpParser::METHOD_HEAD) || since.empty() || !ParseHttpDate(since, &t))
     {
-        return post_.find(key)->second;
+        return false;   //无法识别的日期按没有该请求头处理
     }
-    return "";
+    return mtime <= t;
 }
 
-bool HttpRequest::IsKeepAlive() const{
-    if(header_.count("Connection") == 1)
+bool HttpRequest::MatchETag(string_view list, string_view etag){
+    auto opaque = [](string_view tag) {   //弱比较忽略W/前缀
+        if(tag.size() >= 2 && tag[0] == 'W' && tag[1] == '/')
+        {
+            tag.remove_prefix(2);
+        }
+        return tag;
+    };
+    etag = opaque(etag);
+    size_t start = 0;
+    while(start < list.size())
     {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+        size_t comma = list.find(',', start);
+        if(comma == string_view::npos)
+        {
+            comma = list.size();
+        }
+        string_view tag = list.substr(start, comma - start);
+        while(!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) tag.remove_prefix(1);
+        while(!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) tag.remove_suffix(1);
+        if(tag == "*" || (!tag.empty() && opaque(tag) == etag))
+        {
+            return true;
+        }
+        start = comma + 1;
     }
     return false;
 }
 
+bool HttpRequest::AcceptsEncoding(string_view coding) const{
+    auto trim = [](string_view v) {
+        while(!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+        while(!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+        return v;
+    };
+    // q=0、q=0.0、q=0.000等表示不接受，其余q值都视为接受
+    auto refused = [&trim](string_view params) {
+        size_t q = params.find("q=");
+        if(q == string_view::npos)
+        {
+            return false;
+        }
+        string_view value = trim(params.substr(q + 2));
+        if(value.empty() || value[0] != '0')
+        {
+            return false;
+        }
+        for(size_t i = 1; i < value.size(); i++)
+        {
+            if(value[i] != '.' && value[i] != '0')
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    string_view list = parser_.GetHeader(HttpParser::HEADER_ACCEPT_ENCODING);
+    int any = -1;   //"*"的结果，-1为未出现
+    size_t start = 0;
+    while(start < list.size())
+    {
+        size_t comma = list.find(',', start);
+        if(comma == string_view::npos)
+        {
+            comma = list.size();
+        }
+        string_view item = list.substr(start, comma - start);
+        size_t semi = item.find(';');
+        string_view name = trim(item.substr(0, semi));
+        string_view params = semi == string_view::npos ? string_view() : item.substr(semi + 1);
+        if(HttpParser::EqualsIgnoreCase(name, coding))
+        {
+            return !refused(params);
+        }
+        if(name == "*")
+        {
+            any = refused(params) ? 0 : 1;
+        }
+        start = comma + 1;
+    }
+    return any == 1;
+}
 
+bool HttpRequest::ParseHttpDate(string_view date, time_t* t){
+    char buf[64];
+    if(date.size() >= sizeof(buf))
+    {
+        return false;
+    }
+    memcpy(buf, date.data(), date.size());
+    buf[date.size()] = '\0';
+    struct tm tm = {};
+    const char* end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);   //只接受IMF-fixdate
+    if(end == nullptr || *end != '\0')
+    {
+        return false;
+    }
+    *t = timegm(&tm);
+    return true;
+}
@@ -3,60 +3,74 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <unordered_set>
-#include <regex>
+#include <vector>
 #include <mysql/mysql.h>
 #include <errno.h>
+#include <time.h>
 
 #include "../buffer/buffer.h"
+#include "../buffer/arena.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
+#include "../pool/usercache.h"
+#include "httpparser.h"
 
 
 using namespace std;
 
 class HttpRequest{
 public:
-    enum PARSE_STATE{
-        REQUEST_LINE,     // 解析请求行状态
-        HEADERS,         // 解析请求头状态  
-        BODY,            // 解析请求体状态
-        FINISH           // 解析完成状态    
-    };
-    
     HttpRequest() {Init();}
     ~HttpRequest() = default;
 
     void Init();
-    bool parse(Buffer& buff);  // 解析http请求
+    //解析http请求，请求不完整时返回PARSE_AGAIN，已解析的进度和缓冲区中的数据都保留，读到更多数据后再次调用即可
+    HttpParser::Status parse(Buffer& buff);
+    HttpParser::State state() const { return parser_.GetState(); }
 
-    string path() const;  // 获取请求路径
-    string& path();      //
-    string method() const;  // 获取请求方法
-    string version() const;   // 获取http版本
-    string GetPost(const string& key) const;   // 获取post请求参数
+    //以下视图指向读缓冲区，在下一次读入之前有效
+    string_view path() const;  // 获取请求路径
+    string_view method() const;  // 获取请求方法
+    string_view version() const;   // 获取http版本
+    string_view GetHeader(HttpParser::HeaderId id) const { return parser_.GetHeader(id); }
+    string_view GetHeader(string_view name) const { return parser_.GetHeader(name); }
+    string GetPost(const string& key) const;   // 获取post请求参数，没有时返回空串
     string GetPost(const char* key) const; 
+    string_view PostView(string_view key) const;   // 同上，不拷贝，视图在下一个请求开始前有效
     
     bool IsKeepAlive() const;  // 是否保持连接
+
+    //条件请求（RFC 7232）：If-None-Match优先，否则GET/HEAD看If-Modified-Since
+    bool IsConditional() const;
+    bool IsNotModified(string_view etag, time_t mtime) const;   //资源未变化，可以返回304
+    static bool MatchETag(string_view list, string_view etag);   //弱比较，list为逗号分隔的ETag或"*"
+    static bool ParseHttpDate(string_view date, time_t* t);
+
+    //Accept-Encoding是否接受coding（q值大于0，或未列出但"*"可接受）
+    bool AcceptsEncoding(string_view coding) const;
+
+    //登录/注册表单需要查询数据库，parse只记录下来，由调用方（同步或异步）校验后调用SetVerified
+    bool NeedsVerify() const { return verifyTag_ >= 0; }
+    bool IsLogin() const { return verifyTag_ == 1; }
+    void SetVerified(bool ok);   //根据校验结果把路径改为欢迎页或错误页
+
+    static bool UserVerify(const string& username, const string& password, bool isLogin);   // 阻塞地验证用户名密码
     
 private:
-    bool ParseRequestLine(const string& line);     // 解析请求行
-    void ParseHeader(const string& line);         // 解析请求头
-    void ParseBody(const string& line);            // 解析请求体
-
     void ParsePath();    // 解析请求路径
     void ParsePost();            // 处理post事件
     void ParseFromUrlencoded();   // 解析url编码
 
-    static bool UserVerify(const string& username, const string& password, bool isLogin);   // 验证用户名密码
-
-    PARSE_STATE state_;  // 解析状态
-    string method_, path_, version_, body_;
-    unordered_map<string, string> header_;  // 请求头
-    unordered_map<string, string> post_;
+    HttpParser parser_;  // 请求行和请求头由parser_零拷贝解析
+    string_view path_;   // 指向读缓冲区，路径被改写时指向arena_或字面量
+    Arena arena_;   // 本请求解码、改写出的字符串，下一个请求开始时整体收回
+    vector<pair<string_view, string_view>> post_;   // 表单字段，指向arena_；字段很少，顺序查找，同名时后者为准
+    int verifyTag_;   // 待校验的表单：-1无，0注册，1登录
 
-    static const unordered_set<string> DEFAULT_HTML;  // 默认html文件
-    static const unordered_map<string, int> DEFAULT_HTML_TAG;  // 默认html文件后缀
+    static const unordered_set<string_view> DEFAULT_HTML;  // 默认html文件
+    static const unordered_map<string_view, int> DEFAULT_HTML_TAG;  // 默认html文件后缀
     static int ConverHex(char ch);  // 将16进制字符转换为10进制数字
 };
 
@@ -1,35 +1,53 @@
 #include "httpresponse.h"
+#include "httprequest.h"
 
 using namespace std;
 
-const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
-    { ".html",  "text/html" },
-    { ".xml",   "text/xml" },
-    { ".xhtml", "application/xhtml+xml" },
-    { ".txt",   "text/plain" },
-    { ".rtf",   "application/rtf" },
-    { ".pdf",   "application/pdf" },
-    { ".word",  "application/nsword" },
-    { ".png",   "image/png" },
-    { ".gif",   "image/gif" },
-    { ".jpg",   "image/jpeg" },
-    { ".jpeg",  "image/jpeg" },
-    { ".au",    "audio/basic" },
-    { ".mpeg",  "video/mpeg" },
-    { ".mpg",   "video/mpeg" },
-    { ".avi",   "video/x-msvideo" },
-    { ".gz",    "application/x-gzip" },
-    { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
+unordered_map<string, HttpResponse::FileType> HttpResponse::SUFFIX_TYPE = {
+    { ".html",  { "text/html", 0 } },
+    { ".xml",   { "text/xml", 0 } },
+    { ".xhtml", { "application/xhtml+xml", 0 } },
+    { ".txt",   { "text/plain", 0 } },
+    { ".rtf",   { "application/rtf", 3600 } },
+    { ".pdf",   { "application/pdf", 3600 } },
+    { ".word",  { "application/nsword", 3600 } },
+    { ".png",   { "image/png", 86400 } },
+    { ".gif",   { "image/gif", 86400 } },
+    { ".jpg",   { "image/jpeg", 86400 } },
+    { ".jpeg",  { "image/jpeg", 86400 } },
+    { ".ico",   { "image/x-icon", 86400 } },
+    { ".svg",   { "image/svg+xml", 86400 } },
+    { ".au",    { "audio/basic", 86400 } },
+    { ".mpeg",  { "video/mpeg", 86400 } },
+    { ".mpg",   { "video/mpeg", 86400 } },
+    { ".mp4",   { "video/mp4", 86400 } },
+    { ".avi",   { "video/x-msvideo", 86400 } },
+    { ".gz",    { "application/x-gzip", 3600 } },
+    { ".tar",   { "application/x-tar", 3600 } },
+    { ".css",   { "text/css", 3600 } },
+    { ".js",    { "text/javascript", 3600 } },
+    { ".woff",  { "font/woff", 604800 } },
+    { ".woff2", { "font/woff2", 604800 } },
+    { ".ttf",   { "font/ttf", 604800 } },
+    { ".otf",   { "font/otf", 604800 } },
+    { ".eot",   { "application/vnd.ms-fontobject", 604800 } },
 };       // 文件后缀与文件类型映射
 
 
+const HttpResponse::Sidecar HttpResponse::SIDECARS[] = {
+    { "br", ".br" },
+    { "gzip", ".gz" },
+};      // 预压缩文件，由make compress离线生成
+
+
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 416, "Range Not Satisfiable" },
 };      // 响应状态码与状态描述映射
 
 
@@ -43,8 +61,11 @@ HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr;
-    mmFileStat_ = {0};
+    offset_ = length_ = 0;
+    st_ = {};
+    encoding_ = nullptr;
+    request_ = nullptr;
+    cacheEpoch_ = 0;
 }
 
 HttpResponse::~HttpResponse() {
@@ -53,30 +74,61 @@ HttpResponse::~HttpResponse() {
 
 
 // 初始化响应对象
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code) {
+void HttpResponse::Init(const string& srcDir, string_view path, bool isKeepAlive, int code) {
     assert(srcDir != "");
-    if(mmFile_) 
-    {
-        UnmapFile();
-    }
+    UnmapFile();
     code_ = code;
-    path_ = path;
+    path_.assign(path.data(), path.size());
     srcDir_ = srcDir;
     isKeepAlive_ = isKeepAlive;
-    mmFile_ = nullptr;
-    mmFileStat_ = {0};
+    offset_ = length_ = 0;
+    encoding_ = nullptr;
+    request_ = nullptr;
+    cacheKey_.clear();
 }
 
-// 生成响应报文
+void HttpResponse::SetRequest(const HttpRequest* request) {
+    request_ = request;
+}
+
+// 生成响应报文：文件从进程级FileCache获取，命中时不再stat/open/mmap
+// 条件请求先只取元数据，校验通过直接返回304，不打开也不映射文件
 void HttpResponse::MakeResponse(Buffer& buffer){
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {  //文件不存在或为目录，stat函数获取文件信息，如果文件不存在返回-1，S_ISDIR判断是否为目录
-        code_ = 404;
+    if(code_ != 400) {   //请求格式错误时路径不可信，直接返回400页面
+        string path = srcDir_ + path_;
+        SelectEncoding_(path);
+        if(file_) {
+            if(request_->IsConditional() && request_->IsNotModified(ETag(file_->st), file_->st.st_mtime)) {
+                st_ = file_->st;
+                file_.reset();
+                code_ = 304;
+            }
+            else if(code_ == -1) {
+                code_ = 200;
+            }
+        }
+        else if(request_ && request_->IsConditional() && FileCache::Instance()->Stat(path, &st_) &&
+           request_->IsNotModified(ETag(st_), st_.st_mtime)) {
+            code_ = 304;
+        }
+        else {
+            int err = 0;
+            file_ = FileCache::Instance()->Get(path, &err);
+            if(!file_) {
+                code_ = (err == EACCES) ? 403 : 404;   //文件不存在或为目录返回404，文件不可读返回403
+            }
+            else if(code_ == -1) {
+                code_ = 200;
+            }
+        }
     }
-    else if(!(mmFileStat_.st_mode & S_IROTH)) {  //文件不可读
-        code_ = 403;
-    }
-    else if(code_ == -1){
-        code_ = 200;
+    if(file_) {
+        st_ = file_->st;
+        offset_ = 0;
+        length_ = file_->Size();
+        if(code_ == 200 && request_ && request_->method() == "GET" && !request_->GetHeader(HttpParser::HEADER_RANGE).empty()) {
+            ApplyRange_();   //只发送请求的区间
+        }
     }
 
     ErrorHtml_();   //错误页面
@@ -86,12 +138,194 @@ void HttpResponse::MakeResponse(Buffer& buffer){
 }
 
 
-char* HttpResponse::File() {
-    return mmFile_;
+// 只缓存普通的GET：条件请求和Range请求的响应随请求头变化，不进整包缓存
+// 同一路径按长短连接和客户端可接受的压缩方式分成不同的条目，各自的响应头不同
+bool HttpResponse::CacheKey_() {
+    if(code_ == 400 || !request_ || ResponseCache::Instance()->MaxResponse() == 0 ||
+       request_->method() != "GET" || request_->IsConditional() ||
+       !request_->GetHeader(HttpParser::HEADER_RANGE).empty()) {
+        return false;
+    }
+    char flags = isKeepAlive_ ? 1 : 0;
+    if(!request_->GetHeader(HttpParser::HEADER_ACCEPT_ENCODING).empty()) {
+        for(size_t i = 0; i < sizeof(SIDECARS) / sizeof(SIDECARS[0]); i++) {
+            if(request_->AcceptsEncoding(SIDECARS[i].encoding)) {
+                flags |= 2 << i;
+            }
+        }
+    }
+    cacheKey_.assign(path_);
+    cacheKey_.push_back('\0');
+    cacheKey_.push_back('0' + flags);
+    return true;
+}
+
+ResponseRef HttpResponse::CachedResponse() {
+    if(!CacheKey_()) {
+        return nullptr;
+    }
+    cacheEpoch_ = ResponseCache::Instance()->Epoch();   //先于查缓存和取文件读取
+    return ResponseCache::Instance()->Get(cacheKey_);
+}
+
+// 预压缩文件的响应不缓存：是否发送预压缩文件取决于它与原文件的对应关系，每次请求都要重新判断，整包缓存会绕过这一步
+void HttpResponse::CacheResponse(const Buffer& buffer, size_t offset, size_t headLen) {
+    if(cacheKey_.empty() || encoding_ || (code_ != 200 && code_ != 403 && code_ != 404) ||
+       headLen + FileLen() > ResponseCache::Instance()->MaxResponse()) {
+        return;
+    }
+    shared_ptr<string> response = make_shared<string>();
+    response->reserve(headLen + FileLen());
+    buffer.CopyTo(offset, headLen, *response);
+    if(File()) {
+        response->append(File(), FileLen());
+    }
+    ResponseCache::Instance()->Put(cacheKey_, std::move(response), cacheEpoch_);
+}
+
+
+const char* HttpResponse::File() const {
+    return file_ && file_->data ? file_->data + offset_ : nullptr;
 }
 
 size_t HttpResponse::FileLen() const{
-    return mmFileStat_.st_size;
+    return file_ ? length_ : 0;
+}
+
+
+// 客户端接受时优先发送旁边的.br/.gz预压缩文件，找不到则发送原文件
+// 不存在的预压缩文件也记在FileCache中，不会每个请求都去open；带Range的请求只按原文件处理
+// 预压缩文件须与原文件对应：原文件不存在或不可读时按原文件响应404/403，预压缩文件比原文件旧（原文件修改后没有重新make compress）时不用
+void HttpResponse::SelectEncoding_(const string& path) {
+    if(!request_ || !request_->GetHeader(HttpParser::HEADER_RANGE).empty() ||
+       request_->GetHeader(HttpParser::HEADER_ACCEPT_ENCODING).empty()) {
+        return;
+    }
+    struct stat st;
+    if(!FileCache::Instance()->Stat(path, &st)) {
+        return;
+    }
+    for(const Sidecar& sidecar : SIDECARS) {
+        if(!request_->AcceptsEncoding(sidecar.encoding)) {
+            continue;
+        }
+        int err = 0;
+        file_ = FileCache::Instance()->Get(path + sidecar.suffix, &err);
+        if(file_ && !OlderThan_(file_->st.st_mtim, st.st_mtim)) {
+            encoding_ = sidecar.encoding;
+            return;
+        }
+        file_.reset();
+    }
+}
+
+bool HttpResponse::OlderThan_(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+
+// If-Range与当前文件的ETag（强比较）或Last-Modified一致时才按区间响应，否则文件已变，返回整个文件
+void HttpResponse::ApplyRange_() {
+    string_view ifRange = request_->GetHeader(HttpParser::HEADER_IF_RANGE);
+    if(!ifRange.empty() && ifRange != (ifRange[0] == '"' ? ETag(st_) : HttpDate(st_.st_mtime))) {
+        return;
+    }
+    size_t start = 0, len = 0;
+    RangeResult result = ParseRange(request_->GetHeader(HttpParser::HEADER_RANGE), file_->Size(), &start, &len);
+    if(result == RANGE_OK) {
+        code_ = 206;
+        offset_ = start;
+        length_ = len;
+    }
+    else if(result == RANGE_UNSATISFIABLE) {
+        code_ = 416;
+    }
+}
+
+
+HttpResponse::RangeResult HttpResponse::ParseRange(string_view spec, size_t size, size_t* start, size_t* len) {
+    auto trim = [](string_view s) {
+        while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+        return s;
+    };
+    // 十进制数字串，溢出或为空时失败
+    auto number = [](string_view s, size_t* n) {
+        if(s.empty()) {
+            return false;
+        }
+        *n = 0;
+        for(char ch : s) {
+            if(ch < '0' || ch > '9' || *n > (SIZE_MAX - 9) / 10) {
+                return false;
+            }
+            *n = *n * 10 + (ch - '0');
+        }
+        return true;
+    };
+
+    spec = trim(spec);
+    if(spec.size() < 6 || strncasecmp(spec.data(), "bytes=", 6) != 0) {
+        return RANGE_NONE;
+    }
+    spec = trim(spec.substr(6));
+    size_t dash = spec.find('-');
+    if(dash == string_view::npos || spec.find(',') != string_view::npos) {
+        return RANGE_NONE;
+    }
+    string_view first = trim(spec.substr(0, dash));
+    string_view last = trim(spec.substr(dash + 1));
+    size_t a = 0, b = 0;
+    if(first.empty()) {   // 最后suffix个字节
+        if(!number(last, &b)) {
+            return RANGE_NONE;
+        }
+        if(b == 0 || size == 0) {
+            return RANGE_UNSATISFIABLE;
+        }
+        *len = b < size ? b : size;
+        *start = size - *len;
+        return RANGE_OK;
+    }
+    if(!number(first, &a)) {
+        return RANGE_NONE;
+    }
+    if(last.empty()) {
+        b = SIZE_MAX;
+    }
+    else if(!number(last, &b) || b < a) {
+        return RANGE_NONE;   // 语法错误的Range按没有处理
+    }
+    if(a >= size) {
+        return RANGE_UNSATISFIABLE;
+    }
+    if(b >= size) {
+        b = size - 1;
+    }
+    *start = a;
+    *len = b - a + 1;
+    return RANGE_OK;
+}
+
+
+string HttpResponse::ETag(const struct stat& st) {
+    char buf[64];
+    uint64_t mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    int n = snprintf(buf, sizeof(buf), "\"%lx-%lx-%lx\"", static_cast<unsigned long>(st.st_ino),
+                     static_cast<unsigned long>(st.st_size), static_cast<unsigned long>(mtime));
+    return string(buf, n);
+}
+
+void HttpResponse::SetMaxAge(const string& suffix, int seconds) {
+    SUFFIX_TYPE[suffix].maxAge = seconds;
+}
+
+string HttpResponse::HttpDate(time_t t) {
+    struct tm tm;
+    char buf[64];
+    gmtime_r(&t, &tm);
+    size_t n = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return string(buf, n);
 }
 
 
@@ -99,7 +333,10 @@ size_t HttpResponse::FileLen() const{
 void HttpResponse::ErrorHtml_() {
     if(CODE_PATH.count(code_) == 1){
         path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);   //获取文件信息
+        int err = 0;
+        file_ = FileCache::Instance()->Get(srcDir_ + path_, &err);   //错误页面不存在时由ErrorContent生成
+        offset_ = 0;
+        length_ = file_ ? file_->Size() : 0;
     }
 }
 
@@ -131,35 +368,55 @@ void HttpResponse::AddHeader_(Buffer& buffer) {
         buffer.Append("close\r\n");
     }
     buffer.Append("Content-type: " + GetFileType_() + "\r\n");
+    if(code_ == 200 || code_ == 206 || code_ == 304) {
+        // 校验信息和缓存策略，浏览器据此发条件请求，未变化时只收到304
+        buffer.Append("ETag: " + ETag(st_) + "\r\n");
+        buffer.Append("Last-Modified: " + HttpDate(st_.st_mtime) + "\r\n");
+        buffer.Append("Cache-Control: " + GetMaxAge_() + "\r\n");
+        buffer.Append("Vary: Accept-Encoding\r\n");
+    }
+    if(encoding_ && code_ == 200) {
+        buffer.Append("Content-Encoding: " + string(encoding_) + "\r\n");
+    }
+    else if(code_ == 200 || code_ == 206) {   //Range只作用于原文件，预压缩的响应不声明
+        buffer.Append("Accept-Ranges: bytes\r\n");
+    }
+    if(code_ == 206) {
+        buffer.Append("Content-Range: bytes " + to_string(offset_) + "-" + to_string(offset_ + length_ - 1) + "/" + to_string(file_->Size()) + "\r\n");
+    }
+    else if(code_ == 416) {
+        buffer.Append("Content-Range: bytes */" + to_string(file_->Size()) + "\r\n");
+    }
 }
 
 
-// 添加响应体
+// 添加响应体：文件内容由调用方直接从共享映射发送，这里只写Content-length
 void HttpResponse::AddContent_(Buffer& buffer) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);   // 以只读方式打开文件
-    if(srcFd < 0) {
-        ErrorContent(buffer, "File Not Found!!!");
+    if(code_ == 304) {   // 304没有响应体
+        buffer.Append("\r\n");
         return;
     }
-    
-    LOG_DEBUG("file path: %s", (srcDir_ + path_).data());  
-    //mmap函数将文件映射到内存中,返回指向映射区域的指针,PROT_READ表示映射区域可读,MAP_PRIVATE表示创建一个私有的映射副本
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
-        ErrorContent(buffer, "Internal Server Error!!!");
+    if(code_ == 416) {
+        file_.reset();
+        ErrorContent(buffer, "Requested Range Not Satisfiable");
         return;
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buffer.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    if(!file_) {
+        ErrorContent(buffer, "File Not Found!!!");
+        return;
+    }
+    LOG_DEBUG("file path: %s", file_->path.c_str());
+    buffer.Append("Content-length: " + to_string(length_) + "\r\n\r\n");
 }
 
-// 关闭内存映射
+// 释放文件引用，映射由FileCache在最后一个引用释放时回收
 void HttpResponse::UnmapFile() {
-    if(mmFile_){
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+    file_.reset();
+}
+
+// 交出文件引用，流水线中多个响应的文件要一直保留到整批发送完成
+FileRef HttpResponse::DetachFile() {
+    return std::move(file_);
 }
 
 // 获取文件类型
@@ -170,11 +427,23 @@ string HttpResponse::GetFileType_() {
     }
     string suffix = path_.substr(idx);  // 截取最后一个.之后的部分
     if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;   //返回文件类型
+        return SUFFIX_TYPE.find(suffix)->second.type;   //返回文件类型
     }
     return "text/plain";
 }
 
+// 按文件类型取Cache-Control，未知类型和max-age为0的类型每次都要重新确认
+string HttpResponse::GetMaxAge_() {
+    string::size_type idx = path_.find_last_of('.');
+    if(idx != string::npos) {
+        auto it = SUFFIX_TYPE.find(path_.substr(idx));
+        if(it != SUFFIX_TYPE.end() && it->second.maxAge > 0) {
+            return "max-age=" + to_string(it->second.maxAge);
+        }
+    }
+    return "no-cache";
+}
+
 
 // 向Buffer中添加错误信息
 void HttpResponse::ErrorContent(Buffer& buffer, string message) {
@@ -2,29 +2,51 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <string_view>
 #include <fcntl.h>    // 该头文件定义了文件控制相关的函数
 #include <unistd.h>    // 该头文件定义了标准输入输出相关的函数
 #include <sys/stat.h> // 该头文件定义了文件状态相关的函数
 #include <sys/mman.h> // 该头文件定义了内存映射相关的函数
+#include <strings.h>
+#include <time.h>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "filecache.h"
+#include "responsecache.h"
 
 using namespace std;
 
+class HttpRequest;
+
 class HttpResponse{
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const string& srcDir, string& path, bool isKeepAlive = false, int code = -1);
+    void Init(const string& srcDir, string_view path, bool isKeepAlive = false, int code = -1);
+    //关联当前请求，MakeResponse时据此处理条件请求和Range，请求须在MakeResponse之前保持有效
+    void SetRequest(const HttpRequest* request);
     void MakeResponse(Buffer& buffer);
-    void UnmapFile();
-    char* File();
+    ResponseRef CachedResponse();   //整包缓存命中时返回完整的响应报文，此时不必再MakeResponse
+    void CacheResponse(const Buffer& buffer, size_t offset, size_t headLen);   //MakeResponse之后调用，小响应连同buffer中从offset开始的响应头放入整包缓存
+    void UnmapFile();   //释放对缓存文件的引用
+    FileRef DetachFile();   //交出文件引用，调用方持有到发送完成为止
+    const char* File() const;
     size_t FileLen() const;
     void ErrorContent(Buffer& buffer, string message);
     int Code() const { return code_; };
 
+    enum RangeResult {
+        RANGE_NONE,            // 没有或无法识别的Range，按整个文件响应
+        RANGE_OK,              // 可满足的单个区间
+        RANGE_UNSATISFIABLE    // 区间超出文件大小，响应416
+    };
+    //解析"bytes=first-last"、"bytes=first-"、"bytes=-suffix"形式的单个区间，多区间暂不支持，按整个文件处理
+    static RangeResult ParseRange(string_view spec, size_t size, size_t* start, size_t* len);
+    static string HttpDate(time_t t);   //RFC 7231的IMF-fixdate格式
+    static string ETag(const struct stat& st);   //由inode、大小和修改时间生成的强ETag
+    static void SetMaxAge(const string& suffix, int seconds);   //修改某类文件的Cache-Control max-age，需在服务启动前调用
 
 private:
     void AddStateLine_(Buffer& buffer);
@@ -32,6 +54,11 @@ private:
     void AddContent_(Buffer& buffer);
 
     void ErrorHtml_();
+    void ApplyRange_();
+    void SelectEncoding_(const string& path);
+    static bool OlderThan_(const struct timespec& a, const struct timespec& b);
+    bool CacheKey_();
+    string GetMaxAge_();
     string GetFileType_();
 
     int code_;     // 状态码
@@ -40,10 +67,27 @@ private:
     string path_;    // 文件路径
     string srcDir_;   // 资源文件所在目录
 
-    char* mmFile_;    // 内存映射文件
-    struct stat mmFileStat_;    // 文件状态
+    FileRef file_;    // 文件缓存中的条目，包含fd、stat和共享映射
+    size_t offset_;   // 要发送的文件区间
+    size_t length_;
+
+    struct stat st_;    // 文件的校验信息，304时没有file_
+    const char* encoding_;    // 发送预压缩文件时的Content-Encoding，否则为nullptr
+    const HttpRequest* request_;
+    string cacheKey_;   // 整包缓存的键，为空表示本次响应不缓存
+    uint64_t cacheEpoch_;   // 查整包缓存时的epoch，放回缓存时据此判断期间是否有过失效
+
+    struct FileType {
+        string type;
+        int maxAge;    // Cache-Control的max-age（秒），0表示每次都要向服务器确认
+    };
+    static unordered_map<string, FileType> SUFFIX_TYPE;    // 后缀名与文件类型、缓存时间的映射
 
-    static const unordered_map<string, string> SUFFIX_TYPE;    // 后缀名与文件类型的映射
+    struct Sidecar {
+        const char* encoding;
+        const char* suffix;
+    };
+    static const Sidecar SIDECARS[];    // 按优先级排列的预压缩文件
     static const unordered_map<int, string> CODE_STATUS;    // 状态码与状态描述的映射
     static const unordered_map<int, string> CODE_PATH;    // 状态码与错误页面路径的映射
 
@@ -0,0 +1,246 @@
+#include "httpscan.h"
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+
+// RFC 7230 tchar: 字母数字和 !#$%&'*+-.^_`|~
+const bool HttpScan::TOKEN_CHAR[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,   //  !"#$%&'()*+,-./
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,   // 0123456789:;<=>?
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,   // @ABCDEFGHIJKLMNO
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,   // PQRSTUVWXYZ[\]^_
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,   // `abcdefghijklmno
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,   // pqrstuvwxyz{|}~
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+
+namespace {
+
+/*标量实现，也用于SIMD版本处理不足一个向量的尾部*/
+const char* TokenEndScalar(const char* p, const char* end) {
+    while(p < end && HttpScan::IsTokenChar(static_cast<unsigned char>(*p))) {
+        p++;
+    }
+    return p;
+}
+
+const char* TargetEndScalar(const char* p, const char* end) {
+    for(; p < end; p++) {
+        unsigned char ch = *p;
+        if(ch <= 0x20 || ch == 0x7f) {
+            break;
+        }
+    }
+    return p;
+}
+
+const char* ValueEndScalar(const char* p, const char* end) {
+    for(; p < end; p++) {
+        unsigned char ch = *p;
+        if((ch < 0x20 && ch != '\t') || ch == 0x7f) {
+            break;
+        }
+    }
+    return p;
+}
+
+
+#ifdef HTTP_SCAN_X86
+
+/*tchar的半字节位图：第c&15项的第c>>4位表示字节c是否是tchar（只覆盖0~127，更高的字节都不是tchar）。
+用pshufb按低半字节和高半字节各查一次表，两者相与非零即在集合中*/
+struct NibbleTable {
+    alignas(32) uint8_t lo[32];
+    alignas(32) uint8_t hi[32];
+
+    NibbleTable() {
+        for(int i = 0; i < 32; i++) {
+            lo[i] = 0;
+            hi[i] = (i & 15) < 8 ? static_cast<uint8_t>(1u << (i & 15)) : 0;
+        }
+        for(int c = 0; c < 128; c++) {
+            if(HttpScan::IsTokenChar(c)) {
+                lo[c & 15] |= 1u << (c >> 4);
+                lo[16 + (c & 15)] |= 1u << (c >> 4);   //AVX2的vpshufb在两个128位通道内分别查表
+            }
+        }
+    }
+};
+
+const NibbleTable TOKEN_NIBBLES;
+
+
+__attribute__((target("sse4.2")))
+const char* TokenEndSse42(const char* p, const char* end) {
+    const __m128i lo = _mm_load_si128(reinterpret_cast<const __m128i*>(TOKEN_NIBBLES.lo));
+    const __m128i hi = _mm_load_si128(reinterpret_cast<const __m128i*>(TOKEN_NIBBLES.hi));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    while(end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, mask));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i in = _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());   //不在集合中的字节为0xff
+        int bits = _mm_movemask_epi8(in);
+        if(bits) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 16;
+    }
+    return TokenEndScalar(p, end);
+}
+
+// pcmpestri的范围模式：一次比较找出落在任一区间内的第一个字节
+__attribute__((target("sse4.2")))
+const char* TargetEndSse42(const char* p, const char* end) {
+    static const char ranges[16] = "\000\040\177\177";
+    const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+    while(end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int idx = _mm_cmpestri(r, 4, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(idx != 16) {
+            return p + idx;
+        }
+        p += 16;
+    }
+    return TargetEndScalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+const char* ValueEndSse42(const char* p, const char* end) {
+    static const char ranges[16] = "\000\010\012\037\177\177";
+    const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+    while(end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int idx = _mm_cmpestri(r, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(idx != 16) {
+            return p + idx;
+        }
+        p += 16;
+    }
+    return ValueEndScalar(p, end);
+}
+
+
+__attribute__((target("avx2")))
+const char* TokenEndAvx2(const char* p, const char* end) {
+    const __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(TOKEN_NIBBLES.lo));
+    const __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(TOKEN_NIBBLES.hi));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    while(end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask));
+        __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        __m256i in = _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256());
+        uint32_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(in));
+        if(bits) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 32;
+    }
+    return TokenEndSse42(p, end);
+}
+
+/*有符号比较：ch < bound且不是>=0x80的字节（有符号为负）即为控制字符*/
+__attribute__((target("avx2")))
+inline uint32_t CtlMask(__m256i v, char bound) {
+    __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8(bound), v);
+    __m256i high = _mm256_cmpgt_epi8(_mm256_setzero_si256(), v);
+    __m256i del = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_andnot_si256(high, below), del)));
+}
+
+__attribute__((target("avx2")))
+const char* TargetEndAvx2(const char* p, const char* end) {
+    while(end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t bits = CtlMask(v, 0x21);
+        if(bits) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 32;
+    }
+    return TargetEndScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* ValueEndAvx2(const char* p, const char* end) {
+    const __m256i tab = _mm256_set1_epi8('\t');
+    while(end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t tabs = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, tab)));
+        uint32_t bits = CtlMask(v, 0x20) & ~tabs;
+        if(bits) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 32;
+    }
+    return ValueEndScalar(p, end);
+}
+
+#endif // HTTP_SCAN_X86
+
+}
+
+
+const char* HttpScan::LevelName(Level level) {
+    switch(level) {
+    case AVX2:
+        return "avx2";
+    case SSE42:
+        return "sse4.2";
+    default:
+        return "scalar";
+    }
+}
+
+HttpScan::Level HttpScan::DetectLevel() {
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return AVX2;
+    }
+    if(__builtin_cpu_supports("sse4.2")) {
+        return SSE42;
+    }
+#endif
+    return SCALAR;
+}
+
+HttpScan::Kernels HttpScan::Make_(Level level) {
+#ifdef HTTP_SCAN_X86
+    if(level == AVX2) {
+        return { AVX2, TokenEndAvx2, TargetEndAvx2, ValueEndAvx2 };
+    }
+    if(level == SSE42) {
+        return { SSE42, TokenEndSse42, TargetEndSse42, ValueEndSse42 };
+    }
+#endif
+    return { SCALAR, TokenEndScalar, TargetEndScalar, ValueEndScalar };
+}
+
+HttpScan::Kernels& HttpScan::Kernels_() {
+    static Kernels kernels = Make_(DetectLevel());
+    return kernels;
+}
+
+bool HttpScan::SetLevel(Level level) {
+    if(level > DetectLevel()) {
+        return false;
+    }
+    Kernels_() = Make_(level);
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+/*请求解析用的分隔符扫描内核
+每个函数从p开始找第一个“不合法”的字节，找分隔符和校验字符在同一遍中完成：
+  FindTokenEnd : 第一个非tchar字节（方法名、请求头名字之后的' '或':'）
+  FindTargetEnd: 第一个控制字符、空格或DEL（请求目标之后的' '）
+  FindValueEnd : 第一个除制表符外的控制字符或DEL（请求头值之后的'\r'或'\n'）
+都没有找到时返回end。启动时按CPU支持情况选择AVX2、SSE4.2或标量实现，
+SIMD版本用target属性单独编译，不需要改动全局编译选项*/
+
+class HttpScan {
+public:
+    enum Level { SCALAR, SSE42, AVX2 };
+
+    static const char* FindTokenEnd(const char* p, const char* end) { return Kernels_().token(p, end); }
+    static const char* FindTargetEnd(const char* p, const char* end) { return Kernels_().target(p, end); }
+    static const char* FindValueEnd(const char* p, const char* end) { return Kernels_().value(p, end); }
+
+    static bool IsTokenChar(unsigned char ch) { return TOKEN_CHAR[ch]; }
+
+    static Level GetLevel() { return Kernels_().level; }
+    static const char* LevelName(Level level);
+    static Level DetectLevel();   //当前CPU支持的最高级别
+    static bool SetLevel(Level level);   //强制使用某一级别（测试和基准用），CPU不支持时返回false
+
+private:
+    typedef const char* (*ScanFunc)(const char* p, const char* end);
+
+    struct Kernels {
+        Level level;
+        ScanFunc token;
+        ScanFunc target;
+        ScanFunc value;
+    };
+
+    static Kernels& Kernels_();
+    static Kernels Make_(Level level);
+
+    static const bool TOKEN_CHAR[256];
+};
+
+#endif // HTTP_SCAN_H
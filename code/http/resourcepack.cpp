@@ -0,0 +1,232 @@
+#include "resourcepack.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <vector>
+#include <algorithm>
+
+#include "../log/log.h"
+
+using namespace std;
+
+
+namespace {
+
+struct PackSource {
+    string path;   // 相对资源目录，如"/css/style.css"
+    struct stat st;
+};
+
+void CollectFiles(const string& srcDir, const string& rel, vector<PackSource>& files) {
+    string dir = srcDir + rel;
+    DIR* dp = opendir(dir.c_str());
+    if(!dp) {
+        return;
+    }
+    while(struct dirent* entry = readdir(dp)) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        PackSource src;
+        src.path = rel + "/" + entry->d_name;
+        if(stat((srcDir + src.path).c_str(), &src.st) < 0) {
+            continue;
+        }
+        if(S_ISDIR(src.st.st_mode)) {
+            CollectFiles(srcDir, src.path, files);
+        }
+        else if(S_ISREG(src.st.st_mode)) {
+            files.push_back(std::move(src));
+        }
+    }
+    closedir(dp);
+}
+
+bool WriteAll(int fd, const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 路径哈希作为伪inode：内容未变的文件在新包中的ETag保持不变
+uint64_t PathHash(string_view path) {
+    uint64_t h = 14695981039346656037ULL;
+    for(char ch : path) {
+        h = (h ^ static_cast<unsigned char>(ch)) * 1099511628211ULL;
+    }
+    return h;
+}
+
+}
+
+
+bool ResourcePack::Build(const string& srcDir, const string& packPath) {
+    // 缓存键为资源目录 + 请求路径，这里的相对路径以'/'开头，与请求路径一致
+    string root = srcDir;
+    while(root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    vector<PackSource> files;
+    CollectFiles(root, "", files);
+    sort(files.begin(), files.end(), [](const PackSource& a, const PackSource& b) { return a.path < b.path; });
+
+    string paths;
+    vector<IndexEntry> index(files.size());
+    for(size_t i = 0; i < files.size(); i++) {
+        index[i] = {};
+        index[i].size = files[i].st.st_size;
+        index[i].mtimeSec = files[i].st.st_mtim.tv_sec;
+        index[i].mtimeNsec = files[i].st.st_mtim.tv_nsec;
+        index[i].mode = files[i].st.st_mode;
+        index[i].pathOffset = paths.size();
+        index[i].pathLen = files[i].path.size();
+        paths += files[i].path;
+    }
+    uint64_t offset = sizeof(PackHeader) + sizeof(IndexEntry) * index.size() + paths.size();
+    for(IndexEntry& entry : index) {
+        offset = (offset + PAGE - 1) / PAGE * PAGE;
+        entry.offset = offset;
+        offset += entry.size;
+    }
+
+    string tmp = packPath + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        LOG_ERROR("ResourcePack: create %s failed, errno: %d", tmp.c_str(), errno);
+        return false;
+    }
+    PackHeader header = {};
+    memcpy(header.magic, "WSRPACK1", 8);
+    header.count = index.size();
+    header.pathsSize = paths.size();
+    bool ok = WriteAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+              WriteAll(fd, reinterpret_cast<const char*>(index.data()), sizeof(IndexEntry) * index.size()) &&
+              WriteAll(fd, paths.data(), paths.size());
+    vector<char> buf(64 * 1024);
+    for(size_t i = 0; ok && i < files.size(); i++) {
+        // 打包过程中文件被改动时以打包时读到的内容为准，大小不一致则失败
+        ok = lseek(fd, index[i].offset, SEEK_SET) >= 0;
+        int src = ok ? open((root + files[i].path).c_str(), O_RDONLY | O_CLOEXEC) : -1;
+        size_t left = index[i].size;
+        while(ok && src >= 0 && left > 0) {
+            ssize_t n = read(src, buf.data(), min(left, buf.size()));
+            ok = n > 0 && WriteAll(fd, buf.data(), n);
+            left -= ok ? n : 0;
+        }
+        ok = ok && src >= 0 && left == 0;
+        if(src >= 0) {
+            close(src);
+        }
+    }
+    ok = ok && ftruncate(fd, offset) == 0 && fsync(fd) == 0;
+    close(fd);
+    if(!ok || rename(tmp.c_str(), packPath.c_str()) < 0) {
+        LOG_ERROR("ResourcePack: build %s failed, errno: %d", packPath.c_str(), errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    LOG_INFO("ResourcePack: packed %d files, %llu bytes into %s", (int)files.size(), (unsigned long long)offset, packPath.c_str());
+    return true;
+}
+
+
+ResourcePack::ResourcePack(): fd_(-1), data_(nullptr), size_(0), count_(0), index_(nullptr), paths_(nullptr) {}
+
+ResourcePack::~ResourcePack() {
+    if(data_) {
+        munmap(data_, size_);
+    }
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+
+shared_ptr<ResourcePack> ResourcePack::Load(const string& packPath, bool populate) {
+    shared_ptr<ResourcePack> pack(new ResourcePack());
+    struct stat st;
+    pack->fd_ = open(packPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if(pack->fd_ < 0 || fstat(pack->fd_, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(PackHeader)) {
+        LOG_ERROR("ResourcePack: open %s failed, errno: %d", packPath.c_str(), errno);
+        return nullptr;
+    }
+    pack->size_ = st.st_size;
+    void* mm = mmap(nullptr, pack->size_, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), pack->fd_, 0);
+    if(mm == MAP_FAILED) {
+        LOG_ERROR("ResourcePack: mmap %s failed, errno: %d", packPath.c_str(), errno);
+        return nullptr;
+    }
+    pack->data_ = static_cast<char*>(mm);
+    madvise(mm, pack->size_, MADV_HUGEPAGE);   //文件映射的大页需要内核支持，不支持时忽略
+
+    // 校验头部、索引和每个条目的范围，损坏的包不加载
+    const PackHeader* header = reinterpret_cast<const PackHeader*>(pack->data_);
+    size_t pathsBegin = sizeof(PackHeader) + sizeof(IndexEntry) * static_cast<size_t>(header->count);
+    if(memcmp(header->magic, "WSRPACK1", 8) != 0 || pathsBegin + header->pathsSize > pack->size_) {
+        LOG_ERROR("ResourcePack: %s is not a valid pack", packPath.c_str());
+        return nullptr;
+    }
+    pack->count_ = header->count;
+    pack->index_ = reinterpret_cast<const IndexEntry*>(pack->data_ + sizeof(PackHeader));
+    pack->paths_ = pack->data_ + pathsBegin;
+    pack->files_.reset(new CachedFile[pack->count_]);
+    for(uint32_t i = 0; i < pack->count_; i++) {
+        const IndexEntry& entry = pack->index_[i];
+        if(static_cast<uint64_t>(entry.pathOffset) + entry.pathLen > header->pathsSize ||
+           entry.offset > pack->size_ || entry.size > pack->size_ - entry.offset ||
+           (i > 0 && pack->Path_(i - 1) >= pack->Path_(i))) {
+            LOG_ERROR("ResourcePack: %s entry %u is corrupt", packPath.c_str(), i);
+            return nullptr;
+        }
+        CachedFile& file = pack->files_[i];
+        file.path = string(pack->Path_(i));
+        file.fd = pack->fd_;
+        file.data = pack->data_ + entry.offset;
+        file.base = entry.offset;
+        file.borrowed = true;
+        file.st.st_ino = PathHash(file.path);
+        file.st.st_dev = st.st_dev;
+        file.st.st_mode = entry.mode;
+        file.st.st_size = entry.size;
+        file.st.st_mtim.tv_sec = entry.mtimeSec;
+        file.st.st_mtim.tv_nsec = entry.mtimeNsec;
+    }
+    LOG_INFO("ResourcePack: loaded %s, %d files, %llu bytes%s", packPath.c_str(), (int)pack->count_,
+             (unsigned long long)pack->size_, populate ? ", populated" : "");
+    return pack;
+}
+
+
+string_view ResourcePack::Path_(uint32_t i) const {
+    return string_view(paths_ + index_[i].pathOffset, index_[i].pathLen);
+}
+
+FileRef ResourcePack::Find(string_view path) const {
+    uint32_t lo = 0, hi = count_;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(Path_(mid) < path) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if(lo == count_ || Path_(lo) != path) {
+        return nullptr;
+    }
+    return FileRef(shared_from_this(), &files_[lo]);   //与包共享引用计数，不单独分配
+}
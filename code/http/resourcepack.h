@@ -0,0 +1,65 @@
+#ifndef RESOURCE_PACK_H
+#define RESOURCE_PACK_H
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <stdint.h>
+
+#include "filecache.h"
+
+/*资源包：把资源目录打成一个文件，启动时整体mmap一次
+文件布局：PackHeader | 按路径排序的IndexEntry[count] | 路径字符串表 | 按页对齐的各文件内容。
+每个条目在加载时预先生成CachedFile（fd和data指向整个包），Find用二分查找定位，
+返回与包共享引用计数的FileRef：请求路径上没有stat/open/mmap，也没有内存分配。
+部署时必须把新包写到同一目录下的临时文件再rename覆盖（Build就是这样做的），ResourceWatcher发现后重新加载，旧包在最后一个引用释放后解除映射；
+原地截断重写正在映射的包会让读映射的线程SIGBUS*/
+
+class ResourcePack : public std::enable_shared_from_this<ResourcePack> {
+public:
+    //打包srcDir下所有普通文件，先写packPath.tmp再rename，成功返回true
+    static bool Build(const std::string& srcDir, const std::string& packPath);
+    //映射资源包，populate为true时MAP_POPULATE预读全部内容；格式不对时返回nullptr
+    static std::shared_ptr<ResourcePack> Load(const std::string& packPath, bool populate);
+
+    ~ResourcePack();
+    ResourcePack(const ResourcePack&) = delete;
+    ResourcePack& operator=(const ResourcePack&) = delete;
+
+    FileRef Find(std::string_view path) const;   // path为相对资源目录的请求路径，如"/index.html"
+    size_t Count() const { return count_; }
+    size_t Bytes() const { return size_; }
+
+    static const size_t PAGE = 4096;   // 文件内容的对齐粒度
+
+private:
+    ResourcePack();
+
+    struct PackHeader {
+        char magic[8];         // "WSRPACK1"
+        uint32_t count;        // 文件数
+        uint32_t pathsSize;    // 路径字符串表的字节数
+    };
+    struct IndexEntry {
+        uint64_t offset;       // 内容在包中的偏移，按PAGE对齐
+        uint64_t size;
+        int64_t mtimeSec;
+        int64_t mtimeNsec;
+        uint32_t mode;
+        uint32_t pathOffset;   // 在路径字符串表中的偏移
+        uint32_t pathLen;
+        uint32_t reserved;
+    };
+
+    std::string_view Path_(uint32_t i) const;
+
+    int fd_;
+    char* data_;
+    size_t size_;
+    uint32_t count_;
+    const IndexEntry* index_;
+    const char* paths_;
+    std::unique_ptr<CachedFile[]> files_;
+};
+
+#endif // RESOURCE_PACK_H
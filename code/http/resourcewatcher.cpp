@@ -0,0 +1,208 @@
+#include "resourcewatcher.h"
+
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "filecache.h"
+#include "responsecache.h"
+#include "resourcepack.h"
+#include "../log/log.h"
+
+using namespace std;
+
+
+static const uint32_t WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+
+ResourceWatcher::ResourceWatcher(const string& root):
+    root_(root), inotifyFd_(-1), wakeFd_(-1), packPopulate_(false), packWd_(-1), events_(0) {}
+
+ResourceWatcher::~ResourceWatcher() {
+    Stop();
+}
+
+
+void ResourceWatcher::SetPack(const string& packPath, bool populate) {
+    packPath_ = packPath;
+    packName_ = packPath.substr(packPath.rfind('/') + 1);
+    packPopulate_ = populate;
+}
+
+bool ResourceWatcher::Start() {
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(inotifyFd_ < 0 || wakeFd_ < 0) {
+        LOG_WARN("inotify unavailable, errno: %d", errno);
+        Stop();
+        return false;
+    }
+    AddWatchTree_("");
+    if(!packPath_.empty()) {
+        // 只在新包rename到位（IN_MOVED_TO）时重新加载。不支持原地覆盖：正在使用的映射与被截断重写的是同一个inode，
+        // 读映射（如CacheResponse拷贝包内文件）会SIGBUS或读到新旧混杂的内容，重新加载也救不回来
+        string dir = packPath_.substr(0, packPath_.rfind('/') + 1);
+        packWd_ = inotify_add_watch(inotifyFd_, dir.c_str(), IN_MOVED_TO | IN_ONLYDIR);
+        if(packWd_ < 0) {
+            LOG_WARN("inotify_add_watch %s failed, errno: %d", dir.c_str(), errno);
+        }
+    }
+    if(dirs_.empty()) {
+        LOG_WARN("ResourceWatcher: cannot watch %s", root_.c_str());
+        Stop();
+        return false;
+    }
+    thread_ = thread(&ResourceWatcher::Loop_, this);
+    LOG_INFO("ResourceWatcher: watching %d directories under %s", (int)dirs_.size(), root_.c_str());
+    return true;
+}
+
+void ResourceWatcher::Stop() {
+    if(thread_.joinable()) {
+        uint64_t one = 1;
+        ssize_t ret = write(wakeFd_, &one, sizeof(one));
+        (void)ret;
+        thread_.join();
+    }
+    if(inotifyFd_ >= 0) {
+        close(inotifyFd_);
+        inotifyFd_ = -1;
+    }
+    if(wakeFd_ >= 0) {
+        close(wakeFd_);
+        wakeFd_ = -1;
+    }
+    dirs_.clear();
+    packWd_ = -1;
+}
+
+
+void ResourceWatcher::AddWatchTree_(const string& rel) {
+    string dir = root_ + rel;
+    int wd = inotify_add_watch(inotifyFd_, dir.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if(wd < 0) {
+        LOG_WARN("inotify_add_watch %s failed, errno: %d", dir.c_str(), errno);
+        return;
+    }
+    dirs_[wd] = rel;
+    DIR* dp = opendir(dir.c_str());
+    if(!dp) {
+        return;
+    }
+    while(struct dirent* entry = readdir(dp)) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        bool isDir = entry->d_type == DT_DIR;
+        if(entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isDir = stat((dir + "/" + entry->d_name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if(isDir) {
+            AddWatchTree_(rel + "/" + entry->d_name);
+        }
+    }
+    closedir(dp);
+}
+
+
+void ResourceWatcher::Loop_() {
+    // inotify_event要求按其自身对齐
+    alignas(struct inotify_event) char buf[64 * 1024];
+    struct pollfd fds[2] = { { inotifyFd_, POLLIN, 0 }, { wakeFd_, POLLIN, 0 } };
+    while(true) {
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("ResourceWatcher poll error, errno: %d", errno);
+            break;
+        }
+        if(fds[1].revents) {
+            break;
+        }
+        bool changed = false;
+        ssize_t len;
+        while((len = read(inotifyFd_, buf, sizeof(buf))) > 0) {
+            for(char* p = buf; p < buf + len; ) {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+                changed |= Handle_(event);
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if(changed) {
+            ResponseCache::Instance()->Clear();   //整包响应可能由多个文件拼成，整体作废
+            LogStats_();
+        }
+    }
+}
+
+
+bool ResourceWatcher::Handle_(const struct inotify_event* event) {
+    events_.fetch_add(1, memory_order_relaxed);
+    if(event->mask & IN_Q_OVERFLOW) {
+        LOG_WARN("ResourceWatcher: event queue overflow, dropping all cached files");
+        FileCache::Instance()->Clear();
+        return true;
+    }
+    if(event->wd == packWd_ && packWd_ >= 0) {
+        if(event->len > 0 && packName_ == event->name) {
+            ReloadPack_();
+            return true;
+        }
+        return false;
+    }
+    auto it = dirs_.find(event->wd);
+    if(it == dirs_.end()) {
+        return false;
+    }
+    if(event->mask & IN_IGNORED) {   //目录被删除或移走，监视已被内核移除
+        dirs_.erase(it);
+        return false;
+    }
+    if(event->len == 0) {   //目录自身被删除或移走
+        return (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) != 0;
+    }
+    string rel = it->second + "/" + event->name;
+    if(event->mask & IN_ISDIR) {
+        // 新建或移入的目录需要监视；目录整体移入移出时其下的路径都变了，清空文件缓存
+        if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            AddWatchTree_(rel);
+        }
+        if(event->mask & (IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)) {
+            FileCache::Instance()->Clear();
+        }
+        return true;
+    }
+    LOG_DEBUG("ResourceWatcher: %s changed, mask 0x%x", rel.c_str(), event->mask);
+    FileCache::Instance()->Invalidate(root_ + rel);
+    return true;
+}
+
+
+void ResourceWatcher::ReloadPack_() {
+    shared_ptr<ResourcePack> pack = ResourcePack::Load(packPath_, packPopulate_);
+    if(!pack) {   //新包不完整或损坏时继续使用旧包
+        LOG_WARN("ResourceWatcher: keep serving the previous pack");
+        return;
+    }
+    FileCache::Instance()->SetPack(root_, pack);
+    LOG_INFO("ResourceWatcher: reloaded %s, %d files", packPath_.c_str(), (int)pack->Count());
+}
+
+
+void ResourceWatcher::LogStats_() {
+    FileCache* files = FileCache::Instance();
+    ResponseCache* responses = ResponseCache::Instance();
+    LOG_INFO("ResourceWatcher: %llu events; FileCache hits %llu misses %llu invalidations %llu; "
+             "ResponseCache hits %llu misses %llu invalidations %llu",
+             (unsigned long long)Events(), (unsigned long long)files->Hits(), (unsigned long long)files->Misses(),
+             (unsigned long long)files->Invalidations(), (unsigned long long)responses->Hits(),
+             (unsigned long long)responses->Misses(), (unsigned long long)responses->Invalidations());
+}
@@ -0,0 +1,49 @@
+#ifndef RESOURCE_WATCHER_H
+#define RESOURCE_WATCHER_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+
+/*资源目录的inotify监视线程
+递归监视HttpConn::SrcDir下的所有目录，文件被修改、替换、删除、新建或改权限时，
+使FileCache中对应路径的条目失效，并清空ResponseCache（一次读到的一批事件只清一次）。
+两个缓存失效时都会推进epoch，请求线程的本地视图随之作废，命中路径不需要加锁。
+缓存键为SrcDir + 请求路径，这里按同样的方式拼接：SrcDir + "/css" + "/" + 文件名
+资源包模式下另外监视包所在的目录，新包被rename到包的路径上时重新加载并替换FileCache中的资源包；
+包必须先写到同一目录下的临时文件再rename，不能原地覆盖正在使用的包*/
+
+class ResourceWatcher {
+public:
+    explicit ResourceWatcher(const std::string& root);   // root与HttpConn::SrcDir相同，以'/'结尾
+    ~ResourceWatcher();
+
+    //资源包模式：在Start之前调用，packPath为资源包的绝对路径
+    void SetPack(const std::string& packPath, bool populate);
+    bool Start();   // inotify不可用时返回false，缓存退回按时间复查
+    void Stop();
+
+    uint64_t Events() const { return events_; }   // 已处理的inotify事件数
+
+private:
+    void Loop_();
+    void AddWatchTree_(const std::string& rel);   // 监视root_ + rel及其所有子目录
+    bool Handle_(const struct inotify_event* event);   // 返回资源是否可能发生了变化
+    void ReloadPack_();
+    void LogStats_();
+
+    std::string root_;
+    int inotifyFd_;
+    int wakeFd_;   // eventfd，Stop时唤醒监视线程
+    std::unordered_map<int, std::string> dirs_;   // 监视描述符 -> 相对root_的目录，如""、"/css"
+    std::string packPath_;   // 资源包路径，为空表示未启用资源包
+    std::string packName_;   // 资源包的文件名
+    bool packPopulate_;
+    int packWd_;   // 资源包所在目录的监视描述符
+    std::thread thread_;
+    std::atomic<uint64_t> events_;
+};
+
+#endif // RESOURCE_WATCHER_H
@@ -0,0 +1,126 @@
+#include "responsecache.h"
+
+#include <chrono>
+
+using namespace std;
+
+
+ResponseCache::ResponseCache(): maxBytes_(0), maxResponse_(0), ttlMS_(1000), bytes_(0),
+    epoch_(0), hits_(0), misses_(0), invalidations_(0) {}
+
+ResponseCache* ResponseCache::Instance() {
+    static ResponseCache cache;
+    return &cache;
+}
+
+void ResponseCache::Init(size_t maxBytes, size_t maxResponse, int ttlMS) {
+    lock_guard<mutex> locker(mtx_);
+    maxBytes_ = maxBytes;
+    maxResponse_ = maxResponse < maxBytes ? maxResponse : maxBytes;
+    ttlMS_ = ttlMS;
+    while(!lru_.empty() && bytes_ > maxBytes_) {
+        Erase_(index_.find(lru_.back().key));
+    }
+}
+
+
+int64_t ResponseCache::NowMS_() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// 先查线程本地视图（不加锁），epoch_变化、过期或条目已被淘汰释放时再查共享表
+ResponseRef ResponseCache::Get(const string& key) {
+    thread_local LocalView local;
+    uint64_t epoch = epoch_.load(memory_order_acquire);
+    if(local.epoch != epoch) {
+        local.responses.clear();
+        local.epoch = epoch;
+    }
+    int64_t now = NowMS_();
+    auto lit = local.responses.find(key);
+    if(lit != local.responses.end() && now < lit->second.expires) {
+        ResponseRef response = lit->second.response.lock();
+        if(response) {
+            hits_.fetch_add(1, memory_order_relaxed);
+            return response;
+        }
+    }
+    int64_t created = 0;
+    ResponseRef response = GetShared_(key, now, &created);
+    if(response) {
+        if(local.responses.size() >= LOCAL_MAX_ENTRIES) {
+            local.responses.clear();
+        }
+        int64_t expires = created + ttlMS_;
+        local.responses[key] = { response, expires < now + LOCAL_REFRESH_MS ? expires : now + LOCAL_REFRESH_MS };
+    }
+    return response;
+}
+
+ResponseRef ResponseCache::GetShared_(const string& key, int64_t now, int64_t* created) {
+    lock_guard<mutex> locker(mtx_);
+    auto it = index_.find(key);
+    if(it == index_.end()) {
+        misses_.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+    }
+    if(now - it->second->created >= ttlMS_) {
+        Erase_(it);   //过期，由调用方重新生成
+        misses_.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    hits_.fetch_add(1, memory_order_relaxed);
+    *created = it->second->created;
+    return it->second->response;
+}
+
+
+void ResponseCache::Put(const string& key, ResponseRef response, uint64_t epoch) {
+    size_t size = response->size() + key.size();
+    if(response->size() > maxResponse_) {
+        return;
+    }
+    lock_guard<mutex> locker(mtx_);
+    if(epoch_.load(memory_order_relaxed) != epoch) {
+        return;   //生成期间资源有变化，响应可能来自变化前的文件
+    }
+    auto it = index_.find(key);
+    if(it != index_.end()) {
+        Erase_(it);
+    }
+    while(!lru_.empty() && bytes_ + size > maxBytes_) {
+        Erase_(index_.find(lru_.back().key));   //淘汰最久未使用的条目
+    }
+    lru_.push_front({ key, std::move(response), NowMS_() });
+    index_.emplace(key, lru_.begin());
+    bytes_ += size;
+}
+
+void ResponseCache::Erase_(unordered_map<string, LruList::iterator>::iterator it) {
+    bytes_ -= it->second->response->size() + it->second->key.size();
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+
+// 先清空共享表再推进epoch_，各线程的本地视图在下次访问时丢弃
+void ResponseCache::Clear() {
+    lock_guard<mutex> locker(mtx_);
+    index_.clear();
+    lru_.clear();
+    bytes_ = 0;
+    invalidations_.fetch_add(1, memory_order_relaxed);
+    epoch_.fetch_add(1, memory_order_release);
+}
+
+size_t ResponseCache::Count() {
+    lock_guard<mutex> locker(mtx_);
+    return index_.size();
+}
+
+size_t ResponseCache::Bytes() {
+    lock_guard<mutex> locker(mtx_);
+    return bytes_;
+}
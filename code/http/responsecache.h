@@ -0,0 +1,82 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+
+/*小响应的整包缓存
+热门小页面（首页、登录页、4xx错误页等）的状态行、响应头和响应体拼成一个不可变的字符串，
+按请求路径、长短连接和可接受的压缩方式分别缓存。命中时连接直接把这个字符串放进writev，
+不再拼响应头，也不访问文件系统。条目在ttlMS后过期，由正常路径重新生成，文件的变化随之生效；
+ResourceWatcher监视到资源变化时Clear，推进epoch，各线程的本地视图随之作废，命中路径不加锁*/
+
+typedef std::shared_ptr<const std::string> ResponseRef;
+
+class ResponseCache {
+public:
+    static ResponseCache* Instance();
+
+    //maxBytes为总容量，maxResponse为单个响应的大小上限，0表示不缓存
+    void Init(size_t maxBytes, size_t maxResponse, int ttlMS = 1000);
+    size_t MaxResponse() const { return maxResponse_; }
+
+    ResponseRef Get(const std::string& key);
+    //epoch为生成响应之前（查缓存未命中时）读到的Epoch()，之后有过Clear时不缓存，避免把变化前的文件放回缓存
+    void Put(const std::string& key, ResponseRef response, uint64_t epoch);
+    uint64_t Epoch() const { return epoch_.load(std::memory_order_acquire); }
+    void Clear();
+
+    size_t Count();
+    size_t Bytes();
+    uint64_t Hits() const { return hits_; }
+    uint64_t Misses() const { return misses_; }
+    uint64_t Invalidations() const { return invalidations_; }
+
+private:
+    ResponseCache();
+    ~ResponseCache() = default;
+
+    struct Entry {
+        std::string key;
+        ResponseRef response;
+        int64_t created;   // 生成时刻（毫秒）
+    };
+    typedef std::list<Entry> LruList;   // 表头为最近使用
+
+    struct LocalEntry {
+        std::weak_ptr<const std::string> response;
+        int64_t expires;
+    };
+    struct LocalView {
+        uint64_t epoch = UINT64_MAX;
+        std::unordered_map<std::string, LocalEntry> responses;
+    };
+    static const size_t LOCAL_MAX_ENTRIES = 1024;   // 本地视图的条目上限，超过时清空
+    static const int64_t LOCAL_REFRESH_MS = 1000;   // 至少这么久回共享表一次，维持共享表的LRU顺序
+
+    ResponseRef GetShared_(const std::string& key, int64_t now, int64_t* created);
+
+    static int64_t NowMS_();
+    void Erase_(std::unordered_map<std::string, LruList::iterator>::iterator it);
+
+    size_t maxBytes_;
+    size_t maxResponse_;
+    int ttlMS_;
+
+    std::mutex mtx_;
+    LruList lru_;
+    std::unordered_map<std::string, LruList::iterator> index_;
+    size_t bytes_;
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> invalidations_;
+};
+
+#endif // RESPONSE_CACHE_H
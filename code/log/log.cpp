@@ -1,34 +1,74 @@
 #include "log.h"
 
+#include <sys/uio.h>
+#include <limits.h>
+#include <chrono>
+
 using namespace std;
 
+namespace {
+
+//线程本地的行缓冲区和时间戳缓存，格式化一行日志不加锁、不分配内存
+const size_t LINE_SIZE = 2048;
+
+struct LineCache {
+    time_t sec = -1;    // stamp对应的秒
+    int day = 0;        // 年*10000+月*100+日
+    char stamp[64];     // "YYYY-MM-DD HH:MM:SS"
+    char line[LINE_SIZE];
+    std::string big;    // 超过LINE_SIZE的行在这里格式化，容量留给本线程下一次使用
+};
+thread_local LineCache tLine;
+
+const char* LevelTitle(int level){
+    switch(level){
+        case 0:
+            return "[debug]: ";
+        case 2:
+            return "[warn] : ";
+        case 3:
+            return "[error]: ";
+        default:
+            return "[info] : ";
+    }
+}
+
+}
+
 Log::Log(){
     fp_ = nullptr;
-    deque_ = nullptr;
     writeThread_ = nullptr;
     lineCount_ = 0;
     toDay_ = 0;
+    fileDay_ = 0;
+    filePart_ = 0;
+    isOpen_ = false;
+    level_ = 1;
     isAsync_ = false;
+    running_ = false;
+    wakePending_ = false;
 }
 
 Log::~Log(){
-    while(!deque_->empty()){
-        deque_->flush();  //唤醒消费者，处理完队列中的所有任务
-    }
-    deque_->close();  //关闭队列
-    writeThread_->join(); //等待当前线程执行完
+    Stop_();   //写线程先把积压的缓冲区写完
     if(fp_){               //如果文件指针不为空，则关闭文件
-        lock_guard<mutex> locker(mtx_); 
-        Flush();     //清空缓冲区的数据
+        lock_guard<mutex> locker(mtx_);
+        fflush(fp_);     //清空缓冲区的数据
         fclose(fp_);  //关闭日志文件
     }
 }
 
 void Log::Flush(){
-    if(isAsync_){     //如果为异步写日志，则唤醒消费者线程
-        deque_->flush();
+    if(isAsync_){     //如果为异步写日志，则唤醒写线程；上一次唤醒还没被处理时不再重复通知
+        if(!wakePending_.exchange(true, memory_order_acq_rel)){
+            cond_.notify_one();
+        }
+        return;
+    }
+    lock_guard<mutex> locker(mtx_);
+    if(fp_){
+        fflush(fp_);   //清空缓冲区的数据
     }
-    fflush(fp_);   //清空缓冲区的数据
 }
 
 //懒汉模式 局部静态变量法 不需要加锁
@@ -43,150 +83,290 @@ void Log::FlushLogThread(){
     Log::Instance()->AsynWriteLog();
 }
 
-//异步写日志
+//异步写日志：换走写满的缓冲区和当前缓冲区，在锁外一次写入；写完的缓冲区留作下一轮的备用
 void Log::AsynWriteLog(){
-    string str = "";
-    while(deque_->pop(str)){
-        lock_guard<mutex> locker(mtx_);
-        fputs(str.c_str(), fp_);
+    unique_ptr<LogBuffer> spare1(new LogBuffer);
+    unique_ptr<LogBuffer> spare2(new LogBuffer);
+    vector<unique_ptr<LogBuffer>> batch;
+    bool stop = false;
+    while(!stop){
+        {
+            unique_lock<mutex> locker(mtx_);
+            if(full_.empty() && running_){
+                cond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS), [this]{
+                    return !full_.empty() || !running_ || wakePending_.load(memory_order_acquire);
+                });
+            }
+            wakePending_.store(false, memory_order_release);
+            if(current_ && current_->len > 0){
+                full_.push_back(move(current_));
+                current_ = move(spare1);
+            }
+            batch.swap(full_);
+            if(!next_){
+                next_ = move(spare2);
+            }
+            stop = !running_;
+        }
+
+        if(batch.size() > MAX_PENDING){   //写线程跟不上，只保留最早的两个缓冲区
+            char note[128];
+            int n = snprintf(note, sizeof(note), "Dropped log messages: %d buffers\n", (int)(batch.size() - 2));
+            fputs(note, stderr);
+            batch.resize(2);
+            if(batch[1]->len + n <= BUFFER_SIZE){
+                memcpy(batch[1]->data + batch[1]->len, note, n);
+                batch[1]->len += n;
+            }
+        }
+        WriteBuffers_(batch);
+
+        // 补足两个备用缓冲区，多余的释放
+        for(unique_ptr<LogBuffer>& buffer : batch){
+            buffer->len = 0;
+            if(!spare1){
+                spare1 = move(buffer);
+            }
+            else if(!spare2){
+                spare2 = move(buffer);
+            }
+        }
+        batch.clear();
+        if(!spare1){
+            spare1.reset(new LogBuffer);
+        }
+        if(!spare2){
+            spare2.reset(new LogBuffer);
+        }
     }
 }
 
-void Log::init(int level, const char* path, const char* suffix, int maxQueueCapacity){
-    isOpen_ = true;
-    level_ = level;
-    path_ = path;
-    suffix_ = suffix;
-    if(maxQueueCapacity > 0){
-        isAsync_ = true;
-        if(!deque_)
-        {
-            unique_ptr<BlockQueue<string>> newQue(new BlockQueue<string>); //unique_ptr智能指针，自动释放内存
-            deque_ = move(newQue);  //移动语义，将newQue指针赋值给deque_，newQue指针置空
+// 相邻且属于同一文件的缓冲区合成一次writev
+void Log::WriteBuffers_(vector<unique_ptr<LogBuffer>>& buffers){
+    struct iovec iov[IOV_MAX];
+    size_t i = 0;
+    while(i < buffers.size()){
+        LogBuffer* first = buffers[i].get();
+        if(!fp_ || first->day != fileDay_ || first->part != filePart_){
+            OpenFile_(first->day, first->part);
+        }
+        int cnt = 0;
+        size_t total = 0;
+        while(i < buffers.size() && cnt < IOV_MAX && buffers[i]->day == first->day && buffers[i]->part == first->part){
+            iov[cnt++] = { buffers[i]->data, buffers[i]->len };
+            total += buffers[i]->len;
+            i++;
+        }
+        int fd = fileno(fp_);
+        int start = 0;
+        while(total > 0){   //写不完（被信号打断等）时从断点续写
+            ssize_t len = writev(fd, iov + start, cnt - start);
+            if(len < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                break;
+            }
+            total -= len;
+            while(start < cnt && static_cast<size_t>(len) >= iov[start].iov_len){
+                len -= iov[start].iov_len;
+                start++;
+            }
+            if(start < cnt){
+                iov[start].iov_base = static_cast<char*>(iov[start].iov_base) + len;
+                iov[start].iov_len -= len;
+            }
+        }
+    }
+}
 
-            unique_ptr<thread> newThread(new thread(FlushLogThread)); //unique_ptr智能指针，自动释放内存
-            writeThread_ = move(newThread); //移动语义，将newThread指针赋值给writeThread_，newThread指针置空
+// 同步模式的定时刷新：行写进FLUSH_BYTES的文件缓冲，一段时间没有写满时由这里每FLUSH_INTERVAL_MS写出一次
+void Log::SyncFlush_(){
+    unique_lock<mutex> locker(mtx_);
+    while(running_){
+        cond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS), [this]{ return !running_; });
+        if(fp_){
+            fflush(fp_);
         }
     }
+}
+
+void Log::Stop_(){
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(!running_){
+            return;
+        }
+        running_ = false;
+    }
+    cond_.notify_one();
+    writeThread_->join();
+    writeThread_.reset();
+    //写线程退出之后追加的行由这里写完，之后的日志改为同步写入（直到下一次init）
+    lock_guard<mutex> locker(mtx_);
+    if(current_ && current_->len > 0){
+        full_.push_back(move(current_));
+    }
+    WriteBuffers_(full_);
+    full_.clear();
+    current_.reset();
+    next_.reset();
+    isAsync_ = false;
+}
+
+// 第part个分片（从0开始）：当天第一个文件不带编号，之后的文件名加"-part"
+void Log::OpenFile_(int day, int part){
+    char fileName[LOG_NAME_LEN] = {0};
+    if(part == 0){
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", path_, day / 10000, day / 100 % 100, day % 100, suffix_);
+    }
     else{
-        isAsync_ = false;
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d-%d%s", path_, day / 10000, day / 100 % 100, day % 100, part, suffix_);
     }
+    if(fp_){
+        fflush(fp_);
+        fclose(fp_);
+    }
+    fp_ = fopen(fileName, "a");  //以追加的方式打开文件
+    if(fp_ == nullptr){
+        mkdir(path_,0777);    //创建目录,0777表示权限,即所有用户可读可写可执行
+        fp_ = fopen(fileName, "a");
+    }
+    assert(fp_ != nullptr);  //断言，如果fp_为空，则程序终止
+    setvbuf(fp_, nullptr, _IOFBF, FLUSH_BYTES);   //同步模式攒够FLUSH_BYTES再写
+    fileDay_ = day;
+    filePart_ = part;
+}
 
+void Log::init(int level, const char* path, const char* suffix, int maxQueueCapacity){
+    Stop_();   //重新初始化时先把之前的日志写完
+    isOpen_ = true;
+    level_ = level;
+    path_ = path;
+    suffix_ = suffix;
     lineCount_ = 0;
 
     time_t timer = time(nullptr);     //获取当前时间
-    struct tm *sysTime = localtime(&timer);   //获取本地时间
-    struct tm logTime = *sysTime;   //获取本地时间
-    char fileName[LOG_NAME_LEN] = {0};    //日志文件名
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", path_, logTime.tm_year + 1900, logTime.tm_mon + 1, logTime.tm_mday, suffix_);
-    toDay_ = logTime.tm_mday;
+    struct tm logTime;
+    localtime_r(&timer, &logTime);   //获取本地时间
+    toDay_ = (logTime.tm_year + 1900) * 10000 + (logTime.tm_mon + 1) * 100 + logTime.tm_mday;
 
     {
         lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();
-        if(fp_){     //重新打开文件
-            Flush();
-            fclose(fp_);
+        OpenFile_(toDay_, 0);
+        isAsync_ = maxQueueCapacity > 0;
+        running_ = true;
+        if(isAsync_){
+            current_.reset(new LogBuffer);
+            next_.reset(new LogBuffer);
+            full_.clear();
+            unique_ptr<thread> newThread(new thread(FlushLogThread)); //unique_ptr智能指针，自动释放内存
+            writeThread_ = move(newThread); //移动语义，将newThread指针赋值给writeThread_，newThread指针置空
         }
-        fp_ = fopen(fileName, "a");  //以追加的方式打开文件
-        if(fp_ == nullptr){
-            mkdir(path_,0777);    //创建目录,0777表示权限,即所有用户可读可写可执行
-            fp_ = fopen(fileName, "a"); 
+        else{
+            writeThread_.reset(new thread(&Log::SyncFlush_, this));   //同步模式只需要定时刷新
         }
-        assert(fp_ != nullptr);  //断言，如果fp_为空，则程序终止
     }
+}
 
+// 调用方持有mtx_：当前缓冲区交给写线程，换上备用缓冲区（都在写线程手里时新分配一个）
+void Log::Seal_(){
+    full_.push_back(move(current_));
+    if(next_){
+        current_ = move(next_);
+    }
+    else{
+        current_.reset(new LogBuffer);
+    }
+    cond_.notify_one();
 }
 
 void Log::WriteLog(int level, const char* format, ...)
 {
     struct timeval now = {0, 0};
     gettimeofday(&now, nullptr);   //获取当前时间
-    time_t tSec = now.tv_sec;   //
-    struct tm *sysTime = localtime(&tSec);   //获取本地时间
-    struct tm logTime = *sysTime; 
-    va_list vaList;
-
-    if(toDay_ != logTime.tm_mday || (lineCount_ && (lineCount_ % MAX_LINES == 0))){
-        unique_lock<mutex> locker(mtx_);
-        locker.unlock();
-
-        char newFileName[LOG_NAME_LEN] = {0};
-        char tail[36] = {0};  
-        snprintf(tail, 36, "%04d_%02d_%02d", logTime.tm_year + 1900, logTime.tm_mon + 1, logTime.tm_mday);
-        if(toDay_ != logTime.tm_mday){
-            snprintf(newFileName, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);  //
-            toDay_ = logTime.tm_mday;
-            lineCount_ = 0;  //如果日期改变，则将行数置为0
-        }
-        else{
-            snprintf(newFileName, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_ / MAX_LINES), suffix_);  
-        }
-        locker.lock();
-        Flush();
-        fclose(fp_);
-        fp_ = fopen(newFileName, "a");
-        assert(fp_ != nullptr);
+    LineCache& cache = tLine;
+    if(now.tv_sec != cache.sec){   //每秒只做一次本地时间转换
+        struct tm logTime;
+        localtime_r(&now.tv_sec, &logTime);
+        snprintf(cache.stamp, sizeof(cache.stamp), "%04d-%02d-%02d %02d:%02d:%02d",
+            logTime.tm_year + 1900, logTime.tm_mon + 1, logTime.tm_mday,
+            logTime.tm_hour, logTime.tm_min, logTime.tm_sec);
+        cache.day = (logTime.tm_year + 1900) * 10000 + (logTime.tm_mon + 1) * 100 + logTime.tm_mday;
+        cache.sec = now.tv_sec;
     }
 
+    //在线程本地缓冲区内生成一条对应的日志信息：时间戳、级别、正文、换行
+    char* line = cache.line;
+    memcpy(line, cache.stamp, 19);
+    line[19] = '.';
+    long usec = now.tv_usec;
+    for(int i = 25; i >= 20; i--){
+        line[i] = static_cast<char>('0' + usec % 10);
+        usec /= 10;
+    }
+    line[26] = ' ';
+    memcpy(line + 27, LevelTitle(level), 9);
+    const size_t head = 36;
 
-    //在buff内生成一条对应的日志信息
-    {
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(),128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-            logTime.tm_year + 1900, logTime.tm_mon + 1, logTime.tm_mday,
-            logTime.tm_hour, logTime.tm_min, logTime.tm_sec, now.tv_usec);
-        assert(n > 0);
-        buff_.HasWritten(n);
-        AppendLogLevelTitle(level);
-
+    va_list vaList;
+    va_start(vaList, format);
+    int m = vsnprintf(line + head, LINE_SIZE - head, format, vaList);  //将可变参数格式化到行缓冲区中
+    va_end(vaList);
+    if(m < 0){
+        m = 0;
+    }
+    else if(static_cast<size_t>(m) >= LINE_SIZE - head){   //放不下，换到足够大的线程本地字符串中重新格式化
+        cache.big.resize(head + m + 2);
+        memcpy(&cache.big[0], line, head);
+        line = &cache.big[0];
         va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);  //将可变参数格式化到buff_中
+        vsnprintf(line + head, m + 1, format, vaList);
         va_end(vaList);
+    }
+    size_t len = head + m;
+    line[len++] = '\n';
 
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
-
-        if(isAsync_ && deque_ && !deque_->full()){  //如果为异步写日志，则将日志信息放入队列中
-            deque_->push_back(buff_.RetrieveAllToStr());  //将buff_中的数据放入队列中
+    unique_lock<mutex> locker(mtx_);
+    if(toDay_ != cache.day){
+        toDay_ = cache.day;
+        lineCount_ = 0;  //如果日期改变，则将行数置为0
+    }
+    int part = lineCount_ / MAX_LINES;
+    lineCount_++;
+    if(!isAsync_){
+        if(!fp_ || toDay_ != fileDay_ || part != filePart_){
+            OpenFile_(toDay_, part);
         }
-        else{
-            fputs(buff_.Peek(), fp_);  //将buff_中的数据写入文件
+        fwrite(line, 1, len, fp_);  //将行写入文件
+        if(level >= 3){   //ERROR立即刷新，其他的等文件缓冲写满或SyncFlush_定时刷新
+            fflush(fp_);
         }
-        buff_.RetrieveAll(); //清空buff_
+        return;
     }
-}
-
-//根据日志级别，添加对应的日志级别标题
-void Log::AppendLogLevelTitle(int level){
-    switch(level){
-        case 0:
-            buff_.Append("[debug]: ", 9);
-            break;
-        case 1:
-            buff_.Append("[info] : ", 9);
-            break;
-        case 2:
-            buff_.Append("[warn] : ", 9);
-            break;
-        case 3:
-            buff_.Append("[error]: ", 9);
-            break;
-        default:
-            buff_.Append("[info] : ", 9);
-            break;
+    // 缓冲区只装同一个文件的行；装不下或要换文件时先交给写线程
+    if(current_->len > 0 && (current_->day != toDay_ || current_->part != part || current_->len + len > BUFFER_SIZE)){
+        Seal_();
+    }
+    if(current_->len == 0){
+        current_->day = toDay_;
+        current_->part = part;
+    }
+    while(len > 0){   //超过一个缓冲区的行拆开存放，写入时仍然相邻
+        size_t n = min(len, BUFFER_SIZE - current_->len);
+        memcpy(current_->data + current_->len, line, n);
+        current_->len += n;
+        line += n;
+        len -= n;
+        if(len > 0){
+            Seal_();
+            current_->day = toDay_;
+            current_->part = part;
+        }
+    }
+    locker.unlock();
+    if(level >= 3){   //ERROR不等定时唤醒，立即交给写线程
+        Flush();
     }
 }
 
-
-//获取日志级别
-int Log::GetLevel(){
-    lock_guard<mutex> locker(mtx_);
-    return level_;
-}
-
-void Log::SetLevel(int level){
-    lock_guard<mutex> locker(mtx_);
-    level_ = level;
-}
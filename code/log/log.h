@@ -4,34 +4,63 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
 #include <sys/time.h>
 #include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 #include <sys/stat.h>
-#include "blockqueue.h"
-#include "../buffer/buffer.h"
+
+/*日志
+每行日志在调用线程的线程本地缓冲区中格式化（时间戳的年月日时分秒每秒只算一次），不加锁、不分配内存。
+同步模式下加锁后直接写入文件；异步模式采用前后台双缓冲：
+加锁只是把这一行拷进前台的大缓冲区（BUFFER_SIZE），写满时换上备用缓冲区并唤醒写线程；
+写线程被唤醒或每隔FLUSH_INTERVAL_MS把写满的缓冲区连同当前缓冲区一起换走，在锁外用一次writev写入文件，
+写完的缓冲区留作备用，稳定后不再分配内存。
+按天、按MAX_LINES行切分文件的规则不变：一个缓冲区只装同一个文件的行，写线程据此切换文件。
+调用方不再逐行刷新：异步时由缓冲区写满和写线程的定时唤醒驱动，同步时由FLUSH_BYTES的文件缓冲写满和
+刷新线程每FLUSH_INTERVAL_MS一次的定时刷新驱动，ERROR级别的日志写完立即刷新。日志级别是原子变量，宏里判断级别不加锁*/
 
 class Log{
 public:
-    void init(int level,const char* path = "./log",const char* suffix = ".log",int maxQueueCapacity = 1024);   //初始化日志实例（设置日志级别，日志保存路径，日志文件后缀，阻塞队列最大容量）
+    void init(int level,const char* path = "./log",const char* suffix = ".log",int maxQueueCapacity = 1024);   //初始化日志实例（设置日志级别，日志保存路径，日志文件后缀，maxQueueCapacity大于0时异步写日志）
     static Log* Instance();   //获取日志实例
-    static void FlushLogThread();   //异步刷新日志线程
+    static void FlushLogThread();   //异步写日志线程
 
     void WriteLog(int level,const char* format,...);   //写日志
-    void Flush();   //刷新日志
+    void Flush();   //刷新日志：异步时唤醒写线程，同步时清空文件缓冲
 
-    int GetLevel();   //获取日志级别
-    void SetLevel(int level);   //设置日志级别
+    int GetLevel() const { return level_.load(std::memory_order_relaxed); }   //获取日志级别
+    void SetLevel(int level) { level_.store(level, std::memory_order_relaxed); }   //设置日志级别
 
-    bool IsOpen() {return isOpen_;}   //判断日志是否打开
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }   //判断日志是否打开
 
+    static const size_t BUFFER_SIZE = 1 << 20;   //异步模式每个缓冲区的大小
+    static const int FLUSH_INTERVAL_MS = 1000;   //写线程（同步模式为刷新线程）至少每隔这么久写一次
+    static const size_t MAX_PENDING = 16;   //写线程落后时最多积压的缓冲区数，超出的丢弃并记一行说明
+    static const size_t FLUSH_BYTES = 64 * 1024;   //同步模式的文件缓冲大小，写满时由stdio写入
 
 private:
     Log();   //构造函数私有化，禁止外部创建实例
     virtual ~Log();
     void AsynWriteLog();   //异步写日志
-    void AppendLogLevelTitle(int level);   //追加日志级别
+
+    //异步模式的缓冲区：只装同一个日志文件（日期、分片相同）的行
+    struct LogBuffer {
+        size_t len = 0;
+        int day = 0;    // 年*10000+月*100+日
+        int part = 0;   // 当天的第几个文件
+        char data[BUFFER_SIZE];
+    };
+
+    void SyncFlush_();   //同步模式的刷新线程
+    void Stop_();   //停止写线程或刷新线程，积压的日志全部写完
+    void Seal_();   //当前缓冲区写满或要换文件，交给写线程
+    void OpenFile_(int day, int part);   //打开日志对应的文件
+    void WriteBuffers_(std::vector<std::unique_ptr<LogBuffer>>& buffers);   //按文件分组，每组一次writev
 
 private:
     static const int LOG_PATH_LEN = 256;   //日志路径长度
@@ -41,29 +70,45 @@ private:
     const char* path_;   //日志保存路径
     const char* suffix_;   //日志文件后缀
 
-    int MAX_LINES_;   //日志文件最大行数
-    int lineCount_;   //日志文件当前行数
-    int toDay_;   //日志文件当前日期
+    int lineCount_;   //当天已写的行数
+    int toDay_;   //最后一行日志的日期（年*10000+月*100+日）
+    int fileDay_;    //fp_对应的日期和分片
+    int filePart_;
 
-    bool isOpen_;   //日志是否打开
+    std::atomic<bool> isOpen_;   //日志是否打开
 
-    Buffer buff_;   //日志缓冲区
-    int level_;   //日志级别
-    bool isAsync_;   //是否异步写日志
+    std::atomic<int> level_;   //日志级别
+    std::atomic<bool> isAsync_;   //是否异步写日志
 
-    FILE* fp_;    //日志文件指针
-    std::unique_ptr<BlockQueue<std::string>> deque_;   //阻塞队列
-    std::unique_ptr<std::thread> writeThread_;   //写日志线程
+    FILE* fp_;    //日志文件指针，异步时只由写线程通过文件描述符写入
+    std::unique_ptr<LogBuffer> current_;   //前台缓冲区，生产者追加到这里
+    std::unique_ptr<LogBuffer> next_;      //备用的前台缓冲区
+    std::vector<std::unique_ptr<LogBuffer>> full_;   //待写入的缓冲区
+    bool running_;   //写线程或刷新线程是否运行
+    std::atomic<bool> wakePending_;   //已经请求过写线程尽快写入
+    std::condition_variable cond_;
+    std::unique_ptr<std::thread> writeThread_;   //写日志线程，同步模式下为刷新线程
     std::mutex mtx_;   //互斥锁
 
 };
 
+//编译期的最低日志级别，低于它的LOG_*调用在编译时就被去掉（条件为常量假，参数也不会求值）
+//默认定义了NDEBUG时为1（去掉LOG_DEBUG），否则为0；也可以在编译选项中用-DLOG_MIN_LEVEL=n指定
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL 1
+#else
+#define LOG_MIN_LEVEL 0
+#endif
+#endif
+
 #define LOG_BASE(level, format, ...)\
     do{\
-        Log* log = Log::Instance();\
-        if(log->IsOpen() && log->GetLevel() <= level){\
-            log->WriteLog(level, format, ##__VA_ARGS__);\
-            log->Flush();\
+        if((level) >= LOG_MIN_LEVEL){\
+            Log* log = Log::Instance();\
+            if(log->IsOpen() && log->GetLevel() <= (level)){\
+                log->WriteLog(level, format, ##__VA_ARGS__);\
+            }\
         }\
     }while(0);
 
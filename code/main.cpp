@@ -6,6 +6,11 @@ int main() {
     WebServer server(
         9006, 3, 60000,              // 端口 ET模式 timeoutMs 
         3306, "debian-sys-maint", "OvSKsE6tiqbCFevi", "webserver", /* Mysql配置 */
-        12, 8, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 8, true, 1, 1024,             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        0, false,                         /* 子Reactor数量：0为单Reactor+线程池，>0为多Reactor(SO_REUSEPORT) 多Reactor下是否使用io_uring */
+        64, 1024, 64,                     /* 静态文件缓存容量(MB) 缓存文件数上限 sendfile文件大小阈值(KB) */
+        8, 32, true,                      /* 小响应整包缓存容量(MB) 单个响应上限(KB) 监视资源目录变化 */
+        0,                                /* 资源包模式：0关闭 1打包并映射 2打包并预读(MAP_POPULATE) */
+        4, 60);                           /* 用户缓存容量(MB) 用户缓存有效期(秒) */
     server.Start();
 }
@@ -0,0 +1,393 @@
+#include "sqlasync.h"
+#include "usercache.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <string.h>
+
+using namespace std;
+
+
+SqlNotifier::SqlNotifier(): fd_(-1) {}
+
+SqlNotifier::~SqlNotifier(){
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+bool SqlNotifier::Init(){
+    fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return fd_ >= 0;
+}
+
+void SqlNotifier::Push(uint64_t key, bool ok){
+    {
+        lock_guard<mutex> locker(mtx_);
+        results_.push_back({ key, ok });
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(fd_, &one, sizeof(one));
+    (void)ret;
+}
+
+void SqlNotifier::Pop(vector<SqlResult>& results){
+    uint64_t cnt;
+    ssize_t ret = read(fd_, &cnt, sizeof(cnt));   //清零计数，之后Push的结果会再次唤醒
+    (void)ret;
+    results.clear();
+    lock_guard<mutex> locker(mtx_);
+    results.swap(results_);
+}
+
+
+SqlAsync* SqlAsync::Instance(){
+    static SqlAsync sqlAsync;
+    return &sqlAsync;
+}
+
+SqlAsync::SqlAsync(): epollFd_(-1), wakeFd_(-1), stop_(false) {}
+
+SqlAsync::~SqlAsync(){
+    Close();
+}
+
+int64_t SqlAsync::NowMS_(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// 连接在启动时阻塞建立（MYSQL_OPT_NONBLOCK的连接仍可使用阻塞接口），之后的查询都走_start/_cont
+bool SqlAsync::Init(const char* host, uint16_t port, const char* user, const char* passwd, const char* dbName, int connNum){
+    assert(connNum > 0 && !IsOpen());
+#if !SQL_ASYNC
+    (void)host; (void)port; (void)user; (void)passwd; (void)dbName;
+    LOG_WARN("Mysql client library has no non-blocking API");
+    return false;
+#else
+    for(int i = 0; i < connNum; i++){
+        MYSQL* sql = mysql_init(nullptr);
+        if(!sql){
+            LOG_ERROR("Mysql init error!");
+            break;
+        }
+        if(mysql_options(sql, MYSQL_OPT_NONBLOCK, 0) != 0){
+            LOG_WARN("Mysql client library has no non-blocking API");
+            mysql_close(sql);
+            break;
+        }
+        my_bool reconnect = 1;
+        mysql_options(sql, MYSQL_OPT_RECONNECT, &reconnect);
+        if(!mysql_real_connect(sql, host, user, passwd, dbName, port, nullptr, 0)){
+            LOG_ERROR("Mysql connect error: %s", mysql_error(sql));
+            mysql_close(sql);
+            break;
+        }
+        Conn conn = {};
+        conn.sql = sql;
+        conn.threadId = mysql_thread_id(sql);
+        conn.fd = -1;
+        conn.deadline = -1;
+        conns_.push_back(conn);
+    }
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(static_cast<int>(conns_.size()) < connNum || epollFd_ < 0 || wakeFd_ < 0){
+        Close();
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = conns_.size();   //唤醒事件用连接数作为下标，与各连接区分
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+    stop_ = false;
+    thread_ = thread(&SqlAsync::Loop_, this);
+    LOG_INFO("SqlAsync: %d non-blocking connections", connNum);
+    return true;
+#endif
+}
+
+void SqlAsync::Close(){
+    if(thread_.joinable()){
+        stop_ = true;
+        uint64_t one = 1;
+        ssize_t ret = write(wakeFd_, &one, sizeof(one));
+        (void)ret;
+        thread_.join();
+    }
+    for(Conn& conn : conns_){
+        CloseStmts_(conn);
+        mysql_close(conn.sql);
+    }
+    conns_.clear();
+    tasks_.clear();
+    if(epollFd_ >= 0){
+        close(epollFd_);
+        epollFd_ = -1;
+    }
+    if(wakeFd_ >= 0){
+        close(wakeFd_);
+        wakeFd_ = -1;
+    }
+}
+
+
+void SqlAsync::Verify(const string& name, const string& pwd, bool isLogin, SqlNotifier* notifier, uint64_t key){
+    assert(notifier);
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(tasks_.size() < MAX_TASKS){
+            tasks_.push_back({ name, pwd, isLogin, notifier, key });
+            key = 0;
+            notifier = nullptr;
+        }
+    }
+    if(notifier){
+        LOG_WARN("SqlAsync busy!");
+        notifier->Push(key, false);
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd_, &one, sizeof(one));
+    (void)ret;
+}
+
+
+void SqlAsync::CloseStmts_(Conn& conn, int keep){
+    for(int i = 0; i < STMT_COUNT; i++){
+        if(i != keep && conn.stmts[i]){
+            mysql_stmt_close(conn.stmts[i]);
+            conn.stmts[i] = nullptr;
+        }
+    }
+}
+
+
+#if SQL_ASYNC
+void SqlAsync::Loop_(){
+    vector<struct epoll_event> events(conns_.size() + 1);
+    while(!stop_){
+        int64_t now = NowMS_();
+        int timeoutMS = -1;
+        for(const Conn& conn : conns_){
+            if(conn.deadline >= 0 && (timeoutMS < 0 || conn.deadline - now < timeoutMS)){
+                timeoutMS = conn.deadline > now ? static_cast<int>(conn.deadline - now) : 0;
+            }
+        }
+        int n = epoll_wait(epollFd_, events.data(), events.size(), timeoutMS);
+        if(n < 0 && errno != EINTR){
+            LOG_ERROR("SqlAsync epoll error, errno: %d", errno);
+            break;
+        }
+        for(int i = 0; i < n; i++){
+            uint32_t idx = events[i].data.u32;
+            if(idx == conns_.size()){
+                uint64_t cnt;
+                ssize_t ret = read(wakeFd_, &cnt, sizeof(cnt));
+                (void)ret;
+                continue;
+            }
+            Conn& conn = conns_[idx];
+            if(conn.step == STEP_IDLE){
+                continue;
+            }
+            // 出错或挂断时按可读可写处理，由客户端库自己发现错误
+            uint32_t ev = events[i].events;
+            int ready = 0;
+            if(ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) ready |= MYSQL_WAIT_READ;
+            if(ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) ready |= MYSQL_WAIT_WRITE;
+            if(ev & EPOLLPRI) ready |= MYSQL_WAIT_EXCEPT;
+            Run_(conn, Continue_(conn, ready));
+        }
+        now = NowMS_();
+        for(Conn& conn : conns_){
+            if(conn.step != STEP_IDLE && conn.deadline >= 0 && conn.deadline <= now){
+                Run_(conn, Continue_(conn, MYSQL_WAIT_TIMEOUT));
+            }
+        }
+        Dispatch_();
+    }
+}
+
+void SqlAsync::Dispatch_(){
+    for(Conn& conn : conns_){
+        while(conn.step == STEP_IDLE){   //任务可能立即完成（如用户名为空），连接仍空闲时继续取下一个
+            {
+                lock_guard<mutex> locker(mtx_);
+                if(tasks_.empty()){
+                    return;
+                }
+                conn.task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            Start_(conn);
+        }
+    }
+}
+
+
+void SqlAsync::Start_(Conn& conn){
+    if(conn.task.name.empty() || conn.task.pwd.empty()){
+        Finish_(conn, false);
+        return;
+    }
+    LOG_DEBUG("SqlAsync verify name = %s", conn.task.name.c_str());
+    conn.retried = false;
+    // 注册时Bloom过滤器确定用户名不存在，跳过SELECT，INSERT本身只在不存在时插入
+    bool skipSelect = !conn.task.isLogin && !UserCache::Instance()->MayExist(conn.task.name);
+    Run_(conn, Exec_(conn, skipSelect ? STMT_INSERT_USER : STMT_SELECT_USER));
+}
+
+int SqlAsync::Exec_(Conn& conn, SQL_STMT id){
+    conn.stmtId = id;
+    MYSQL_STMT*& stmt = conn.stmts[id];
+    if(!stmt){
+        conn.step = STEP_PREPARE;
+        stmt = mysql_stmt_init(conn.sql);
+        if(!stmt){
+            conn.err = 1;
+            return 0;
+        }
+        return mysql_stmt_prepare_start(&conn.err, stmt, SQL_STMT_TEXT[id], strlen(SQL_STMT_TEXT[id]));
+    }
+    // 参数绑定的是task中的字符串，任务完成前不会改动
+    conn.step = id == STMT_SELECT_USER ? STEP_SELECT : STEP_INSERT;
+    if(!conn.bind.BindParams(stmt, conn.task.name, id == STMT_INSERT_USER ? &conn.task.pwd : nullptr)){
+        conn.err = 1;
+        return 0;
+    }
+    return mysql_stmt_execute_start(&conn.err, stmt);
+}
+
+int SqlAsync::Continue_(Conn& conn, int ready){
+    MYSQL_STMT* stmt = conn.stmts[conn.stmtId];
+    switch(conn.step){
+    case STEP_PREPARE:
+        return mysql_stmt_prepare_cont(&conn.err, stmt, ready);
+    case STEP_STORE:
+        return mysql_stmt_store_result_cont(&conn.err, stmt, ready);
+    default:
+        return mysql_stmt_execute_cont(&conn.err, stmt, ready);
+    }
+}
+
+// 每一步完成（status为0）后根据结果开始下一步，需要等待IO时把socket注册到epoll上
+void SqlAsync::Run_(Conn& conn, int status){
+    while(status == 0){
+        MYSQL_STMT*& stmt = conn.stmts[conn.stmtId];
+        switch(conn.step){
+        case STEP_PREPARE:
+            if(conn.err){
+                LOG_ERROR("Prepare error: %s", stmt ? mysql_stmt_error(stmt) : mysql_error(conn.sql));
+                if(stmt){
+                    mysql_stmt_close(stmt);
+                    stmt = nullptr;
+                }
+                Finish_(conn, false);
+                return;
+            }
+            if(mysql_thread_id(conn.sql) != conn.threadId){   //预编译时发生了重连，旧连接上的语句都已失效
+                CloseStmts_(conn, conn.stmtId);
+                conn.threadId = mysql_thread_id(conn.sql);
+            }
+            status = Exec_(conn, conn.stmtId);
+            break;
+        case STEP_SELECT:
+            if(conn.err){
+                LOG_ERROR("Query Error: %s", mysql_stmt_error(stmt));
+                if(conn.retried || !SqlConnPool::IsStmtLost(mysql_stmt_errno(stmt))){
+                    Finish_(conn, false);
+                    return;
+                }
+                // 连接断开：丢弃全部语句，重新预编译（预编译时自动重连）后再查一次
+                conn.retried = true;
+                CloseStmts_(conn);
+                status = Exec_(conn, STMT_SELECT_USER);
+                break;
+            }
+            conn.step = STEP_STORE;
+            status = mysql_stmt_store_result_start(&conn.err, stmt);
+            break;
+        case STEP_STORE: {
+            if(conn.err){
+                LOG_ERROR("Store result error: %s", mysql_stmt_error(stmt));
+                Finish_(conn, false);
+                return;
+            }
+            // 结果集已经完整取回，读取和释放都不再有IO
+            bool found;
+            bool match = conn.bind.FetchUser(stmt, conn.task.pwd, &found);
+            if(conn.bind.pwdValid){
+                UserCache::Instance()->Put(conn.task.name, conn.bind.pwd, conn.bind.pwdLen);
+            }
+            else if(!found){
+                UserCache::Instance()->Erase(conn.task.name);
+            }
+            bool ok = conn.task.isLogin ? match : !found;
+            if(conn.task.isLogin || !ok){
+                LOG_INFO("Verify %s: %s", conn.task.name.c_str(), conn.task.isLogin ? (ok ? "ok" : "password is not correct") : "user already exists");
+                Finish_(conn, ok);
+                return;
+            }
+            status = Exec_(conn, STMT_INSERT_USER);   //插入不重试，连接断开时无法确定是否已经插入
+            break;
+        }
+        case STEP_INSERT: {
+            bool ok = conn.err == 0 && mysql_stmt_affected_rows(stmt) == 1;
+            if(conn.err){
+                LOG_ERROR("Insert Error: %s", mysql_stmt_error(stmt));
+            }
+            else if(!ok){
+                LOG_INFO("Verify %s: user already exists", conn.task.name.c_str());
+            }
+            else{
+                UserCache::Instance()->Put(conn.task.name, conn.task.pwd.data(), conn.task.pwd.size());   //写穿
+            }
+            Finish_(conn, ok);
+            return;
+        }
+        default:
+            return;
+        }
+    }
+    Wait_(conn, status);
+}
+
+void SqlAsync::Wait_(Conn& conn, int status){
+    struct epoll_event ev = {};
+    ev.data.u32 = &conn - conns_.data();
+    if(status & MYSQL_WAIT_READ) ev.events |= EPOLLIN;
+    if(status & MYSQL_WAIT_WRITE) ev.events |= EPOLLOUT;
+    if(status & MYSQL_WAIT_EXCEPT) ev.events |= EPOLLPRI;
+    int fd = mysql_get_socket(conn.sql);
+    if(fd != conn.fd){   //重连后socket会变
+        if(conn.fd >= 0){
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        }
+        conn.fd = epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) == 0 ? fd : -1;
+    }
+    else{
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+    }
+    conn.deadline = (status & MYSQL_WAIT_TIMEOUT) ? NowMS_() + mysql_get_timeout_value(conn.sql) * 1000LL : -1;
+}
+
+// 空闲的socket从epoll中摘除：epoll总会报告EPOLLHUP/EPOLLERR，留在epoll里时服务端断开空闲连接会让数据库线程空转，
+// 断开由下一个任务的查询发现并自动重连，Wait_时重新注册
+void SqlAsync::Finish_(Conn& conn, bool ok){
+    if(conn.fd >= 0){
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        conn.fd = -1;
+    }
+    conn.step = STEP_IDLE;
+    conn.deadline = -1;
+    conn.task.notifier->Push(conn.task.key, ok);
+    conn.task = Task();
+}
+#endif
@@ -0,0 +1,122 @@
+#ifndef SQLASYNC_H
+#define SQLASYNC_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include "../log/log.h"
+#include "sqlconnpool.h"
+
+/*非阻塞数据库访问，基于MariaDB Connector/C的mysql_stmt_execute_start/_cont等接口
+一个数据库线程持有全部连接，把各连接的socket注册在自己的epoll上推进查询，
+IO线程（线程池工作线程、子Reactor）只负责提交任务，数据库再慢也不会占住它们。
+查询结果通过SqlNotifier投递回提交任务的事件循环，由它恢复被挂起的请求。
+这些接口只有MariaDB Connector/C提供（可通过libmariadb的libmysqlclient兼容库链接），
+用Oracle MySQL的客户端库编译时SQL_ASYNC为0，Init直接返回false，登录/注册仍走连接池的阻塞查询*/
+
+#if defined(MARIADB_BASE_VERSION) || defined(LIBMARIADB)
+#define SQL_ASYNC 1
+#else
+#define SQL_ASYNC 0
+#endif
+
+struct SqlResult {
+    uint64_t key;   // 提交方的连接标识（代数<<32 | fd，与ConnSlab::Key相同）
+    bool ok;
+};
+
+//数据库结果的投递通道：数据库线程Push，所属的事件循环在Fd()可读时Pop出全部结果
+class SqlNotifier {
+public:
+    SqlNotifier();
+    ~SqlNotifier();
+    SqlNotifier(const SqlNotifier&) = delete;
+    SqlNotifier& operator=(const SqlNotifier&) = delete;
+
+    bool Init();
+    int Fd() const { return fd_; }
+    void Push(uint64_t key, bool ok);
+    void Pop(std::vector<SqlResult>& results);
+
+private:
+    int fd_;   // eventfd
+    std::mutex mtx_;
+    std::vector<SqlResult> results_;
+};
+
+class SqlAsync {
+public:
+    static SqlAsync* Instance();
+
+    //建立connNum条非阻塞连接并启动数据库线程；客户端库不支持非阻塞接口或连接失败时返回false
+    bool Init(const char* host, uint16_t port, const char* user, const char* passwd, const char* dbName, int connNum);
+    void Close();
+    bool IsOpen() const { return thread_.joinable(); }
+
+    //登录/注册校验，结果投递到notifier；排队的任务过多时直接投递失败
+    void Verify(const std::string& name, const std::string& pwd, bool isLogin, SqlNotifier* notifier, uint64_t key);
+
+    static const size_t MAX_TASKS = 4096;   // 排队等待连接的任务上限
+
+private:
+    SqlAsync();
+    ~SqlAsync();
+
+    struct Task {
+        std::string name;
+        std::string pwd;
+        bool isLogin;
+        SqlNotifier* notifier;
+        uint64_t key;
+    };
+
+    enum STEP {
+        STEP_IDLE,
+        STEP_PREPARE,  // 预编译conn.stmtId对应的语句，完成后执行它
+        STEP_SELECT,   // 查询用户名
+        STEP_STORE,    // 取回结果集
+        STEP_INSERT    // 注册：插入新用户
+    };
+
+    struct Conn {
+        MYSQL* sql;
+        STEP step;
+        Task task;
+        MYSQL_STMT* stmts[STMT_COUNT];   // 本连接上预编译好的语句，首次使用时预编译
+        unsigned long threadId;          // 预编译时的连接线程ID，重连后会变
+        SQL_STMT stmtId;                 // 正在预编译或执行的语句
+        UserStmtBind bind;
+        bool retried;                    // 本任务已因连接断开重试过
+        int err;             // start/_cont的返回值
+        int fd;              // 已注册到epoll的socket，-1表示未注册
+        int64_t deadline;    // MYSQL_WAIT_TIMEOUT的到期时间（毫秒），-1表示没有
+    };
+
+    void Loop_();
+    void Dispatch_();   // 把排队的任务分给空闲连接
+    void Start_(Conn& conn);
+    int Exec_(Conn& conn, SQL_STMT id);   // 返回start的状态，语句尚未预编译时先开始预编译
+    void Run_(Conn& conn, int status);   // 推进到需要等待IO或任务完成，status为上一步start/cont的返回值
+    int Continue_(Conn& conn, int ready);
+    void Wait_(Conn& conn, int status);
+    void Finish_(Conn& conn, bool ok);
+    static void CloseStmts_(Conn& conn, int keep = -1);
+
+    static int64_t NowMS_();
+
+    std::vector<Conn> conns_;
+    int epollFd_;
+    int wakeFd_;   // eventfd，有新任务或Close时唤醒数据库线程
+    std::atomic<bool> stop_;
+    std::thread thread_;
+
+    std::mutex mtx_;
+    std::deque<Task> tasks_;
+};
+
+#endif // SQLASYNC_H
@@ -1,5 +1,43 @@
 #include "sqlconnpool.h"
 
+#include <string.h>
+#include <mysql/errmsg.h>
+
+using namespace std;
+
+const char* const SQL_STMT_TEXT[STMT_COUNT] = {
+    "SELECT password FROM user WHERE username = ? LIMIT 1",
+    "INSERT INTO user(username, password) SELECT ?, ? FROM DUAL WHERE NOT EXISTS (SELECT 1 FROM user WHERE username = ?)"
+};
+
+bool UserStmtBind::BindParams(MYSQL_STMT* stmt, const std::string& name, const std::string* pwdParam){
+    memset(params, 0, sizeof(params));
+    const std::string* strs[3] = { &name, pwdParam, &name };
+    for(int i = 0; i < 3 && strs[i]; i++){
+        lens[i] = strs[i]->size();
+        params[i].buffer_type = MYSQL_TYPE_STRING;
+        params[i].buffer = const_cast<char*>(strs[i]->data());
+        params[i].buffer_length = lens[i];
+        params[i].length = &lens[i];
+    }
+    return mysql_stmt_bind_param(stmt, params) == 0;
+}
+
+bool UserStmtBind::FetchUser(MYSQL_STMT* stmt, const std::string& pwdParam, bool* found){
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = pwd;
+    result.buffer_length = sizeof(pwd);
+    result.length = &pwdLen;
+    result.is_null = &pwdNull;
+    int ret = mysql_stmt_bind_result(stmt, &result) == 0 ? mysql_stmt_fetch(stmt) : 1;
+    *found = ret != MYSQL_NO_DATA;   //取结果出错时按已存在处理，注册不会继续插入
+    pwdValid = ret == 0 && !pwdNull;   //截断时返回MYSQL_DATA_TRUNCATED，不算取到
+    bool match = pwdValid && pwdLen == pwdParam.size() && memcmp(pwd, pwdParam.data(), pwdLen) == 0;
+    mysql_stmt_free_result(stmt);
+    return match;
+}
+
 // 懒汉式单例模式
 // 返回SqlConnPool类的实例
 SqlConnPool* SqlConnPool::Instance()
@@ -26,6 +64,9 @@ void SqlConnPool::Init(const char* host, uint16_t port, const char* user, const
             LOG_ERROR("Mysql init error!");
             assert(conn);
         }
+        // 断线后自动重连，之后在重连的连接上重新预编译语句
+        bool reconnect = true;   //MySQL 8没有my_bool，两者都是一个字节
+        mysql_options(conn, MYSQL_OPT_RECONNECT, &reconnect);
         // 连接数据库
         conn = mysql_real_connect(conn, host, user, passwd, db_name, port, nullptr, 0);
         if(!conn){
@@ -35,8 +76,9 @@ void SqlConnPool::Init(const char* host, uint16_t port, const char* user, const
         }
         // 输出连接成功日志
         LOG_INFO("Mysql connect success!");
-        // 将连接放入连接队列
+        // 将连接放入连接队列，语句在第一次使用时预编译
         connQue_.emplace(conn);
+        stmts_[conn] = ConnStmts{ {}, mysql_thread_id(conn) };
     }
     // 设置最大连接数
     MAX_CONN_ = maxConn;
@@ -73,8 +115,10 @@ void SqlConnPool::ClosePool(){
     while(!connQue_.empty()){
         auto conn = connQue_.front();
         connQue_.pop();
+        CloseStmts_(stmts_[conn]);
         mysql_close(conn);
     }
+    stmts_.clear();
     mysql_library_end();  // 关闭mysql库
 }
 
@@ -82,4 +126,51 @@ void SqlConnPool::ClosePool(){
 int SqlConnPool::GetFreeConnCnt(){
     lock_guard<mutex> locker(mtx_);
     return connQue_.size();
-}
\ No newline at end of file
+}
+
+
+void SqlConnPool::CloseStmts_(ConnStmts& cs, int keep){
+    for(int i = 0; i < STMT_COUNT; i++){
+        if(i != keep && cs.stmts[i]){
+            mysql_stmt_close(cs.stmts[i]);
+            cs.stmts[i] = nullptr;
+        }
+    }
+}
+
+MYSQL_STMT* SqlConnPool::GetStmt(MYSQL* conn, SQL_STMT id){
+    auto it = stmts_.find(conn);
+    assert(it != stmts_.end());
+    ConnStmts& cs = it->second;
+    if(mysql_thread_id(conn) != cs.threadId){   // 已经重连过，旧连接上的语句都已失效
+        CloseStmts_(cs);
+        cs.threadId = mysql_thread_id(conn);
+    }
+    if(!cs.stmts[id]){
+        MYSQL_STMT* stmt = mysql_stmt_init(conn);
+        if(!stmt || mysql_stmt_prepare(stmt, SQL_STMT_TEXT[id], strlen(SQL_STMT_TEXT[id])) != 0){
+            LOG_ERROR("Prepare error: %s", stmt ? mysql_stmt_error(stmt) : mysql_error(conn));
+            if(stmt){
+                mysql_stmt_close(stmt);
+            }
+            return nullptr;
+        }
+        cs.stmts[id] = stmt;
+        if(mysql_thread_id(conn) != cs.threadId){   // 预编译时发生了重连
+            CloseStmts_(cs, id);
+            cs.threadId = mysql_thread_id(conn);
+        }
+    }
+    return cs.stmts[id];
+}
+
+void SqlConnPool::ResetStmts(MYSQL* conn){
+    auto it = stmts_.find(conn);
+    assert(it != stmts_.end());
+    CloseStmts_(it->second);
+}
+
+bool SqlConnPool::IsStmtLost(unsigned int err){
+    static const unsigned int ER_UNKNOWN_STMT_HANDLER = 1243;   // 服务器端已没有该语句（如服务器重启后自动重连）
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST || err == ER_UNKNOWN_STMT_HANDLER;
+}
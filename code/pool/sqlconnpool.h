@@ -7,8 +7,34 @@
 #include <mutex>
 #include <semaphore.h>
 #include <thread>
+#include <unordered_map>
+#include <type_traits>
 #include "../log/log.h"
 
+//用户表上的预编译语句，SqlConnPool和SqlAsync共用
+enum SQL_STMT {
+    STMT_SELECT_USER,   // 按用户名查密码，参数为username
+    STMT_INSERT_USER,   // 用户名不存在时注册新用户，参数为username、password、username，影响行数为0表示已存在
+    STMT_COUNT
+};
+extern const char* const SQL_STMT_TEXT[STMT_COUNT];
+
+//用户表语句的参数和结果绑定：绑定的缓冲区在执行、取结果完成前须保持有效
+struct UserStmtBind {
+    MYSQL_BIND params[3];
+    unsigned long lens[3];
+    MYSQL_BIND result;
+    char pwd[256];   // 查到的密码，更长的视为不匹配
+    unsigned long pwdLen;
+    std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type pwdNull;   // MariaDB为my_bool，MySQL 8去掉了my_bool，改用bool
+    bool pwdValid;   // FetchUser完整取到了密码，pwd[0, pwdLen)可以使用
+
+    //绑定username（插入时还有password）参数，字符串在执行完成前不能改动
+    bool BindParams(MYSQL_STMT* stmt, const std::string& name, const std::string* pwd);
+    //取出SELECT的结果（须已store_result）并释放结果集，found为用户是否存在（出错时也为true），返回密码是否与pwd一致
+    bool FetchUser(MYSQL_STMT* stmt, const std::string& pwd, bool* found);
+};
+
 class SqlConnPool{
 public:
     static SqlConnPool* Instance();
@@ -16,6 +42,13 @@ public:
     MYSQL* GetConn();
     void FreeConn(MYSQL* conn);
 
+    //conn上预编译好的语句，只能由持有conn的线程使用；第一次使用或连接重连后（线程ID变化）重新预编译，失败返回nullptr
+    MYSQL_STMT* GetStmt(MYSQL* conn, SQL_STMT id);
+    //执行时连接已断开：丢弃conn上的全部语句，下次GetStmt预编译时自动重连
+    void ResetStmts(MYSQL* conn);
+    //语句执行失败是因为连接断开或服务器已丢弃语句，重新预编译后可以重试
+    static bool IsStmtLost(unsigned int err);
+
     int GetFreeConnCnt();
     void ClosePool();
 
@@ -25,9 +58,16 @@ private:
     SqlConnPool() = default;
     ~SqlConnPool() {ClosePool();}
 
+    struct ConnStmts {
+        MYSQL_STMT* stmts[STMT_COUNT];
+        unsigned long threadId;   // 预编译时的连接线程ID，重连后会变
+    };
+    static void CloseStmts_(ConnStmts& cs, int keep = -1);
+
     int MAX_CONN_;
 
     std::queue<MYSQL*> connQue_;  // 连接队列
+    std::unordered_map<MYSQL*, ConnStmts> stmts_;  // 每条连接的预编译语句，Init后只读，各条目只由持有连接的线程访问
     std::mutex mtx_;
     sem_t semId_;  //信号量
 };
@@ -1,74 +1,355 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <queue>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <thread>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 
 
+/*固定大小的内联任务，取代std::function<void()>
+可调用对象不超过CAPACITY字节时直接放在内部缓冲区，不分配堆内存（std::bind(&WebServer::OnRead_, this, client)只有32字节）；
+超出时才退化为堆上分配*/
+class InlineTask {
+public:
+    static const size_t CAPACITY = 48;
+
+    InlineTask(): invoke_(nullptr), manage_(nullptr) {}
+
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineTask>::value>::type>
+    InlineTask(F&& f): invoke_(nullptr), manage_(nullptr) {
+        typedef typename std::decay<F>::type Fn;
+        Store_<Fn>(std::forward<F>(f), std::integral_constant<bool, IsInline_<Fn>()>());
+    }
+
+    InlineTask(InlineTask&& other): invoke_(other.invoke_), manage_(other.manage_) {
+        if(manage_) {
+            manage_(buf_, other.buf_, MOVE);
+            other.Reset_();
+        }
+    }
+
+    InlineTask& operator=(InlineTask&& other) {
+        if(this != &other) {
+            Destroy_();
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            if(manage_) {
+                manage_(buf_, other.buf_, MOVE);
+                other.Reset_();
+            }
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    ~InlineTask() { Destroy_(); }
+
+    void operator()() {
+        assert(invoke_);
+        invoke_(buf_);
+    }
+
+    explicit operator bool() const { return invoke_ != nullptr; }
+
+private:
+    enum { MOVE, DESTROY };
+
+    template<typename Fn>
+    static constexpr bool IsInline_() {
+        return sizeof(Fn) <= CAPACITY && alignof(Fn) <= alignof(max_align_t) && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    //内联存放：可调用对象直接构造在buf_中
+    template<typename Fn, typename F>
+    void Store_(F&& f, std::true_type) {
+        new (buf_) Fn(std::forward<F>(f));
+        invoke_ = [](void* p) { (*static_cast<Fn*>(p))(); };
+        manage_ = [](void* dst, void* src, int op) {
+            if(op == MOVE) {
+                new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            }
+            static_cast<Fn*>(src)->~Fn();
+        };
+    }
+
+    //过大的可调用对象放在堆上，buf_中只保存指针
+    template<typename Fn, typename F>
+    void Store_(F&& f, std::false_type) {
+        *reinterpret_cast<Fn**>(buf_) = new Fn(std::forward<F>(f));
+        invoke_ = [](void* p) { (**static_cast<Fn**>(p))(); };
+        manage_ = [](void* dst, void* src, int op) {
+            if(op == MOVE) {
+                *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+            }
+            else {
+                delete *static_cast<Fn**>(src);
+            }
+        };
+    }
+
+    void Destroy_() {
+        if(manage_) {
+            manage_(nullptr, buf_, DESTROY);
+            Reset_();
+        }
+    }
+
+    void Reset_() {
+        invoke_ = nullptr;
+        manage_ = nullptr;
+    }
+
+    alignas(max_align_t) unsigned char buf_[CAPACITY];
+    void (*invoke_)(void*);
+    void (*manage_)(void* dst, void* src, int op);
+};
+
+
+/*有界无锁多生产者多消费者环形队列（Vyukov算法）
+每个槽带一个序号，生产者/消费者各用一次CAS抢占位置，槽内可以直接存放InlineTask*/
+template<typename T>
+class MpmcRing {
+public:
+    explicit MpmcRing(size_t capacity): mask_(capacity - 1), cells_(new Cell[capacity]), enqueuePos_(0), dequeuePos_(0) {
+        assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);  //容量必须是2的幂
+        for(size_t i = 0; i < capacity; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    //队列满时返回false，且不移动item
+    bool TryPush(T& item) {
+        Cell* cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(dif == 0) {
+                if(enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(dif < 0) {
+                return false;
+            }
+            else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& item) {
+        Cell* cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if(dif == 0) {
+                if(dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(dif < 0) {
+                return false;
+            }
+            else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Empty() const {
+        return enqueuePos_.load(std::memory_order_acquire) == dequeuePos_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    //生产者和消费者的位置分处不同缓存行（C++14的new不保证alignas(64)，用填充隔开）
+    char pad0_[64];
+    std::atomic<size_t> enqueuePos_;
+    char pad1_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> dequeuePos_;
+    char pad2_[64 - sizeof(std::atomic<size_t>)];
+};
+
+
+/*工作窃取线程池
+每个工作线程有自己的无锁任务队列，外部线程（事件循环）提交的任务进入全局注入队列；
+工作线程依次从自己的队列、全局队列取任务，都为空时从其他线程的队列窃取，仍然没有任务才休眠。
+只有工作线程在任务中再提交的任务才进入它自己的队列，窃取也只针对这些任务；
+WebServer的任务都由事件循环提交，全部经过全局队列。
+提交任务时只有存在休眠线程才去加锁唤醒，忙碌时提交和取任务都不加锁。
+析构时已排队的任务仍会被执行完，工作线程随后退出*/
 class ThreadPool {
 public:
     ThreadPool() = default;    //默认构造函数
     ThreadPool(ThreadPool&&) = default;    //移动构造函数
-    
-    explicit ThreadPool(int threadCount = 8) : pool_(std::make_shared<Pool>()) {   //make_shared：传递右值，功能是在动态内存中分配一个对象并初始化它，返回指向此对象的shared_ptr
+
+    explicit ThreadPool(int threadCount = 8) : pool_(std::make_shared<Pool>(threadCount)) {
         assert(threadCount > 0);
         for (int i = 0; i < threadCount; ++i) {
-            std::thread([this](){
-                std::unique_lock<std::mutex> locker(pool_->mtx_);
+            std::shared_ptr<Pool> pool = pool_;   //线程持有Pool的引用，ThreadPool析构后线程仍可安全退出
+            std::thread([pool, i](){
+                Pool::Current() = std::make_pair(pool.get(), i);
                 while (true) {
-                    if(!pool_->tasks_.empty())
+                    InlineTask task;
+                    if(pool->TryGet(i, task))
                     {
-                        auto task = std::move(pool_->tasks_.front());
-                        pool_->tasks_.pop();
-                        locker.unlock();  //任务取出后，解锁
                         task();  //执行任务
-                        locker.lock();  //执行完任务后，加锁
                     }
-                    else if(pool_->isClosed_)
+                    else if(pool->isClosed_.load())
                     {
                         break;
                     }
                     else
                     {
-                        pool_->cond_.wait(locker);   //等待任务队列中有任务
+                        pool->Park();   //没有任务可做，休眠等待唤醒
                     }
                 }
             }).detach();  //分离线程
         }
-        
     }
 
     ~ThreadPool(){
         if(pool_)    //线程池存在
         {
-            std::unique_lock<std::mutex> locker(pool_->mtx_);
+            std::lock_guard<std::mutex> locker(pool_->mtx_);
             pool_->isClosed_ = true;
+            pool_->cond_.notify_all();  //唤醒所有线程
         }
-        pool_->cond_.notify_all();  //唤醒所有线程
     }
 
-    //添加任务
+    //添加任务：工作线程内提交的进入自己的队列，其他线程提交的进入全局注入队列
     template<typename T>
     void addTask(T&& task) {       //T&&:万能引用
-        std::unique_lock<std::mutex> locker(pool_->mtx_);
-        pool_->tasks_.emplace(std::forward<T>(task));  //emplace：在容器中直接构造对象，而不是拷贝或移动 froward：转发参数
-        pool_->cond_.notify_one();  //唤醒一个线程
+        InlineTask t(std::forward<T>(task));
+        std::pair<Pool*, int> cur = Pool::Current();
+        if(cur.first != pool_.get() || !pool_->locals_[cur.second]->TryPush(t))
+        {
+            pool_->Inject(t);
+        }
+        pool_->Notify();
     }
 
 
 private:
-    struct Pool{    ////线程池结构体
+    struct Pool {    //线程池结构体
+        static const size_t LOCAL_CAPACITY = 1024;   //每个工作线程队列容量
+        static const size_t GLOBAL_CAPACITY = 1 << 16;   //全局注入队列容量
+
+        explicit Pool(int threadCount): global_(GLOBAL_CAPACITY), overflowCnt_(0), idle_(0), isClosed_(false) {
+            for(int i = 0; i < threadCount; i++) {
+                locals_.emplace_back(new MpmcRing<InlineTask>(LOCAL_CAPACITY));
+            }
+        }
+
+        //当前线程所属的线程池及编号，非工作线程为{nullptr, -1}
+        static std::pair<Pool*, int>& Current() {
+            static thread_local std::pair<Pool*, int> cur(nullptr, -1);
+            return cur;
+        }
+
+        void Inject(InlineTask& task) {
+            if(!global_.TryPush(task)) {   //全局队列满了才退化为加锁的溢出队列
+                std::lock_guard<std::mutex> locker(overflowMtx_);
+                overflow_.push_back(std::move(task));
+                overflowCnt_++;
+            }
+        }
+
+        bool TryGet(int self, InlineTask& task) {
+            if(locals_[self]->TryPop(task) || global_.TryPop(task)) {
+                return true;
+            }
+            if(overflowCnt_.load() > 0) {
+                std::lock_guard<std::mutex> locker(overflowMtx_);
+                if(!overflow_.empty()) {
+                    task = std::move(overflow_.front());
+                    overflow_.pop_front();
+                    overflowCnt_--;
+                    return true;
+                }
+            }
+            int n = static_cast<int>(locals_.size());
+            for(int k = 1; k < n; k++) {    //从相邻线程开始窃取
+                if(locals_[(self + k) % n]->TryPop(task)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool HasWork() const {
+            if(!global_.Empty() || overflowCnt_.load() > 0) {
+                return true;
+            }
+            for(const auto& q : locals_) {
+                if(!q->Empty()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //先登记为空闲再复查队列，与Notify中“先入队再检查空闲数”配合，不会丢失唤醒
+        void Park() {
+            std::unique_lock<std::mutex> locker(mtx_);
+            idle_++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);   //idle_的修改先于下面对队列的检查
+            if(!HasWork() && !isClosed_.load()) {
+                cond_.wait(locker);
+            }
+            idle_--;
+        }
+
+        void Notify() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);   //入队先于读idle_，队列的CAS本身是relaxed的
+            if(idle_.load() > 0) {
+                std::lock_guard<std::mutex> locker(mtx_);
+                cond_.notify_one();  //唤醒一个线程
+            }
+        }
+
+        std::vector<std::unique_ptr<MpmcRing<InlineTask>>> locals_;   //每个工作线程的任务队列
+        MpmcRing<InlineTask> global_;   //全局注入队列
+        std::mutex overflowMtx_;
+        std::deque<InlineTask> overflow_;
+        std::atomic<size_t> overflowCnt_;
+
         std::mutex mtx_;
-        std::condition_variable cond_;  //条件变量
-        bool isClosed_;
-        std::queue<std::function<void()>> tasks_;   //任务队列
+        std::condition_variable cond_;  //条件变量，只用于休眠/唤醒
+        std::atomic<int> idle_;   //休眠中的线程数
+        std::atomic<bool> isClosed_;
     };
 
     std::shared_ptr<Pool> pool_;  //线程池
 };
 
-#endif // THREADPOOL_H
\ No newline at end of file
+#endif // THREADPOOL_H
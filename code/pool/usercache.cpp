@@ -0,0 +1,216 @@
+#include "usercache.h"
+
+#include <mysql/mysql.h>
+#include <chrono>
+#include <random>
+
+#include "../log/log.h"
+
+using namespace std;
+
+
+UserCache::UserCache(): shardBytes_(0), ttlMS_(60000), seed_(0), bloomMask_(0), bloomReady_(false),
+    hits_(0), misses_(0), bloomSkips_(0) {
+    random_device rd;
+    seed_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+UserCache* UserCache::Instance() {
+    static UserCache cache;
+    return &cache;
+}
+
+void UserCache::Init(size_t maxBytes, int ttlMS) {
+    shardBytes_ = maxBytes / SHARDS;
+    ttlMS_ = ttlMS;
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        while(!shard.lru.empty() && shard.bytes > shardBytes_) {
+            Erase_(shard, shard.index.find(shard.lru.back().name));
+        }
+    }
+}
+
+
+// FNV-1a后再做一次splitmix64的混合，高位用来分片，低位和高低交换后的值用作Bloom的两个基础哈希
+uint64_t UserCache::Hash_(const char* data, size_t len, uint64_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    for(size_t i = 0; i < len; i++) {
+        h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+int64_t UserCache::NowMS_() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// 启动时用一条阻塞的临时连接流式读取用户名，不占用连接池
+bool UserCache::LoadNames(const char* host, uint16_t port, const char* user, const char* passwd, const char* dbName) {
+    MYSQL* sql = mysql_init(nullptr);
+    if(!sql) {
+        return false;
+    }
+    vector<string> names;
+    bool ok = mysql_real_connect(sql, host, user, passwd, dbName, port, nullptr, 0) &&
+              mysql_query(sql, "SELECT username FROM user") == 0;
+    MYSQL_RES* res = ok ? mysql_use_result(sql) : nullptr;
+    if(res) {
+        while(MYSQL_ROW row = mysql_fetch_row(res)) {
+            if(row[0]) {
+                names.emplace_back(row[0]);
+            }
+        }
+        ok = mysql_errno(sql) == 0;
+        mysql_free_result(res);
+    }
+    if(!res || !ok) {
+        LOG_WARN("UserCache: load usernames failed: %s", mysql_error(sql));
+        mysql_close(sql);
+        return false;
+    }
+    mysql_close(sql);
+    SetNames(names);
+    return true;
+}
+
+// 只在开始服务前调用：建立期间过滤器不启用，注册都先查询
+void UserCache::SetNames(const vector<string>& names) {
+    bloomReady_.store(false, memory_order_release);
+    size_t bits = BLOOM_MIN_BITS;
+    while(bits < names.size() * BLOOM_BITS_PER_NAME) {
+        bits <<= 1;
+    }
+    bloom_.reset(new atomic<uint64_t>[bits / 64]);
+    for(size_t i = 0; i < bits / 64; i++) {
+        bloom_[i].store(0, memory_order_relaxed);
+    }
+    bloomMask_ = bits - 1;
+    for(const string& name : names) {
+        BloomAdd_(Hash_(name.data(), name.size(), 0));
+    }
+    bloomReady_.store(true, memory_order_release);
+    LOG_INFO("UserCache: %d usernames in bloom filter, %d KB", (int)names.size(), (int)(bits >> 13));
+}
+
+void UserCache::BloomAdd_(uint64_t h) {
+    uint64_t h2 = ((h >> 32) | (h << 32)) | 1;
+    for(int i = 0; i < BLOOM_HASHES; i++) {
+        uint64_t bit = (h + i * h2) & bloomMask_;
+        bloom_[bit >> 6].fetch_or(1ULL << (bit & 63), memory_order_relaxed);
+    }
+}
+
+bool UserCache::BloomTest_(uint64_t h) const {
+    uint64_t h2 = ((h >> 32) | (h << 32)) | 1;
+    for(int i = 0; i < BLOOM_HASHES; i++) {
+        uint64_t bit = (h + i * h2) & bloomMask_;
+        if(!(bloom_[bit >> 6].load(memory_order_relaxed) & (1ULL << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool UserCache::MayExist(const string& name) {
+    if(!bloomReady_.load(memory_order_acquire) || BloomTest_(Hash_(name.data(), name.size(), 0))) {
+        return true;
+    }
+    bloomSkips_.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+
+bool UserCache::Lookup(const string& name, const string& pwd, bool isLogin, bool* ok) {
+    if(shardBytes_ == 0) {
+        return false;
+    }
+    uint64_t verifier = isLogin ? Hash_(pwd.data(), pwd.size(), seed_) : 0;
+    Shard& shard = ShardOf_(Hash_(name.data(), name.size(), 0));
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it == shard.index.end() || NowMS_() >= it->second->expires) {
+        if(it != shard.index.end()) {
+            Erase_(shard, it);   //过期，由数据库的结果重新写入
+        }
+        misses_.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    hits_.fetch_add(1, memory_order_relaxed);
+    *ok = isLogin && it->second->verifier == verifier;
+    return true;
+}
+
+void UserCache::Put(const string& name, const char* pwd, size_t len) {
+    uint64_t h = Hash_(name.data(), name.size(), 0);
+    if(bloomReady_.load(memory_order_acquire)) {
+        BloomAdd_(h);
+    }
+    if(shardBytes_ == 0) {
+        return;
+    }
+    Shard& shard = ShardOf_(h);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        Erase_(shard, it);
+    }
+    Entry entry = { name, Hash_(pwd, len, seed_), NowMS_() + ttlMS_ };
+    size_t bytes = EntryBytes_(entry);
+    if(bytes > shardBytes_) {
+        return;
+    }
+    while(shard.bytes + bytes > shardBytes_) {
+        Erase_(shard, shard.index.find(shard.lru.back().name));
+    }
+    shard.lru.push_front(std::move(entry));
+    shard.index.emplace(name, shard.lru.begin());
+    shard.bytes += bytes;
+}
+
+void UserCache::Erase(const string& name) {
+    Shard& shard = ShardOf_(Hash_(name.data(), name.size(), 0));
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        Erase_(shard, it);
+    }
+}
+
+void UserCache::Erase_(Shard& shard, unordered_map<string, LruList::iterator>::iterator it) {
+    shard.bytes -= EntryBytes_(*it->second);
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+}
+
+void UserCache::Clear() {
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        shard.lru.clear();
+        shard.index.clear();
+        shard.bytes = 0;
+    }
+}
+
+
+size_t UserCache::Count() {
+    size_t count = 0;
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        count += shard.index.size();
+    }
+    return count;
+}
+
+size_t UserCache::Bytes() {
+    size_t bytes = 0;
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}
@@ -0,0 +1,96 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <stdint.h>
+
+/*登录/注册的用户缓存
+用户名 → 密码校验值（带进程随机种子的64位哈希，不保留明文），按用户名哈希分片，每片各自加锁、各自LRU，
+条目在ttlMS后过期，总容量按maxBytes估算。数据库查到用户或注册成功时写入（写穿），
+登录命中时直接比对校验值，注册命中时直接判定已存在，都不再访问数据库。
+另有一个已存在用户名的Bloom过滤器，启动时从用户表整体加载、注册成功时加入：
+过滤器判定不存在的注册请求跳过SELECT，直接执行"不存在才插入"的INSERT，
+其他进程写入的用户即使不在过滤器中也不会被重复插入*/
+
+class UserCache {
+public:
+    static UserCache* Instance();
+
+    //maxBytes为缓存容量，0表示不缓存（Bloom过滤器不受影响）
+    void Init(size_t maxBytes, int ttlMS);
+    //从用户表加载全部用户名，建立Bloom过滤器；失败时过滤器不启用，注册总是先查询
+    bool LoadNames(const char* host, uint16_t port, const char* user, const char* passwd, const char* dbName);
+    void SetNames(const std::vector<std::string>& names);
+
+    //能否不访问数据库得出结果，能时结果写入ok：登录比对密码，注册时用户已存在即失败
+    bool Lookup(const std::string& name, const std::string& pwd, bool isLogin, bool* ok);
+    //用户名可能已存在（Bloom过滤器未启用时总是true），false时注册可以跳过SELECT
+    bool MayExist(const std::string& name);
+
+    //数据库中查到了用户或注册成功，pwd为库中的密码
+    void Put(const std::string& name, const char* pwd, size_t len);
+    //数据库中查不到用户：丢掉可能残留的条目
+    void Erase(const std::string& name);
+    void Clear();
+
+    size_t Count();
+    size_t Bytes();
+    uint64_t Hits() const { return hits_; }
+    uint64_t Misses() const { return misses_; }
+    uint64_t BloomSkips() const { return bloomSkips_; }   // 跳过了SELECT的注册请求
+
+    static const int SHARDS = 16;
+
+private:
+    UserCache();
+    ~UserCache() = default;
+
+    struct Entry {
+        std::string name;
+        uint64_t verifier;
+        int64_t expires;   // 毫秒
+    };
+    typedef std::list<Entry> LruList;   // 表头为最近使用
+
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        LruList lru;
+        std::unordered_map<std::string, LruList::iterator> index;
+        size_t bytes = 0;
+    };
+
+    static const size_t ENTRY_OVERHEAD = 128;   // 链表节点、哈希桶等的估算开销
+    static const int BLOOM_HASHES = 7;
+    static const size_t BLOOM_MIN_BITS = 1 << 20;
+    static const size_t BLOOM_BITS_PER_NAME = 16;   // 按现有用户数的两倍预留，注册增长后误判率仍在1%以内
+
+    static uint64_t Hash_(const char* data, size_t len, uint64_t seed);
+    static int64_t NowMS_();
+    static size_t EntryBytes_(const Entry& entry) { return entry.name.size() * 2 + ENTRY_OVERHEAD; }
+    Shard& ShardOf_(uint64_t h) { return shards_[h >> 60]; }
+    void Erase_(Shard& shard, std::unordered_map<std::string, LruList::iterator>::iterator it);
+
+    void BloomAdd_(uint64_t h);
+    bool BloomTest_(uint64_t h) const;
+
+    size_t shardBytes_;   // 每片的容量
+    int ttlMS_;
+    uint64_t seed_;       // 密码校验值的种子，每次启动随机生成
+    Shard shards_[SHARDS];
+
+    std::unique_ptr<std::atomic<uint64_t>[]> bloom_;
+    uint64_t bloomMask_;   // 位数减一，位数为2的幂
+    std::atomic<bool> bloomReady_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> bloomSkips_;
+};
+
+#endif // USER_CACHE_H
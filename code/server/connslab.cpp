@@ -0,0 +1,55 @@
+#include "connslab.h"
+
+#include <new>
+
+
+ConnSlab::ConnSlab(int maxFd): maxFd_(maxFd), chunks_((maxFd + CHUNK_SIZE - 1) / CHUNK_SIZE, nullptr) {
+    assert(maxFd_ > 0);
+}
+
+ConnSlab::~ConnSlab() {
+    for(Slot* chunk : chunks_) {
+        if(chunk == nullptr) {
+            continue;
+        }
+        for(int i = 0; i < CHUNK_SIZE; i++) {
+            chunk[i].~Slot();
+        }
+        free(chunk);
+    }
+}
+
+
+HttpConn* ConnSlab::Get(int fd) {
+    assert(fd >= 0 && fd < maxFd_);
+    Slot*& chunk = chunks_[fd >> CHUNK_SHIFT];
+    if(chunk == nullptr) {
+        void* mem = nullptr;
+        // 按缓存行对齐分配一整块连接槽，并原地构造
+        if(posix_memalign(&mem, alignof(Slot), sizeof(Slot) * CHUNK_SIZE) != 0) {
+            throw std::bad_alloc();
+        }
+        chunk = static_cast<Slot*>(mem);
+        for(int i = 0; i < CHUNK_SIZE; i++) {
+            new (&chunk[i]) Slot();
+        }
+    }
+    return &chunk[fd & (CHUNK_SIZE - 1)].conn;
+}
+
+
+HttpConn* ConnSlab::Find(uint64_t key) const {
+    int fd = KeyFd(key);
+    if(fd < 0 || fd >= maxFd_) {
+        return nullptr;
+    }
+    Slot* chunk = chunks_[fd >> CHUNK_SHIFT];
+    if(chunk == nullptr) {
+        return nullptr;
+    }
+    HttpConn* client = &chunk[fd & (CHUNK_SIZE - 1)].conn;
+    if(client->GetGen() != KeyGen(key)) {
+        return nullptr;
+    }
+    return client;
+}
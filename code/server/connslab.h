@@ -0,0 +1,46 @@
+#ifndef CONNSLAB_H
+#define CONNSLAB_H
+
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "../http/httpconn.h"
+
+/*以fd为下标的HttpConn连接槽，取代unordered_map<int, HttpConn>
+按块（每块CHUNK_SIZE个连接）分配并按缓存行对齐，块一旦分配就不再移动或释放，
+所以HttpConn的地址在整个进程生命周期内不变，查找只是一次数组下标运算，没有哈希和rehash。
+事件和定时器用Key（代数<<32 | fd）标识连接，代数不一致说明连接已关闭或fd已被复用*/
+
+class ConnSlab{
+public:
+    explicit ConnSlab(int maxFd = 65536);
+    ~ConnSlab();
+
+    HttpConn* Get(int fd);   //返回fd对应的连接槽，所在块未分配时先分配
+    HttpConn* Find(uint64_t key) const;   //按Key查找，槽未分配或代数不一致（过期事件）返回nullptr
+
+    static uint64_t Key(const HttpConn* client) {
+        return (static_cast<uint64_t>(client->GetGen()) << 32) | static_cast<uint32_t>(client->GetFd());
+    }
+    static int KeyFd(uint64_t key) { return static_cast<int>(static_cast<uint32_t>(key)); }
+    static uint32_t KeyGen(uint64_t key) { return static_cast<uint32_t>(key >> 32); }
+
+private:
+    ConnSlab(const ConnSlab&) = delete;
+    ConnSlab& operator=(const ConnSlab&) = delete;
+
+    struct alignas(64) Slot{   //独占缓存行，相邻连接不会伪共享
+        HttpConn conn;
+    };
+
+    static const int CHUNK_SHIFT = 8;
+    static const int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+
+    int maxFd_;
+    std::vector<Slot*> chunks_;  //块目录，构造时按maxFd预先分配
+};
+
+
+#endif // CONNSLAB_H
@@ -47,6 +47,30 @@ bool Epoller::ModFd(int fd, uint32_t events) {
 }
 
 
+// 添加文件描述符，事件数据使用调用方给定的64位值
+bool Epoller::AddFd(int fd, uint32_t events, uint64_t data) {
+    if(fd < 0){
+        return false;
+    }
+    epoll_event ev = {0};
+    ev.data.u64 = data;
+    ev.events = events;
+    return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+
+// 修改文件描述符的事件，事件数据使用调用方给定的64位值
+bool Epoller::ModFd(int fd, uint32_t events, uint64_t data) {
+    if(fd < 0){
+        return false;
+    }
+    epoll_event ev = {0};
+    ev.data.u64 = data;
+    ev.events = events;
+    return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+
 // 删除文件描述符
 bool Epoller::DelFd(int fd) {
     // 如果文件描述符小于0，返回false
@@ -74,6 +98,13 @@ int Epoller::GetEventFd(size_t i) const {
 }
 
 
+// 获取第i个事件的64位数据
+uint64_t Epoller::GetEventData(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return events_[i].data.u64;
+}
+
+
 // 获取第i个事件的事件类型
 uint32_t Epoller::GetEvents(size_t i) const {
     // 断言i在events_的范围内
@@ -14,9 +14,12 @@ public:
 
     bool AddFd(int fd, uint32_t events);
     bool ModFd(int fd, uint32_t events);
+    bool AddFd(int fd, uint32_t events, uint64_t data);  //data随事件一起返回，用于直接定位连接
+    bool ModFd(int fd, uint32_t events, uint64_t data);
     bool DelFd(int fd);
     int Wait(int timeoutMS = -1);
     int GetEventFd(size_t i) const;
+    uint64_t GetEventData(size_t i) const;
     uint32_t GetEvents(size_t i) const;
 
 private:
@@ -0,0 +1,632 @@
+#include "subreactor.h"
+
+using namespace std;
+
+
+SubReactor::SubReactor(int id, int port, uint32_t listenEvent, uint32_t connEvent, int timeoutMS, bool useUring):
+    id_(id), port_(port), timeoutMS_(timeoutMS), isClose_(false), listenFd_(-1), wakeFd_(-1), accepted_(0),
+    listenEvent_(listenEvent), connEvent_(connEvent), timer_(new TimingWheel(&SubReactor::OnTimeout_, this)), epoller_(new Epoller()),
+    useUring_(useUring), multishotAccept_(true), multishotRecv_(true)
+{
+}
+
+SubReactor::~SubReactor(){
+    isClose_ = true;
+    timer_.reset();  // 定时器节点嵌在HttpConn中，时间轮要在clients_析构之前摘除它们
+    uring_.reset();  // 先关闭ring，再释放提供给内核的接收缓冲区和在途sendmsg引用的msghdr
+    if(listenFd_ >= 0)
+    {
+        close(listenFd_);
+    }
+    if(wakeFd_ >= 0)
+    {
+        close(wakeFd_);
+    }
+}
+
+void SubReactor::Stop(){
+    isClose_ = true;
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd_, &one, sizeof(one));
+    (void)ret;
+}
+
+
+// 创建本子Reactor的监听socket，SO_REUSEPORT让多个socket绑定同一端口，由内核做负载均衡
+bool SubReactor::Init(){
+    int ret = 0;
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port_);
+
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd_ < 0)
+    {
+        LOG_ERROR("SubReactor[%d] socket create error!", id_);
+        return false;
+    }
+
+    int optval = 1;
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    if(ret == -1)
+    {
+        LOG_ERROR("SubReactor[%d] set SO_REUSEADDR error!", id_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));  // 多个子Reactor共享同一端口
+    if(ret == -1)
+    {
+        LOG_ERROR("SubReactor[%d] set SO_REUSEPORT error!", id_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    if(ret < 0)
+    {
+        LOG_ERROR("SubReactor[%d] bind port:%d error!", id_, port_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    ret = listen(listenFd_, 8);
+    if(ret < 0)
+    {
+        LOG_ERROR("SubReactor[%d] listen port:%d error!", id_, port_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    SetFdNonBlock_(listenFd_);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ < 0)
+    {
+        LOG_ERROR("SubReactor[%d] eventfd error!", id_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    if(SqlAsync::Instance()->IsOpen() && !notifier_.Init())
+    {
+        LOG_ERROR("SubReactor[%d] sql notifier error!", id_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    if(useUring_)
+    {
+        if(InitUring_())
+        {
+            LOG_INFO("SubReactor[%d] listen port:%d, backend: io_uring", id_, port_);
+            return true;
+        }
+        LOG_WARN("SubReactor[%d] io_uring unavailable, fall back to epoll", id_);
+    }
+    ret = epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN) && epoller_->AddFd(wakeFd_, EPOLLIN) &&
+          (notifier_.Fd() < 0 || epoller_->AddFd(notifier_.Fd(), EPOLLIN));
+    if(ret == 0)
+    {
+        LOG_ERROR("SubReactor[%d] add listen error!", id_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    LOG_INFO("SubReactor[%d] listen port:%d, backend: epoll", id_, port_);
+    return true;
+}
+
+int SubReactor::SetFdNonBlock_(int fd){
+    assert(fd > 0);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+
+void SubReactor::SendError_(int fd, const char* info){
+    assert(fd > 0);
+    int ret = send(fd, info, strlen(info), 0);
+    if(ret < 0)
+    {
+        LOG_WARN("send error to client[%d] error!", fd);
+    }
+    close(fd);
+}
+
+void SubReactor::CloseConn_(HttpConn* client){
+    assert(client);
+    timer_->Del(client->TimerNode());  // 单线程内关闭，同时摘除定时器
+    if(uring_)
+    {
+        CloseConnUring_(client);
+        return;
+    }
+    LOG_INFO("SubReactor[%d] Client[%d] quit!", id_, client->GetFd());
+    epoller_->DelFd(client->GetFd());
+    client->Close();
+}
+
+void SubReactor::OnTimeout_(void* arg, void* data){
+    static_cast<SubReactor*>(arg)->CloseConn_(static_cast<HttpConn*>(data));
+}
+
+void SubReactor::AddClient_(int fd, sockaddr_in addr){
+    assert(fd > 0);
+    HttpConn* client = clients_.Get(fd);
+    client->Init(fd, addr, notifier_.Fd() >= 0 ? &notifier_ : nullptr);
+    if(timeoutMS_ > 0)
+    {
+        timer_->Add(client->TimerNode(), timeoutMS_);
+    }
+    epoller_->AddFd(fd, EPOLLIN | connEvent_, ConnSlab::Key(client));
+    SetFdNonBlock_(fd);
+    accepted_.fetch_add(1, std::memory_order_relaxed);
+    LOG_INFO("SubReactor[%d] Client[%d] in!", id_, fd);
+}
+
+void SubReactor::DealListen_(){
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    do{
+        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+        if(fd <= 0)
+        {
+            return;
+        }
+        else if(fd >= MAX_FD || HttpConn::UserCount >= MAX_FD)
+        {
+            SendError_(fd, "Internal Server Busy");
+            LOG_WARN("Clients are full!");
+            return;
+        }
+        AddClient_(fd, addr);
+    }while(listenEvent_ & EPOLLET);
+}
+
+void SubReactor::ExtentTime_(HttpConn* client){
+    assert(client);
+    if(timeoutMS_ > 0)
+    {
+        timer_->Adjust(client->TimerNode(), timeoutMS_);
+    }
+}
+
+
+// 读、处理、写都在本线程内完成，不经过线程池
+void SubReactor::OnRead_(HttpConn* client){
+    assert(client);
+    int readErrno = 0;
+    ssize_t ret = client->Read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN)
+    {
+        CloseConn_(client);
+        return;
+    }
+    OnProcess_(client);
+}
+
+void SubReactor::OnProcess_(HttpConn* client){
+    if(client->Process())
+    {
+        OnWrite_(client);  // 同一线程内直接尝试发送，发不完再注册EPOLLOUT，省一次epoll_wait
+    }
+    else if(client->IsSuspended())
+    {
+        client->SubmitVerify();  // 挂起期间不监听任何事件（EPOLLONESHOT），结果到达后由DealResume_恢复
+    }
+    else
+    {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN, ConnSlab::Key(client));
+    }
+}
+
+// 结果都在本线程处理；连接已关闭、fd已被复用或io_uring连接正在关闭时丢弃
+void SubReactor::DealResume_(){
+    std::vector<SqlResult> results;
+    notifier_.Pop(results);
+    for(const SqlResult& result : results)
+    {
+        HttpConn* client = clients_.Find(result.key);
+        if(client == nullptr || !client->IsSuspended() || (uring_ && uringConns_[client->GetFd()].closing))
+        {
+            continue;
+        }
+        ExtentTime_(client);
+        if(!client->Resume(result.ok))
+        {
+            continue;
+        }
+        if(uring_)
+        {
+            SubmitWrite_(client);
+        }
+        else
+        {
+            OnWrite_(client);
+        }
+    }
+}
+
+void SubReactor::OnWrite_(HttpConn* client){
+    assert(client);
+    while(true)
+    {
+        int writeErrno = 0;
+        ssize_t ret = client->Write(&writeErrno);
+        if(client->ToWriteBytes() == 0)
+        {
+            if(client->IsKeepAlive())
+            {
+                if(client->Process())
+                {
+                    continue;  // 读缓冲区中还有流水线请求，接着发送下一批
+                }
+                if(client->IsSuspended())
+                {
+                    client->SubmitVerify();
+                    return;
+                }
+                epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN, ConnSlab::Key(client));
+                return;
+            }
+        }
+        else if(ret < 0)
+        {
+            if(writeErrno == EAGAIN)
+            {
+                epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, ConnSlab::Key(client));
+                return;
+            }
+        }
+        CloseConn_(client);
+        return;
+    }
+}
+
+
+// 子Reactor的事件循环
+void SubReactor::Loop(){
+    if(uring_)
+    {
+        LoopUring_();
+        return;
+    }
+    int timeMS = -1;
+    LOG_INFO("SubReactor[%d] start!", id_);
+    while(!isClose_)
+    {
+        if(timeoutMS_ > 0)
+        {
+            timeMS = timer_->GetNextTick();
+        }
+        int eventCnt = epoller_->Wait(timeMS);
+        if(timeoutMS_ > 0)
+        {
+            timer_->Tick();
+        }
+        for(int i = 0; i < eventCnt; i++)
+        {
+            uint64_t key = epoller_->GetEventData(i);
+            uint32_t events = epoller_->GetEvents(i);
+            if(ConnSlab::KeyFd(key) == listenFd_)
+            {
+                DealListen_();
+                continue;
+            }
+            if(ConnSlab::KeyFd(key) == notifier_.Fd())
+            {
+                DealResume_();
+                continue;
+            }
+            if(ConnSlab::KeyFd(key) == wakeFd_)  // Stop唤醒，循环条件负责退出
+            {
+                continue;
+            }
+            HttpConn* client = clients_.Find(key);
+            if(client == nullptr)  // 过期事件
+            {
+                continue;
+            }
+            if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                CloseConn_(client);
+            }
+            else if(events & EPOLLIN)
+            {
+                ExtentTime_(client);
+                OnRead_(client);
+            }
+            else if(events & EPOLLOUT)
+            {
+                ExtentTime_(client);
+                OnWrite_(client);
+            }
+            else
+            {
+                LOG_ERROR("Unexpected event");
+            }
+        }
+    }
+}
+
+
+/* io_uring后端
+每轮循环只调用一次io_uring_enter：提交本轮产生的所有sendmsg/recv/provide请求，同时等待新的完成事件。
+accept和recv都是multishot的，一次提交持续产生完成事件，不再需要epoll_ctl重新注册；
+recv使用内核提供的缓冲区，数据拷入HttpConn的读缓冲区后立即把缓冲区还给内核。*/
+
+bool SubReactor::InitUring_(){
+    std::unique_ptr<Uringer> uring(new Uringer(4096));
+    if(!uring->Init())
+    {
+        return false;
+    }
+    uring_ = std::move(uring);
+    uringBufs_.resize(static_cast<size_t>(URING_BUF_SIZE) * URING_BUF_COUNT);
+    uringConns_.resize(MAX_FD);
+    uring_->PrepProvideBuffers(&uringBufs_[0], URING_BUF_SIZE, URING_BUF_COUNT, URING_BUF_GROUP, 0, UserData_(OP_PROVIDE, -1));
+    ArmAccept_();
+    uring_->PrepPollAdd(wakeFd_, POLLIN, UserData_(OP_WAKE, wakeFd_));
+    if(notifier_.Fd() >= 0)
+    {
+        ArmNotify_();
+    }
+    return true;
+}
+
+void SubReactor::ArmAccept_(){
+    uring_->PrepAccept(listenFd_, multishotAccept_, UserData_(OP_ACCEPT, listenFd_));
+}
+
+void SubReactor::ArmRecv_(int fd){
+    uringConns_[fd].inflight++;
+    uring_->PrepRecv(fd, URING_BUF_GROUP, multishotRecv_, UserData_(OP_RECV, fd));
+}
+
+// eventfd可读时产生一个完成事件，处理完数据库结果后重新提交
+void SubReactor::ArmNotify_(){
+    uring_->PrepPollAdd(notifier_.Fd(), POLLIN, UserData_(OP_NOTIFY, notifier_.Fd()));
+}
+
+// 把HttpConn待发送的数据作为一个sendmsg请求排入提交队列，在下一次io_uring_enter时批量提交
+void SubReactor::SubmitWrite_(HttpConn* client){
+    int fd = client->GetFd();
+    UringConn& uc = uringConns_[fd];
+    memset(&uc.msg, 0, sizeof(uc.msg));
+    uc.msg.msg_iov = const_cast<struct iovec*>(client->WriteIov());
+    uc.msg.msg_iovlen = client->WriteIovCnt();
+    uc.sending = true;
+    uc.inflight++;
+    uring_->PrepSendmsg(fd, &uc.msg, MSG_NOSIGNAL, UserData_(OP_SEND, fd));
+}
+
+void SubReactor::ProcessUring_(HttpConn* client){
+    if(client->IsSuspended())
+    {
+        return;  // 查询已提交，等待DealResume_
+    }
+    if(client->Process())
+    {
+        SubmitWrite_(client);
+    }
+    else if(client->IsSuspended())
+    {
+        client->SubmitVerify();  // 挂起期间recv照常进行，收到的数据由HttpConn暂存
+    }
+}
+
+// shutdown唤醒在途的recv/send，等它们都完成后再真正关闭fd
+void SubReactor::CloseConnUring_(HttpConn* client){
+    int fd = client->GetFd();
+    if(fd < 0 || fd >= MAX_FD)
+    {
+        return;
+    }
+    UringConn& uc = uringConns_[fd];
+    if(uc.closing)
+    {
+        return;
+    }
+    LOG_INFO("SubReactor[%d] Client[%d] quit!", id_, fd);
+    uc.closing = true;
+    shutdown(fd, SHUT_RDWR);
+    if(uc.inflight == 0)
+    {
+        uc.closing = false;
+        client->Close();
+    }
+}
+
+void SubReactor::DoneOp_(int fd){
+    UringConn& uc = uringConns_[fd];
+    assert(uc.inflight > 0);
+    uc.inflight--;
+    if(uc.closing && uc.inflight == 0)
+    {
+        uc.closing = false;
+        clients_.Get(fd)->Close();
+    }
+}
+
+void SubReactor::OnAcceptCqe_(int res, uint32_t flags){
+    if(res >= 0)
+    {
+        int fd = res;
+        if(fd >= MAX_FD || HttpConn::UserCount >= MAX_FD)
+        {
+            SendError_(fd, "Internal Server Busy");
+            LOG_WARN("Clients are full!");
+        }
+        else
+        {
+            struct sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            memset(&addr, 0, sizeof(addr));
+            getpeername(fd, (struct sockaddr *)&addr, &len);
+            HttpConn* client = clients_.Get(fd);
+            client->Init(fd, addr, notifier_.Fd() >= 0 ? &notifier_ : nullptr);
+            UringConn& uc = uringConns_[fd];
+            uc.inflight = 0;
+            uc.closing = false;
+            uc.sending = false;
+            if(timeoutMS_ > 0)
+            {
+                timer_->Add(client->TimerNode(), timeoutMS_);
+            }
+            ArmRecv_(fd);
+            accepted_.fetch_add(1, std::memory_order_relaxed);
+            LOG_INFO("SubReactor[%d] Client[%d] in!", id_, fd);
+        }
+    }
+    else if(res == -EINVAL && multishotAccept_)
+    {
+        LOG_WARN("SubReactor[%d] multishot accept unsupported", id_);
+        multishotAccept_ = false;
+    }
+    if(!(flags & IORING_CQE_F_MORE))  // multishot被内核终止或本来就是单次请求，重新提交
+    {
+        ArmAccept_();
+    }
+}
+
+void SubReactor::OnRecvCqe_(int fd, int res, uint32_t flags){
+    UringConn& uc = uringConns_[fd];
+    bool more = flags & IORING_CQE_F_MORE;
+    bool closing = uc.closing;
+    if(flags & IORING_CQE_F_BUFFER)
+    {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        char* buf = &uringBufs_[static_cast<size_t>(bid) * URING_BUF_SIZE];
+        if(res > 0 && !closing)
+        {
+            clients_.Get(fd)->Feed(buf, res);
+        }
+        uring_->PrepProvideBuffers(buf, URING_BUF_SIZE, 1, URING_BUF_GROUP, bid, UserData_(OP_PROVIDE, -1));
+    }
+    if(!more)
+    {
+        DoneOp_(fd);
+    }
+    if(closing)
+    {
+        return;
+    }
+
+    HttpConn* client = clients_.Get(fd);
+    if(res > 0)
+    {
+        ExtentTime_(client);
+        if(!uc.sending)
+        {
+            ProcessUring_(client);
+        }
+    }
+    else if(res == 0 || (res != -ENOBUFS && res != -EINVAL && res != -EAGAIN && res != -EINTR))
+    {
+        CloseConn_(client);
+        return;
+    }
+    else if(res == -EINVAL && multishotRecv_)
+    {
+        LOG_WARN("SubReactor[%d] multishot recv unsupported", id_);
+        multishotRecv_ = false;
+    }
+    if(!more)
+    {
+        ArmRecv_(fd);
+    }
+}
+
+void SubReactor::OnSendCqe_(int fd, int res){
+    UringConn& uc = uringConns_[fd];
+    bool closing = uc.closing;
+    uc.sending = false;
+    DoneOp_(fd);
+    if(closing)
+    {
+        return;
+    }
+    HttpConn* client = clients_.Get(fd);
+    if(res < 0)
+    {
+        if(res == -EAGAIN || res == -EINTR)
+        {
+            SubmitWrite_(client);
+            return;
+        }
+        CloseConn_(client);
+        return;
+    }
+    client->HasSent(res);
+    if(client->ToWriteBytes() > 0)
+    {
+        SubmitWrite_(client);  // 未发完，继续发送剩余部分
+    }
+    else if(client->IsKeepAlive())
+    {
+        ProcessUring_(client);  // 响应发送期间可能已收到下一个请求
+    }
+    else
+    {
+        CloseConn_(client);
+    }
+}
+
+void SubReactor::LoopUring_(){
+    int timeMS = -1;
+    LOG_INFO("SubReactor[%d] start!", id_);
+    while(!isClose_)
+    {
+        if(timeoutMS_ > 0)
+        {
+            timeMS = timer_->GetNextTick();
+        }
+        if(uring_->SubmitAndWait(timeMS) < 0)
+        {
+            LOG_ERROR("SubReactor[%d] io_uring_enter error: %d", id_, errno);  // 出错也要取走已有的完成事件，否则下一次进入仍会失败
+        }
+        if(timeoutMS_ > 0)
+        {
+            timer_->Tick();
+        }
+        struct io_uring_cqe* cqe = nullptr;
+        while((cqe = uring_->PeekCqe()) != nullptr)
+        {
+            int op = static_cast<int>(cqe->user_data >> 32);
+            int fd = static_cast<int>(static_cast<uint32_t>(cqe->user_data));
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring_->SeenCqe();
+            switch(op)
+            {
+            case OP_ACCEPT:
+                OnAcceptCqe_(res, flags);
+                break;
+            case OP_RECV:
+                OnRecvCqe_(fd, res, flags);
+                break;
+            case OP_SEND:
+                OnSendCqe_(fd, res);
+                break;
+            case OP_NOTIFY:
+                DealResume_();
+                ArmNotify_();
+                break;
+            case OP_WAKE:  // Stop唤醒，循环条件负责退出
+                break;
+            case OP_PROVIDE:
+                if(res < 0)
+                {
+                    LOG_ERROR("SubReactor[%d] provide buffers error: %d", id_, res);
+                }
+                break;
+            default:
+                LOG_ERROR("Unexpected completion");
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef SUBREACTOR_H
+#define SUBREACTOR_H
+
+#include <vector>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "epoller.h"
+#include "uringer.h"
+#include "connslab.h"
+#include "../timer/timingwheel.h"
+#include "../log/log.h"
+#include "../http/httpconn.h"
+#include "../pool/sqlasync.h"
+
+/*多Reactor模式下的子Reactor（one loop per thread）
+每个子Reactor独占一个Epoller、一个时间轮和自己的那部分客户端连接，
+并通过SO_REUSEPORT各自监听同一个端口，由内核把新连接分散到各个子Reactor上。
+连接的读、处理、写都在所属线程内完成，不会在线程之间迁移，也不需要线程池。
+登录/注册的数据库查询交给数据库线程，结果经本子Reactor的SqlNotifier回到本线程恢复请求。
+事件后端可选epoll或io_uring，io_uring不可用时自动退回epoll*/
+
+class SubReactor{
+public:
+    SubReactor(int id, int port, uint32_t listenEvent, uint32_t connEvent, int timeoutMS, bool useUring = false);
+    ~SubReactor();
+
+    bool Init();  //创建SO_REUSEPORT监听socket并注册到epoll
+    void Loop();  //事件循环，在所属线程中运行
+    void Stop();  //可在其他线程调用：唤醒事件循环并让Loop返回，连接在析构时关闭
+    int Id() const { return id_; }
+    uint64_t Accepted() const { return accepted_; }  //本子Reactor接受的连接数
+    bool IsUring() const { return uring_ != nullptr; }
+
+private:
+    void AddClient_(int fd, sockaddr_in addr);
+
+    void DealListen_();
+    void SendError_(int fd, const char* info);
+    void ExtentTime_(HttpConn* client);
+    void CloseConn_(HttpConn* client);
+    static void OnTimeout_(void* arg, void* data);  //时间轮超时回调，data为HttpConn
+
+    void OnRead_(HttpConn* client);
+    void OnWrite_(HttpConn* client);
+    void OnProcess_(HttpConn* client);
+    void DealResume_();  //数据库结果到达，恢复被挂起的连接
+
+    /*io_uring后端*/
+    bool InitUring_();
+    void LoopUring_();
+    void ArmAccept_();
+    void ArmRecv_(int fd);
+    void ArmNotify_();
+    void SubmitWrite_(HttpConn* client);
+    void ProcessUring_(HttpConn* client);
+    void CloseConnUring_(HttpConn* client);
+    void OnAcceptCqe_(int res, uint32_t flags);
+    void OnRecvCqe_(int fd, int res, uint32_t flags);
+    void OnSendCqe_(int fd, int res);
+    void DoneOp_(int fd);  //一个在途请求完成，连接正在关闭且没有在途请求时真正关闭fd
+
+    static uint64_t UserData_(int op, int fd) { return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd); }
+
+    enum URING_OP{
+        OP_ACCEPT,
+        OP_RECV,
+        OP_SEND,
+        OP_PROVIDE,
+        OP_NOTIFY,
+        OP_WAKE
+    };
+
+    struct UringConn{
+        int inflight;    // 尚未完成的请求数，为0之前不能close(fd)，防止fd被复用后收到旧的完成事件
+        bool closing;    // 已shutdown，等待在途请求结束
+        bool sending;    // 有sendmsg在途
+        struct msghdr msg;  // sendmsg需要在请求完成前保持有效
+    };
+
+    static const int MAX_FD = 65536;  //最大文件描述符数量
+    static const int URING_BUF_SIZE = 4096;  //提供给内核的单个接收缓冲区大小
+    static const int URING_BUF_COUNT = 512;  //接收缓冲区数量
+    static const uint16_t URING_BUF_GROUP = 0;
+
+    static int SetFdNonBlock_(int fd);
+
+    int id_;  //子Reactor编号
+    int port_;
+    int timeoutMS_;
+    std::atomic<bool> isClose_;
+    int listenFd_;  //本子Reactor独占的监听socket
+    int wakeFd_;  //eventfd，Stop时唤醒事件循环
+    std::atomic<uint64_t> accepted_;
+
+    uint32_t listenEvent_;
+    uint32_t connEvent_;
+
+    std::unique_ptr<TimingWheel> timer_;  //空闲超时时间轮
+    std::unique_ptr<Epoller> epoller_;
+
+    ConnSlab clients_;  //只属于本线程的客户端连接，以fd为下标
+    SqlNotifier notifier_;  //数据库线程投递结果，未启用非阻塞数据库时Fd()为-1
+
+    bool useUring_;
+    std::unique_ptr<Uringer> uring_;  //非空表示使用io_uring后端
+    bool multishotAccept_;  //内核不支持multishot时退化为单次请求
+    bool multishotRecv_;
+    std::vector<char> uringBufs_;  //提供给内核的接收缓冲区
+    std::vector<UringConn> uringConns_;  //以fd为下标的io_uring连接状态
+};
+
+
+#endif // SUBREACTOR_H
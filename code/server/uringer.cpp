@@ -0,0 +1,220 @@
+#include "uringer.h"
+
+
+Uringer::Uringer(unsigned entries): ringFd_(-1), entries_(entries), sqRing_(MAP_FAILED), cqRing_(MAP_FAILED),
+    sqRingSize_(0), cqRingSize_(0), sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqLocalTail_(0), sqSubmitted_(0), stashHead_(0) {
+    assert(entries_ > 0);
+}
+
+Uringer::~Uringer() {
+    if(sqes_ != MAP_FAILED) {
+        munmap(sqes_, entries_ * sizeof(struct io_uring_sqe));
+    }
+    if(cqRing_ != MAP_FAILED && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if(sqRing_ != MAP_FAILED) {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if(ringFd_ >= 0) {
+        close(ringFd_);
+    }
+}
+
+
+// 创建io_uring并映射提交队列、完成队列
+bool Uringer::Init() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringFd_ = syscall(__NR_io_uring_setup, entries_, &p);
+    if(ringFd_ < 0) {
+        return false;  // 内核不支持或被禁用
+    }
+    // 等待超时依赖IORING_ENTER_EXT_ARG（5.11+），没有则认为内核太旧
+    if(!(p.features & IORING_FEAT_EXT_ARG)) {
+        close(ringFd_);
+        ringFd_ = -1;
+        return false;
+    }
+    entries_ = p.sq_entries;
+
+    sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = p.features & IORING_FEAT_SINGLE_MMAP;  // 提交队列和完成队列共用一次mmap
+    if(singleMmap) {
+        if(cqRingSize_ > sqRingSize_) {
+            sqRingSize_ = cqRingSize_;
+        }
+        cqRingSize_ = sqRingSize_;
+    }
+
+    sqRing_ = mmap(0, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED) {
+        return false;
+    }
+    if(singleMmap) {
+        cqRing_ = sqRing_;
+    }
+    else {
+        cqRing_ = mmap(0, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+        if(cqRing_ == MAP_FAILED) {
+            return false;
+        }
+    }
+    sqes_ = static_cast<struct io_uring_sqe*>(mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES));
+    if(sqes_ == MAP_FAILED) {
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sqLocalTail_ = sqSubmitted_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+}
+
+
+// 获取一个空闲的提交队列项，队列满时先把已有的请求提交给内核
+// 完成队列溢出时内核拒绝提交（EBUSY），这时先把完成事件暂存到本地再重试
+struct io_uring_sqe* Uringer::GetSqe_() {
+    assert(IsOpen());
+    while(sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= entries_) {
+        int ret = Enter_(sqLocalTail_ - sqSubmitted_, 0, IORING_ENTER_GETEVENTS, -1);
+        if(ret < 0 && errno != EBUSY && errno != EAGAIN && errno != EINTR) {
+            break;
+        }
+        StashCqes_();
+    }
+    assert(sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) < entries_);
+    unsigned idx = sqLocalTail_ & *sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[idx] = idx;
+    sqLocalTail_++;
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// multishot为true时一次提交持续accept，每个新连接产生一个完成事件（5.19+）
+void Uringer::PrepAccept(int fd, bool multishot, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    if(multishot) {
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    }
+    sqe->user_data = userData;
+}
+
+// 由内核从bufGroup中挑选缓冲区接收数据，完成事件中带回缓冲区编号
+void Uringer::PrepRecv(int fd, uint16_t bufGroup, bool multishot, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufGroup;
+    if(multishot) {
+        sqe->ioprio |= IORING_RECV_MULTISHOT;
+    }
+    sqe->user_data = userData;
+}
+
+void Uringer::PrepSendmsg(int fd, const struct msghdr* msg, unsigned flags, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = userData;
+}
+
+// 向内核提供nr个长度为len的缓冲区，编号从bid开始
+void Uringer::PrepProvideBuffers(void* addr, unsigned len, int nr, uint16_t bufGroup, uint16_t bid, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = nr;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->len = len;
+    sqe->off = bid;
+    sqe->buf_group = bufGroup;
+    sqe->user_data = userData;
+}
+
+void Uringer::PrepPollAdd(int fd, unsigned events, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = userData;
+}
+
+
+int Uringer::Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMS) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if(timeoutMS >= 0) {
+        ts.tv_sec = timeoutMS / 1000;
+        ts.tv_nsec = (timeoutMS % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+    int ret = syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete,
+                      flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if(ret > 0) {
+        sqSubmitted_ += ret;
+    }
+    return ret;
+}
+
+// 提交并等待：所有在本轮事件处理中产生的send/recv请求在这一次io_uring_enter中批量提交
+// EBUSY/EAGAIN说明完成队列溢出或内核暂时无法接收，请求留在提交队列里，调用方取完完成事件后下一轮再提交
+int Uringer::SubmitAndWait(int timeoutMS) {
+    bool ready = stashHead_ < stash_.size() || *cqHead_ != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    int ret = Enter_(sqLocalTail_ - sqSubmitted_, ready ? 0 : 1, IORING_ENTER_GETEVENTS, timeoutMS);
+    if(ret < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN)) {
+        return 0;
+    }
+    return ret;
+}
+
+void Uringer::StashCqes_() {
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++) {
+        stash_.push_back(cqes_[head & *cqMask_]);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+}
+
+struct io_uring_cqe* Uringer::PeekCqe() {
+    if(stashHead_ < stash_.size()) {
+        return &stash_[stashHead_];
+    }
+    unsigned head = *cqHead_;
+    if(head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &cqes_[head & *cqMask_];
+}
+
+void Uringer::SeenCqe() {
+    if(stashHead_ < stash_.size()) {
+        if(++stashHead_ == stash_.size()) {
+            stash_.clear();
+            stashHead_ = 0;
+        }
+        return;
+    }
+    __atomic_store_n(cqHead_, *cqHead_ + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,71 @@
+#ifndef URINGER_H
+#define URINGER_H
+
+#include <linux/io_uring.h>  //io_uring 相关的数据结构和常量（直接使用系统调用，不依赖liburing）
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <vector>
+
+/*io_uring的轻量封装，作为Epoller之外的另一种事件后端
+只提供事件循环需要的几种请求：多次触发accept、使用内核提供缓冲区的recv、sendmsg、提供缓冲区，以及监听eventfd等的poll*/
+
+class Uringer{
+public:
+    explicit Uringer(unsigned entries = 1024);
+    ~Uringer();
+
+    bool Init();  //创建ring，内核不支持时返回false，由调用方退回epoll
+    bool IsOpen() const { return ringFd_ >= 0; }
+
+    void PrepAccept(int fd, bool multishot, uint64_t userData);
+    void PrepRecv(int fd, uint16_t bufGroup, bool multishot, uint64_t userData);
+    void PrepSendmsg(int fd, const struct msghdr* msg, unsigned flags, uint64_t userData);
+    void PrepProvideBuffers(void* addr, unsigned len, int nr, uint16_t bufGroup, uint16_t bid, uint64_t userData);
+    void PrepPollAdd(int fd, unsigned events, uint64_t userData);  //单次poll，完成后需重新提交
+
+    int SubmitAndWait(int timeoutMS = -1);  //一次系统调用提交所有待提交的请求并等待至少一个完成事件，完成队列溢出时返回0，由调用方先取走完成事件
+
+    //遍历完成队列（先返回提交队列满时暂存到本地的完成事件）
+    struct io_uring_cqe* PeekCqe();
+    void SeenCqe();
+
+private:
+    struct io_uring_sqe* GetSqe_();
+    int Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMS);
+    void StashCqes_();  //把完成队列中的事件搬到本地，给内核腾出位置
+
+    int ringFd_;
+    unsigned entries_;
+
+    void* sqRing_;
+    void* cqRing_;
+    size_t sqRingSize_;
+    size_t cqRingSize_;
+    struct io_uring_sqe* sqes_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqArray_;
+    unsigned sqLocalTail_;  //本地已填充但尚未提交给内核的队尾
+    unsigned sqSubmitted_;  //已提交给内核的队尾
+
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+    struct io_uring_cqe* cqes_;
+
+    std::vector<struct io_uring_cqe> stash_;  //提交队列满、完成队列也满时暂存的完成事件，按顺序先于完成队列返回
+    size_t stashHead_;
+};
+
+
+#endif // URINGER_H
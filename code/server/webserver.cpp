@@ -7,7 +7,13 @@ WebServer::WebServer(
     int port, int trigMode, int timeoutMS, 
     int sqlPort, const char* sqlUser, const char* sqlPwd, const char* sqlDBName,   
     int connPoolNum, int threadNum, 
-    bool openLog, int logLevel, int logQueueSize): port_(port), timeoutMS_(timeoutMS), isClose_(false), timer_(new HeapTimer()), threadPool_(new ThreadPool(threadNum)), epoller_(new Epoller()) 
+    bool openLog, int logLevel, int logQueueSize,
+    int reactorNum, bool useUring,
+    int fileCacheMB, int fileCacheEntries, int sendfileKB,
+    int respCacheMB, int respCacheMaxKB, bool watchResources, int packMode,
+    int userCacheMB, int userCacheSec): port_(port), timeoutMS_(timeoutMS), isClose_(false), listenFd_(-1), timer_(new TimingWheel(&WebServer::OnTimeout_, this)),
+    threadPool_(reactorNum > 0 ? nullptr : new ThreadPool(threadNum)), epoller_(new Epoller()), reactorNum_(reactorNum),
+    useUring_(useUring)
 {
     // 如果开启日志
     if(openLog){
@@ -23,7 +29,17 @@ WebServer::WebServer(
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",(listenEvent_ & EPOLLET ? "ET" : "LT"), (connEvent_ & EPOLLET ? "ET" : "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::SrcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            if(reactorNum > 0)
+            {
+                LOG_INFO("SqlConnPool num: %d, SubReactor num: %d", connPoolNum, reactorNum);
+            }
+            else
+            {
+                LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            }
+            LOG_INFO("FileCache: %d MB, %d entries, sendfile >= %d KB", fileCacheMB, fileCacheEntries, sendfileKB);
+            LOG_INFO("ResponseCache: %d MB, responses <= %d KB", respCacheMB, respCacheMaxKB);
+            LOG_INFO("UserCache: %d MB, ttl %d s", userCacheMB, userCacheSec);
         }
     }
 
@@ -37,13 +53,74 @@ WebServer::WebServer(
     HttpConn::SrcDir = srcDir_;
     // 设置HttpConn的静态成员变量UserCount为0
     HttpConn::UserCount = 0;
+    // 大文件改用sendfile发送（io_uring后端仍通过映射发送）
+    HttpConn::SendfileMin = sendfileKB > 0 ? static_cast<size_t>(sendfileKB) << 10 : 0;
 
-    // 初始化数据库连接池
-    SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, sqlDBName, connPoolNum);
+    // 资源包模式：资源目录打包成工作目录下的resources.pack，之后所有静态文件都从包的映射中取
+    string packPath;
+    shared_ptr<ResourcePack> pack;
+    if(packMode > 0)
+    {
+        packPath = string(srcDir_, strlen(srcDir_) - strlen("resources/")) + "resources.pack";
+        if(ResourcePack::Build(srcDir_, packPath))
+        {
+            pack = ResourcePack::Load(packPath, packMode > 1);
+        }
+        if(pack)
+        {
+            LOG_INFO("ResourcePack: %d files, %d KB", (int)pack->Count(), (int)(pack->Bytes() >> 10));
+        }
+        else
+        {
+            LOG_WARN("ResourcePack unavailable, serving files from %s", srcDir_);
+            packPath.clear();
+        }
+    }
+    // 监视资源目录：文件变化由inotify事件立即失效，定时stat复查只作为兜底（如经过"//"、".."等别名访问的路径）
+    int revalidateMS = 1000;
+    if(watchResources)
+    {
+        watcher_.reset(new ResourceWatcher(srcDir_));
+        if(!packPath.empty())
+        {
+            watcher_->SetPack(packPath, packMode > 1);
+        }
+        if(watcher_->Start())
+        {
+            revalidateMS = 60000;
+        }
+        else
+        {
+            watcher_.reset();
+        }
+    }
+    // 初始化静态文件缓存
+    FileCache::Instance()->Init(static_cast<size_t>(fileCacheMB) << 20, fileCacheEntries, revalidateMS);
+    if(pack)
+    {
+        FileCache::Instance()->SetPack(srcDir_, pack);
+    }
+    // 初始化小响应整包缓存
+    ResponseCache::Instance()->Init(static_cast<size_t>(respCacheMB) << 20, static_cast<size_t>(respCacheMaxKB) << 10, revalidateMS);
+    // 初始化数据库：优先使用非阻塞连接，由数据库线程推进查询，IO线程不再等待数据库；客户端库不支持时退回阻塞的连接池
+    if(!SqlAsync::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, sqlDBName, connPoolNum))
+    {
+        LOG_WARN("Non-blocking MySQL unavailable, use blocking SqlConnPool");
+        SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, sqlDBName, connPoolNum);
+    }
+    // 用户缓存：登录/注册结果先查缓存，已有用户名载入Bloom过滤器，新用户注册时跳过查询
+    UserCache::Instance()->Init(static_cast<size_t>(userCacheMB) << 20, userCacheSec * 1000);
+    UserCache::Instance()->LoadNames("localhost", sqlPort, sqlUser, sqlPwd, sqlDBName);
     // 初始化事件模式
     InitEventMode_(trigMode);
-    // 初始化socket
-    if(!InitSocket_())
+    // io_uring后端只在多Reactor模式下使用，单Reactor+线程池模式仍走epoll
+    if(useUring_ && reactorNum_ <= 0)
+    {
+        LOG_WARN("io_uring backend requires multi-reactor mode, use epoll");
+        useUring_ = false;
+    }
+    // 初始化socket，多Reactor模式下由每个子Reactor各自创建监听socket
+    if(reactorNum_ > 0 ? !InitSubReactors_() : !InitSocket_())
     {
         isClose_ = true;
     }
@@ -53,12 +130,23 @@ WebServer::WebServer(
 // 析构函数，释放资源
 WebServer::~WebServer(){
     // 关闭监听文件描述符
-    close(listenFd_);
+    if(listenFd_ >= 0)
+    {
+        close(listenFd_);
+    }
     // 设置关闭标志
     isClose_ = true;
+    // 定时器节点嵌在HttpConn中，时间轮要在clients_析构之前摘除它们
+    timer_.reset();
+    // 停止资源目录监视线程
+    watcher_.reset();
     // 释放源目录
     free(srcDir_);
-    // 关闭数据库连接池
+    // 关闭数据库线程和连接池
+    UserCache* users = UserCache::Instance();
+    LOG_INFO("UserCache: %d users, hits %llu misses %llu, %llu registrations skipped the lookup", (int)users->Count(),
+             (unsigned long long)users->Hits(), (unsigned long long)users->Misses(), (unsigned long long)users->BloomSkips());
+    SqlAsync::Instance()->Close();
     SqlConnPool::Instance()->ClosePool();
 }
 
@@ -124,17 +212,23 @@ void WebServer::CloseConn_(HttpConn* client){
     client->Close();
 }
 
+// 时间轮超时回调，定时器节点嵌入在HttpConn中，fd复用时节点会被重新Add，不会误关新连接
+void WebServer::OnTimeout_(void* arg, void* data){
+    static_cast<WebServer*>(arg)->CloseConn_(static_cast<HttpConn*>(data));
+}
+
 // 添加客户端
 void WebServer::AddClient_(int fd, sockaddr_in addr){
     assert(fd > 0);  // 断言文件描述符大于0
-    clients_[fd].Init(fd, addr);  // 初始化客户端
+    HttpConn* client = clients_.Get(fd);
+    client->Init(fd, addr, notifier_.Fd() >= 0 ? &notifier_ : nullptr);  // 初始化客户端
     if(timeoutMS_ > 0)
     {
-        timer_->Add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &clients_[fd]));   // 添加定时器  // std::bind(&WebServer::CloseConn_, this, &clients_[fd])  将CloseConn_函数绑定到this指针和clients_[fd]指针上
+        timer_->Add(client->TimerNode(), timeoutMS_);   // 添加定时器，节点嵌入在连接中，无需分配回调对象
     }
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);  // 添加文件描述符到epoller中
+    epoller_->AddFd(fd, EPOLLIN | connEvent_, ConnSlab::Key(client));  // 添加文件描述符到epoller中，事件数据携带fd和代数
     SetFdNonBlock_(fd);  // 设置文件描述符为非阻塞
-    LOG_INFO("Client[%d] in!", clients_[fd].GetFd());  // 记录日志
+    LOG_INFO("Client[%d] in!", client->GetFd());  // 记录日志
 }
 
 
@@ -154,7 +248,7 @@ void WebServer::DealListen_(){
             return;
         }
         // 如果当前连接数大于等于最大连接数，表示服务器忙，向客户端发送错误信息，并记录日志，然后返回
-        else if(HttpConn::UserCount >= MAX_FD)
+        else if(fd >= MAX_FD || HttpConn::UserCount >= MAX_FD)
         {
             SendError_(fd, "Internal Server Busy");
             LOG_WARN("Clients are full!");
@@ -190,7 +284,7 @@ void WebServer::ExtentTime_(HttpConn* client){
     if(timeoutMS_ > 0)
     {
         // 调整client的文件描述符对应的超时时间
-        timer_->Adjust(client->GetFd(), timeoutMS_);
+        timer_->Adjust(client->TimerNode(), timeoutMS_);
     }
 }
 
@@ -217,11 +311,41 @@ void WebServer::OnProcess_(HttpConn* client){
     // 如果客户端处理成功
     if(client->Process())  //根据返回的信息重新将fd置为EPOLLIN或EPOLLOUT
     {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);  // 修改文件描述符的监听事件为可写
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, ConnSlab::Key(client));  // 修改文件描述符的监听事件为可写
+    }
+    else if(client->IsSuspended())  // 挂起等待数据库时不监听任何事件（EPOLLONESHOT），结果到达后由DealResume_恢复
+    {
+        client->SubmitVerify();  // 结果可能立即到达并交给其他工作线程，之后不能再访问client
     }
     else
     {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);  // 修改文件描述符的监听事件为可读
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN, ConnSlab::Key(client));  // 修改文件描述符的监听事件为可读
+    }
+}
+
+
+// 取出数据库线程投递的结果，连接已关闭或fd已被复用的结果直接丢弃
+void WebServer::DealResume_(){
+    std::vector<SqlResult> results;
+    notifier_.Pop(results);
+    for(const SqlResult& result : results)
+    {
+        HttpConn* client = clients_.Find(result.key);
+        if(client == nullptr || !client->IsSuspended())
+        {
+            LOG_DEBUG("Stale sql result on fd[%d]", ConnSlab::KeyFd(result.key));
+            continue;
+        }
+        ExtentTime_(client);
+        threadPool_->addTask(std::bind(&WebServer::OnResume_, this, client, result.ok));
+    }
+}
+
+// 被挂起的请求一定会生成响应，之后与普通请求一样注册EPOLLOUT
+void WebServer::OnResume_(HttpConn* client, bool ok){
+    if(client->Resume(ok))
+    {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, ConnSlab::Key(client));
     }
 }
 
@@ -235,11 +359,10 @@ void WebServer::OnWrite_(HttpConn* client){
     ret = client->Write(&writeErrno);  // 发送数据
     if(client->ToWriteBytes() == 0)
     {
-        // 如果还有数据要发送
+        // 本批响应发送完毕
         if(client->IsKeepAlive())
         {
-            //OnProcess_(client);  // 继续处理请求
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);  // 修改文件描述符的监听事件为可读
+            OnProcess_(client);  // 读缓冲区中可能还有流水线请求，没有则重新监听可读
             return;
         }
     }
@@ -249,7 +372,7 @@ void WebServer::OnWrite_(HttpConn* client){
         if(writeErrno == EAGAIN)   // EAGAIN：非阻塞IO，没有数据可写
         {
             // 继续发送
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);  // 修改文件描述符的监听事件为可写
+            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, ConnSlab::Key(client));  // 修改文件描述符的监听事件为可写
             return;
         }
     }
@@ -308,10 +431,47 @@ bool WebServer::InitSocket_(){
         return false;
     }
     SetFdNonBlock_(listenFd_);  // 设置监听套接字为非阻塞
+    // 非阻塞数据库的结果通过eventfd回到主线程
+    if(SqlAsync::Instance()->IsOpen() && (!notifier_.Init() || !epoller_->AddFd(notifier_.Fd(), EPOLLIN)))
+    {
+        LOG_ERROR("Add sql notifier error!");
+        close(listenFd_);
+        return false;
+    }
     LOG_INFO("Server port:%d", port_);
     return true;
 }
 
+// 多Reactor模式：创建reactorNum_个子Reactor，每个都有自己的SO_REUSEPORT监听socket
+bool WebServer::InitSubReactors_(){
+    for(int i = 0; i < reactorNum_; i++)
+    {
+        std::unique_ptr<SubReactor> reactor(new SubReactor(i, port_, listenEvent_, connEvent_, timeoutMS_, useUring_));
+        if(!reactor->Init())
+        {
+            subReactors_.clear();
+            return false;
+        }
+        subReactors_.push_back(std::move(reactor));
+    }
+    LOG_INFO("Server port:%d, SubReactor num:%d", port_, reactorNum_);
+    return true;
+}
+
+// 多Reactor模式：前reactorNum_-1个子Reactor各起一个线程，最后一个在当前线程运行
+void WebServer::StartSubReactors_(){
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i + 1 < subReactors_.size(); i++)
+    {
+        threads.emplace_back(&SubReactor::Loop, subReactors_[i].get());
+    }
+    subReactors_.back()->Loop();
+    for(auto& t : threads)
+    {
+        t.join();
+    }
+}
+
 int WebServer::SetFdNonBlock_(int fd){
     assert(fd > 0);
     return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK); // 设置文件描述符为非阻塞,fcntl函数用于获取或设置文件描述符的属性
@@ -325,6 +485,11 @@ void WebServer::Start(){
     {
         LOG_INFO("=========== Server start! ==========");
     }
+    if(!isClose_ && reactorNum_ > 0)
+    {
+        StartSubReactors_();
+        return;
+    }
     while(!isClose_)
     {
         if(timeoutMS_ > 0)
@@ -332,33 +497,46 @@ void WebServer::Start(){
             timeMS = timer_->GetNextTick();  // 获取下一次的超时等待事件(至少这个时间才会有用户过期，每次关闭超时连接则需要有新的请求进来)
         }
         int eventCnt = epoller_->Wait(timeMS);  // 等待事件发生 
+        if(timeoutMS_ > 0)
+        {
+            timer_->Tick();  // 时间轮推进到当前时刻，本轮的Add/Adjust都以此为基准，不必每次读时钟
+        }
         for(int i = 0; i < eventCnt; i++)
         {
-            //处理事件
-            int fd = epoller_->GetEventFd(i);
+            //处理事件，事件数据中携带fd和连接代数，直接定位连接槽
+            uint64_t key = epoller_->GetEventData(i);
             uint32_t events = epoller_->GetEvents(i);
-            if(fd == listenFd_)   // 如果是监听套接字
+            if(ConnSlab::KeyFd(key) == listenFd_)   // 如果是监听套接字
             {
                 DealListen_();
+                continue;
+            }
+            if(ConnSlab::KeyFd(key) == notifier_.Fd())   // 数据库结果
+            {
+                DealResume_();
+                continue;
+            }
+            HttpConn* client = clients_.Find(key);
+            if(client == nullptr)  // 连接已在本轮中被关闭（fd可能已被复用），丢弃过期事件
+            {
+                LOG_DEBUG("Stale event on fd[%d]", ConnSlab::KeyFd(key));
+                continue;
             }
-            else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))  // 如果是错误事件
+            if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))  // 如果是错误事件
             {
                 /*处理连接异常情况：
                 EPOLLRDHUP: 对端关闭连接或关闭写端
                 EPOLLHUP: 连接挂起
                 EPOLLERR: 连接出错*/
-                assert(clients_.count(fd) > 0);
-                CloseConn_(&clients_[fd]);
+                CloseConn_(client);
             }
             else if(events & EPOLLIN)  // 如果是读事件
             {
-                assert(clients_.count(fd) > 0);
-                DealRead_(&clients_[fd]);  // 处理读事件
+                DealRead_(client);  // 处理读事件
             }
             else if(events & EPOLLOUT)  // 如果是写事件
             {
-                assert(clients_.count(fd) > 0);
-                DealWrite_(&clients_[fd]);  // 处理写事件
+                DealWrite_(client);  // 处理写事件
             }
             else
             {
@@ -9,13 +9,23 @@
 #include <sys/socket.h>     //这个库的头文件中定义了socket相关的函数
 #include <netinet/in.h>    //这个库的头文件中定义了IPv4和IPv6相关的结构体
 #include <arpa/inet.h>      //这个库的头文件中定义了inet_pton和inet_ntop函数
+#include <vector>
+#include <thread>
 
 #include "epoller.h"
-#include "../timer/heaptimer.h"
+#include "subreactor.h"
+#include "connslab.h"
+#include "../timer/timingwheel.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
+#include "../pool/sqlasync.h"
+#include "../pool/usercache.h"
 #include "../pool/threadpool.h"
 #include "../http/httpconn.h"
+#include "../http/filecache.h"
+#include "../http/responsecache.h"
+#include "../http/resourcewatcher.h"
+#include "../http/resourcepack.h"
 
 class WebServer{
 public:
@@ -23,7 +33,15 @@ public:
         int port, int trigMode, int timeoutMS,    //端口号，触发模式，超时时间
         int sqlPort, const char* sqlUser, const char* sqlPwd, const char* sqlDBName,   //数据库信息
         int connPoolNum, int threadNum,  //连接池和线程池数量
-        bool openLog, int logLevel, int logQueueSize   //日志信息
+        bool openLog, int logLevel, int logQueueSize,   //日志信息
+        int reactorNum = 0,   //子Reactor数量，0为单Reactor+线程池模式，大于0为多Reactor模式
+        bool useUring = false,   //多Reactor模式下使用io_uring事件后端，不可用时退回epoll
+        int fileCacheMB = 64, int fileCacheEntries = 1024,   //静态文件缓存的容量上限（MB）和条目数上限
+        int sendfileKB = 64,   //不小于该大小（KB）的文件用sendfile零拷贝发送，0为全部用writev
+        int respCacheMB = 8, int respCacheMaxKB = 32,   //小响应整包缓存的容量（MB）和单个响应的上限（KB），0为不缓存
+        bool watchResources = true,   //用inotify监视资源目录，文件变化时立即使缓存失效
+        int packMode = 0,   //资源包模式：0关闭，1启动时把资源目录打成一个包并映射，2同1并用MAP_POPULATE预读
+        int userCacheMB = 4, int userCacheSec = 60   //登录/注册用户缓存的容量（MB）和条目有效期（秒），0为不缓存
     );
 
     ~WebServer();
@@ -31,6 +49,8 @@ public:
 
 private:
     bool InitSocket_();
+    bool InitSubReactors_();  //多Reactor模式：创建子Reactor，各自通过SO_REUSEPORT监听
+    void StartSubReactors_();  //多Reactor模式：每个子Reactor一个线程
     void InitEventMode_(int trigMode);
     void AddClient_(int fd, sockaddr_in clientAddr);
 
@@ -41,10 +61,13 @@ private:
     void SendError_(int fd, const char* info);  //发送错误信息
     void ExtentTime_(HttpConn* client);  //延长超时时间
     void CloseConn_(HttpConn* client);  //关闭连接
+    static void OnTimeout_(void* arg, void* data);  //时间轮超时回调，data为HttpConn
 
     void OnRead_(HttpConn* client);  //处理读事件
     void OnWrite_(HttpConn* client);  //处理写事件
     void OnProcess_(HttpConn* client);  //处理业务
+    void DealResume_();  //数据库结果到达，把被挂起的连接交给线程池继续处理
+    void OnResume_(HttpConn* client, bool ok);
 
     static const int MAX_FD = 65536;  //最大文件描述符数量
 
@@ -60,11 +83,17 @@ private:
     uint32_t listenEvent_;  //监听事件模式（LT/ET）
     uint32_t connEvent_;  //连接事件模式（LT/ET）
 
-    std::unique_ptr<HeapTimer> timer_;  //定时器
+    std::unique_ptr<TimingWheel> timer_;  //空闲超时时间轮
     std::unique_ptr<ThreadPool> threadPool_;  //线程池
     std::unique_ptr<Epoller> epoller_;  //epoll对象
+    std::unique_ptr<ResourceWatcher> watcher_;  //资源目录监视线程，inotify不可用时为空
 
-    std::unordered_map<int, HttpConn> clients_;  //客户端连接
+    ConnSlab clients_;  //客户端连接，以fd为下标
+    SqlNotifier notifier_;  //数据库线程投递登录/注册结果，未启用非阻塞数据库时Fd()为-1
+
+    int reactorNum_;  //子Reactor数量
+    bool useUring_;  //是否使用io_uring后端
+    std::vector<std::unique_ptr<SubReactor>> subReactors_;  //多Reactor模式下的子Reactor
 };
 
 
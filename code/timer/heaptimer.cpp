@@ -19,16 +19,15 @@ void HeapTimer::SwapNode_(size_t i, size_t j) {
 void HeapTimer::SiftUp_(size_t i) {
     // 断言i在堆的范围内
     assert(i >= 0 && i < heap_.size());
-    // 计算父节点的索引
-    size_t parent = (i - 1) / 2;
-    // 当父节点存在时，继续调整
-    while(parent >= 0) {
+    // 当父节点存在时（i不是根节点），继续调整
+    while(i > 0) {
+        // 计算父节点的索引
+        size_t parent = (i - 1) / 2;
         // 如果父节点的值大于当前节点的值，交换节点
         if(heap_[parent] > heap_[i]) {
             SwapNode_(i, parent);
-            // 更新当前节点和父节点的索引
+            // 更新当前节点的索引
             i = parent;
-            parent = (i - 1) / 2;
         }
         else{
             // 否则，跳出循环
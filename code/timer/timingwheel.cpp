@@ -0,0 +1,186 @@
+#include "timingwheel.h"
+
+using namespace std;
+
+
+TimingWheel::TimingWheel(WheelCallback cb, void* arg): curTick_(0), count_(0), start_(WheelClock::now()), cb_(cb), arg_(arg) {
+    // 每个槽都是带哨兵的空循环链表
+    for(int i = 0; i < TVR_SIZE; i++) {
+        tvr_[i].prev = tvr_[i].next = &tvr_[i];
+    }
+    for(int l = 0; l < LEVELS; l++) {
+        for(int i = 0; i < TVN_SIZE; i++) {
+            tvn_[l][i].prev = tvn_[l][i].next = &tvn_[l][i];
+        }
+    }
+    curTick_ = NowTick_();
+}
+
+// 析构时只摘除节点，节点内存属于调用方
+TimingWheel::~TimingWheel() {
+    for(int i = 0; i < TVR_SIZE; i++) {
+        while(tvr_[i].next != &tvr_[i]) {
+            Unlink_(tvr_[i].next);
+        }
+    }
+    for(int l = 0; l < LEVELS; l++) {
+        for(int i = 0; i < TVN_SIZE; i++) {
+            while(tvn_[l][i].next != &tvn_[l][i]) {
+                Unlink_(tvn_[l][i].next);
+            }
+        }
+    }
+}
+
+void TimingWheel::SetCallback(WheelCallback cb, void* arg) {
+    cb_ = cb;
+    arg_ = arg;
+}
+
+
+uint64_t TimingWheel::NowTick_() const {
+    return chrono::duration_cast<chrono::milliseconds>(WheelClock::now() - start_).count() / TICK_MS;
+}
+
+void TimingWheel::Link_(WheelNode* head, WheelNode* node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void TimingWheel::Unlink_(WheelNode* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+}
+
+
+// 按到期时间距当前tick的远近选择层：越远的定时器放在越高层，到时再逐层下放
+void TimingWheel::Place_(WheelNode* node) {
+    uint64_t expire = node->expire;
+    if(expire < curTick_) {
+        expire = curTick_;   // 已过期的放到下一个处理的槽
+    }
+    uint64_t idx = expire - curTick_;
+    WheelNode* head = nullptr;
+    if(idx < static_cast<uint64_t>(TVR_SIZE)) {
+        head = &tvr_[expire & TVR_MASK];
+    }
+    else {
+        int level = 0;
+        int shift = TVR_BITS;
+        while(level < LEVELS - 1 && idx >= (1ULL << (shift + TVN_BITS))) {
+            level++;
+            shift += TVN_BITS;
+        }
+        if(idx >= (1ULL << (shift + TVN_BITS))) {   // 超出最大范围，放在最高层最远处
+            expire = curTick_ + (1ULL << (shift + TVN_BITS)) - 1;
+            node->expire = expire;
+        }
+        head = &tvn_[level][(expire >> shift) & TVN_MASK];
+    }
+    Link_(head, node);
+}
+
+void TimingWheel::Cascade_(int level, int index) {
+    WheelNode* head = &tvn_[level][index];
+    WheelNode list;   // 先整体摘下，再逐个重新放置
+    if(head->next == head) {
+        return;
+    }
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head->prev = head->next = head;
+    while(list.next != &list) {
+        WheelNode* node = list.next;
+        Unlink_(node);
+        Place_(node);
+    }
+}
+
+
+void TimingWheel::Add(WheelNode* node, int timeout) {
+    assert(node);
+    if(node->IsLinked()) {
+        Unlink_(node);
+        count_--;
+    }
+    node->expire = curTick_ + (timeout > 0 ? static_cast<uint64_t>(timeout) / TICK_MS : 0);
+    Place_(node);
+    count_++;
+}
+
+void TimingWheel::Adjust(WheelNode* node, int newExpires) {
+    assert(node);
+    Add(node, newExpires);
+}
+
+void TimingWheel::Del(WheelNode* node) {
+    assert(node);
+    if(node->IsLinked()) {
+        Unlink_(node);
+        count_--;
+    }
+}
+
+
+// 推进到当前时刻，依次处理经过的每个tick；第0层转满一圈时从高层下放一个槽
+void TimingWheel::Tick() {
+    uint64_t now = NowTick_();
+    if(count_ == 0) {
+        if(now >= curTick_) {
+            curTick_ = now + 1;
+        }
+        return;
+    }
+    while(curTick_ <= now) {
+        int index = curTick_ & TVR_MASK;
+        if(index == 0) {
+            int shift = TVR_BITS;
+            for(int l = 0; l < LEVELS; l++) {
+                int i = (curTick_ >> shift) & TVN_MASK;
+                Cascade_(l, i);
+                if(i != 0) {
+                    break;
+                }
+                shift += TVN_BITS;
+            }
+        }
+        WheelNode* head = &tvr_[index];
+        while(head->next != head) {
+            WheelNode* node = head->next;
+            Unlink_(node);
+            count_--;
+            if(cb_) {
+                cb_(arg_, node->data);   // 回调中可以安全地Add/Del其他节点，也可以重新Add本节点
+            }
+        }
+        curTick_++;
+        if(count_ == 0) {
+            curTick_ = now + 1;
+            break;
+        }
+    }
+}
+
+
+int TimingWheel::GetNextTick() {
+    Tick();
+    if(count_ == 0) {
+        return -1;
+    }
+    // 在第0层本圈剩余的槽中找第一个非空槽，找不到就在下一次下放时醒来
+    uint64_t target = (curTick_ | TVR_MASK) + 1;
+    for(uint64_t t = curTick_; t < target; t++) {
+        if(tvr_[t & TVR_MASK].next != &tvr_[t & TVR_MASK]) {
+            target = t;
+            break;
+        }
+    }
+    int64_t elapsed = chrono::duration_cast<chrono::milliseconds>(WheelClock::now() - start_).count();
+    int64_t res = static_cast<int64_t>(target) * TICK_MS - elapsed;
+    return res > 0 ? static_cast<int>(res) : 0;
+}
@@ -0,0 +1,70 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <chrono>
+#include <stdint.h>
+#include <assert.h>
+
+/*分层时间轮，用于连接空闲超时
+定时器节点侵入式地嵌入在HttpConn中，槽是双向循环链表：
+Add/Adjust/Del都是O(1)的链表摘除+插入，不需要堆调整，也不需要为回调分配std::function。
+4层时间轮：第0层256个槽，1~3层各64个槽，精度TICK_MS毫秒，可表示约2^26个tick的超时*/
+
+struct WheelNode{
+    WheelNode* prev;
+    WheelNode* next;   // 为nullptr表示不在时间轮中
+    uint64_t expire;   // 到期的tick
+    void* data;        // 回调时原样传回，一般指向所属对象
+
+    WheelNode(): prev(nullptr), next(nullptr), expire(0), data(nullptr) {}
+    bool IsLinked() const { return next != nullptr; }
+};
+
+typedef void (*WheelCallback)(void* arg, void* data);  // 超时回调：arg为注册时给定的上下文，data为WheelNode::data
+
+class TimingWheel{
+public:
+    explicit TimingWheel(WheelCallback cb = nullptr, void* arg = nullptr);
+    ~TimingWheel();
+
+    void SetCallback(WheelCallback cb, void* arg);
+
+    //Add/Adjust以最近一次Tick推进到的时刻为基准，不读时钟；事件循环在等待返回后应先调用一次Tick
+    void Add(WheelNode* node, int timeout);     //添加定时器，已在时间轮中则重新设置超时时间
+    void Adjust(WheelNode* node, int newExpires);   //调整超时时间，只是一次链表摘除和插入
+    void Del(WheelNode* node);   //删除定时器
+    void Tick();   //处理所有已到期的定时器
+    int GetNextTick();   //处理到期定时器，返回距离下一次需要处理的毫秒数，没有定时器时返回-1
+    size_t Size() const { return count_; }
+
+private:
+    typedef std::chrono::steady_clock WheelClock;
+
+    static const int TICK_MS = 1;
+    static const int TVR_BITS = 8;   // 第0层槽数的位数
+    static const int TVN_BITS = 6;   // 第1~3层槽数的位数
+    static const int TVR_SIZE = 1 << TVR_BITS;
+    static const int TVN_SIZE = 1 << TVN_BITS;
+    static const int TVR_MASK = TVR_SIZE - 1;
+    static const int TVN_MASK = TVN_SIZE - 1;
+    static const int LEVELS = 3;     // 第0层之外的层数
+
+    uint64_t NowTick_() const;   //当前时刻对应的tick
+    void Place_(WheelNode* node);   //按到期tick放入对应的层和槽
+    void Cascade_(int level, int index);   //把高层槽中的节点重新分配到低层
+    static void Link_(WheelNode* head, WheelNode* node);
+    static void Unlink_(WheelNode* node);
+
+    WheelNode tvr_[TVR_SIZE];   // 第0层，每个元素是槽的链表头
+    WheelNode tvn_[LEVELS][TVN_SIZE];
+
+    uint64_t curTick_;   // 下一个待处理的tick
+    size_t count_;
+    WheelClock::time_point start_;
+
+    WheelCallback cb_;
+    void* arg_;
+};
+
+
+#endif // TIMING_WHEEL_H
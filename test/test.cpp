@@ -1,5 +1,35 @@
 #include "../code/log/log.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/timer/timingwheel.h"
+#include "../code/http/httpparser.h"
+#include "../code/http/httpscan.h"
+#include "../code/http/httpresponse.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/resourcepack.h"
+#include "../code/http/resourcewatcher.h"
+#include "../code/http/httpconn.h"
+#include "../code/pool/sqlasync.h"
+#include "../code/pool/usercache.h"
+#include "../code/pool/threadpool.h"
+#include "../code/buffer/buffer.h"
+#include "../code/buffer/arena.h"
+#include "../code/server/uringer.h"
+#include "../code/server/subreactor.h"
+#include "../code/server/connslab.h"
 #include <features.h>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <regex>
+#include <unordered_map>
+#include <thread>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
@@ -39,6 +69,1432 @@ void TestLog(){
 }
 
 
+static double ElapsedMS(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void CountFired(void* arg, void* data){
+    (*static_cast<int*>(arg))++;
+}
+
+//HeapTimer与TimingWheel对比：10万个定时器的添加、100万次调整（模拟keep-alive请求续期）以及全部到期
+void TestTimer(){
+    const int N = 100000;
+    const int ADJUST = 1000000;
+    std::vector<int> order(ADJUST);
+    unsigned seed = 12345;
+    for(int i = 0; i < ADJUST; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        order[i] = (seed >> 8) % N;
+    }
+
+    int heapFired = 0;
+    HeapTimer heap;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++)
+    {
+        heap.Add(i, 60000 + i % 1000, [&heapFired](){ heapFired++; });
+    }
+    double heapAdd = ElapsedMS(start);
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ADJUST; i++)
+    {
+        heap.Adjust(order[i], 60000);
+    }
+    double heapAdjust = ElapsedMS(start);
+    for(int i = 0; i < N; i++)
+    {
+        heap.Adjust(i, 0);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    start = std::chrono::steady_clock::now();
+    heap.Tick();
+    double heapTick = ElapsedMS(start);
+
+    int wheelFired = 0;
+    TimingWheel wheel(CountFired, &wheelFired);
+    std::vector<WheelNode> nodes(N);
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++)
+    {
+        wheel.Add(&nodes[i], 60000 + i % 1000);
+    }
+    double wheelAdd = ElapsedMS(start);
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ADJUST; i++)
+    {
+        wheel.Adjust(&nodes[order[i]], 60000);
+    }
+    double wheelAdjust = ElapsedMS(start);
+    for(int i = 0; i < N; i++)
+    {
+        wheel.Adjust(&nodes[i], 0);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    start = std::chrono::steady_clock::now();
+    wheel.Tick();
+    double wheelTick = ElapsedMS(start);
+
+    assert(heapFired == N);
+    assert(wheelFired == N);
+    assert(wheel.Size() == 0 && wheel.GetNextTick() == -1);
+
+    //时间轮到期顺序与超时时间一致，跨层的定时器在下放后按时到期
+    int fired = 0;
+    TimingWheel order2(CountFired, &fired);
+    WheelNode shortNode, longNode;
+    order2.Add(&shortNode, 5);
+    order2.Add(&longNode, 300);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    order2.Tick();
+    assert(fired == 1 && !shortNode.IsLinked() && longNode.IsLinked());
+    assert(order2.GetNextTick() <= 300);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    order2.Tick();
+    assert(fired == 2 && order2.Size() == 0);
+
+    printf("Timer benchmark (%d timers, %d adjusts)\n", N, ADJUST);
+    printf("  HeapTimer  : add %8.2f ms, adjust %8.2f ms, expire %8.2f ms\n", heapAdd, heapAdjust, heapTick);
+    printf("  TimingWheel: add %8.2f ms, adjust %8.2f ms, expire %8.2f ms\n", wheelAdd, wheelAdjust, wheelTick);
+}
+
+
+//旧的正则解析实现：逐行拷贝成string，请求行和每个请求头各做一次regex_match
+static bool RegexParse(const std::string& req, std::string& method, std::string& path, std::string& version,
+                       std::unordered_map<std::string, std::string>& header){
+    const char END[] = "\r\n";
+    const char* p = req.data();
+    const char* end = req.data() + req.size();
+    bool requestLine = true;
+    while(p < end)
+    {
+        const char* lineEnd = std::search(p, end, END, END + 2);
+        std::string line(p, lineEnd);
+        if(requestLine)
+        {
+            std::regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+            std::smatch match;
+            if(!std::regex_match(line, match, pattern))
+            {
+                return false;
+            }
+            method = match[1];
+            path = match[2];
+            version = match[3];
+            requestLine = false;
+        }
+        else
+        {
+            std::regex pattern("^([^:]*): ?(.*)$");
+            std::smatch match;
+            if(!std::regex_match(line, match, pattern))
+            {
+                break;
+            }
+            header[match[1]] = match[2];
+        }
+        if(lineEnd == end)
+        {
+            break;
+        }
+        p = lineEnd + 2;
+    }
+    return true;
+}
+
+//SIMD扫描内核与标量实现逐字节对比：每个字节值放在向量内和尾部的各个位置
+void TestScan(){
+    typedef const char* (*ScanFunc)(const char*, const char*);
+    const ScanFunc funcs[] = { HttpScan::FindTokenEnd, HttpScan::FindTargetEnd, HttpScan::FindValueEnd };
+    const int LEN = 80;
+    char buf[LEN];
+    HttpScan::Level best = HttpScan::DetectLevel();
+    for(int f = 0; f < 3; f++)
+    {
+        for(int c = 0; c < 256; c++)
+        {
+            for(int pos = 0; pos < LEN; pos++)
+            {
+                memset(buf, 'a', LEN);
+                buf[pos] = static_cast<char>(c);
+                for(int shift = 0; shift < 2; shift++)    //再错开一个字节，覆盖非对齐的起点和尾部
+                {
+                    HttpScan::SetLevel(HttpScan::SCALAR);
+                    const char* expect = funcs[f](buf + shift, buf + LEN - shift);
+                    for(int level = HttpScan::SSE42; level <= best; level++)
+                    {
+                        HttpScan::SetLevel(static_cast<HttpScan::Level>(level));
+                        assert(funcs[f](buf + shift, buf + LEN - shift) == expect);
+                    }
+                }
+            }
+        }
+    }
+    HttpScan::SetLevel(best);
+    memset(buf, 'a', LEN);
+    buf[40] = ':';
+    assert(HttpScan::FindTokenEnd(buf, buf + LEN) == buf + 40);
+    buf[40] = '\t';
+    assert(HttpScan::FindValueEnd(buf, buf + LEN) == buf + LEN && HttpScan::FindTargetEnd(buf, buf + LEN) == buf + 40);
+    printf("Scan kernels verified, using %s\n", HttpScan::LevelName(HttpScan::GetLevel()));
+}
+
+//正则解析与HttpParser的吞吐对比，请求为带Cookie和长User-Agent的典型浏览器GET
+void TestParser(){
+    const std::string req =
+        "GET /images/logo.png?v=3 HTTP/1.1\r\n"
+        "Host: www.example.com:9006\r\n"
+        "Connection: keep-alive\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Referer: http://www.example.com:9006/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Cookie: _ga=GA1.1.1234567890.1700000000; session=9f8e7d6c5b4a39281706f5e4d3c2b1a0; theme=dark; lang=zh-CN\r\n"
+        "\r\n";
+    const int REGEX_N = 2000;     //正则实现太慢，迭代次数少一些，按每秒请求数比较
+    const int N = 200000;
+
+    HttpParser parser;
+    assert(parser.Parse(req.data(), req.data() + req.size()) == HttpParser::PARSE_OK);
+    assert(parser.Consumed() == req.size());
+    assert(parser.GetMethod() == HttpParser::METHOD_GET && parser.Path() == "/images/logo.png" && parser.Query() == "v=3");
+    assert(parser.Version() == "1.1" && parser.IsKeepAlive());
+    assert(parser.GetHeader(HttpParser::HEADER_HOST) == "www.example.com:9006");
+    assert(parser.GetHeader("accept-language") == "zh-CN,zh;q=0.9,en;q=0.8");
+    assert(parser.Headers().size() == 16);
+
+    //不完整和格式错误的请求
+    parser.Reset();
+    assert(parser.Parse(req.data(), req.data() + req.size() - 2) == HttpParser::PARSE_AGAIN);
+    const std::string bad = "GET /index.html HTTP/1.1\r\nHost : x\r\n\r\n";
+    parser.Reset();
+    assert(parser.Parse(bad.data(), bad.data() + bad.size()) == HttpParser::PARSE_ERROR);
+    const std::string post = "POST /login HTTP/1.0\r\nContent-Length: 9\r\n\r\nuser=abcdGET";
+    parser.Reset();
+    assert(parser.Parse(post.data(), post.data() + post.size()) == HttpParser::PARSE_OK);
+    assert(parser.Body() == "user=abcd" && parser.Consumed() == post.size() - 3 && !parser.IsKeepAlive());
+
+    //逐段写入一个很小的Buffer模拟多次读入：缓冲区会扩容移动，解析从上次的进度续接
+    for(size_t step : {1, 3, 7, 64})
+    {
+        const std::string full = req.substr(0, req.size() - 2) + "Content-Length: 11\r\n\r\nhello=world";
+        Buffer buff(16);
+        HttpParser resume;
+        HttpParser::Status status = HttpParser::PARSE_AGAIN;
+        for(size_t off = 0; off < full.size(); off += step)
+        {
+            assert(status == HttpParser::PARSE_AGAIN);
+            buff.Append(full.data() + off, std::min(step, full.size() - off));
+            status = resume.Parse(buff.Peek(), buff.BeginWritePtr());
+        }
+        assert(status == HttpParser::PARSE_OK && resume.Done() && resume.Consumed() == full.size());
+        assert(resume.Path() == "/images/logo.png" && resume.Body() == "hello=world" && resume.Headers().size() == 17);
+        assert(resume.GetHeader(HttpParser::HEADER_COOKIE).substr(0, 4) == "_ga=" && resume.GetHeader("Referer").back() == 'l');
+    }
+
+    std::string method, path, version;
+    std::unordered_map<std::string, std::string> header;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < REGEX_N; i++)
+    {
+        header.clear();
+        RegexParse(req, method, path, version, header);
+    }
+    double regexMS = ElapsedMS(start);
+    assert(header.size() == 16 && path == "/images/logo.png?v=3");
+
+    double mb = static_cast<double>(req.size()) / (1024 * 1024);
+    printf("Parser benchmark (%d-byte browser request)\n", (int)req.size());
+    printf("  regex             : %7d requests %9.2f ms, %10.0f req/s, %8.2f MB/s\n", REGEX_N, regexMS, REGEX_N / regexMS * 1000, mb * REGEX_N / regexMS * 1000);
+
+    //依次用CPU支持的各级扫描内核解析
+    HttpScan::Level best = HttpScan::DetectLevel();
+    for(int level = HttpScan::SCALAR; level <= best; level++)
+    {
+        HttpScan::SetLevel(static_cast<HttpScan::Level>(level));
+        size_t headers = 0;
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < N; i++)
+        {
+            parser.Reset();
+            parser.Parse(req.data(), req.data() + req.size());
+            headers += parser.Headers().size();
+        }
+        double parserMS = ElapsedMS(start);
+        assert(headers == static_cast<size_t>(N) * 16);
+        printf("  HttpParser %-7s: %7d requests %9.2f ms, %10.0f req/s, %8.2f MB/s\n", HttpScan::LevelName(HttpScan::GetLevel()),
+               N, parserMS, N / parserMS * 1000, mb * N / parserMS * 1000);
+    }
+    HttpScan::SetLevel(best);
+}
+
+
+void TestRange(){
+    struct Case {
+        const char* spec;
+        size_t size;
+        HttpResponse::RangeResult result;
+        size_t start, len;
+    };
+    const Case cases[] = {
+        { "bytes=0-499", 1000, HttpResponse::RANGE_OK, 0, 500 },
+        { "bytes=500-", 1000, HttpResponse::RANGE_OK, 500, 500 },
+        { "bytes=-200", 1000, HttpResponse::RANGE_OK, 800, 200 },
+        { "bytes=-5000", 1000, HttpResponse::RANGE_OK, 0, 1000 },
+        { "bytes=900-5000", 1000, HttpResponse::RANGE_OK, 900, 100 },
+        { " Bytes=10-19 ", 1000, HttpResponse::RANGE_OK, 10, 10 },
+        { "bytes=1000-", 1000, HttpResponse::RANGE_UNSATISFIABLE, 0, 0 },
+        { "bytes=-0", 1000, HttpResponse::RANGE_UNSATISFIABLE, 0, 0 },
+        { "bytes=0-", 0, HttpResponse::RANGE_UNSATISFIABLE, 0, 0 },
+        { "bytes=5-1", 1000, HttpResponse::RANGE_NONE, 0, 0 },
+        { "bytes=0-1,5-9", 1000, HttpResponse::RANGE_NONE, 0, 0 },
+        { "items=0-1", 1000, HttpResponse::RANGE_NONE, 0, 0 },
+        { "bytes=a-1", 1000, HttpResponse::RANGE_NONE, 0, 0 },
+        { "bytes=99999999999999999999999-", 1000, HttpResponse::RANGE_NONE, 0, 0 },
+    };
+    for(const Case& c : cases)
+    {
+        size_t start = 0, len = 0;
+        HttpResponse::RangeResult result = HttpResponse::ParseRange(c.spec, c.size, &start, &len);
+        assert(result == c.result);
+        assert(result != HttpResponse::RANGE_OK || (start == c.start && len == c.len));
+    }
+    assert(HttpResponse::HttpDate(0) == "Thu, 01 Jan 1970 00:00:00 GMT");
+    printf("Range parsing verified\n");
+}
+
+void TestConditional(){
+    struct stat st = {};
+    st.st_ino = 0x1234;
+    st.st_size = 4096;
+    st.st_mtim.tv_sec = 1700000000;
+    const std::string etag = HttpResponse::ETag(st);
+    const std::string date = HttpResponse::HttpDate(st.st_mtim.tv_sec);
+    time_t t = 0;
+    assert(HttpRequest::ParseHttpDate(date, &t) && t == st.st_mtim.tv_sec);
+    assert(!HttpRequest::ParseHttpDate("Tuesday, 14-Nov-23 22:13:20 GMT", &t));
+
+    assert(HttpRequest::MatchETag(etag, etag));
+    assert(HttpRequest::MatchETag("\"x\", W/" + etag, etag));
+    assert(HttpRequest::MatchETag(" * ", etag));
+    assert(!HttpRequest::MatchETag("\"x\", \"y\"", etag));
+
+    struct Case {
+        std::string headers;
+        bool conditional, notModified;
+    };
+    const Case cases[] = {
+        { "", false, false },
+        { "If-None-Match: " + etag + "\r\n", true, true },
+        { "If-None-Match: \"other\"\r\nIf-Modified-Since: " + date + "\r\n", true, false },   //If-None-Match优先
+        { "If-Modified-Since: " + date + "\r\n", true, true },
+        { "If-Modified-Since: " + HttpResponse::HttpDate(st.st_mtim.tv_sec - 1) + "\r\n", true, false },
+        { "If-Modified-Since: yesterday\r\n", true, false },
+    };
+    for(const Case& c : cases)
+    {
+        Buffer buff;
+        buff.Append("GET /index.html HTTP/1.1\r\nHost: x\r\n" + c.headers + "\r\n");
+        HttpRequest request;
+        assert(request.parse(buff) == HttpParser::PARSE_OK);
+        assert(request.IsConditional() == c.conditional);
+        assert(request.IsNotModified(etag, st.st_mtim.tv_sec) == c.notModified);
+    }
+    printf("Conditional requests verified\n");
+}
+
+void TestAcceptEncoding(){
+    struct Case {
+        const char* header;
+        bool gzip, br;
+    };
+    const Case cases[] = {
+        { "", false, false },
+        { "gzip, deflate, br", true, true },
+        { "GZIP;q=0.5", true, false },
+        { "br;q=0, gzip;q=0.8", true, false },
+        { "*", true, true },
+        { "*;q=0.1, gzip;q=0.000", false, true },
+        { "identity", false, false },
+        { "xgzip, brx", false, false },
+    };
+    for(const Case& c : cases)
+    {
+        Buffer buff;
+        buff.Append(std::string("GET / HTTP/1.1\r\nAccept-Encoding: ") + c.header + "\r\n\r\n");
+        HttpRequest request;
+        assert(request.parse(buff) == HttpParser::PARSE_OK);
+        assert(request.AcceptsEncoding("gzip") == c.gzip && request.AcceptsEncoding("br") == c.br);
+    }
+    printf("Accept-Encoding negotiation verified\n");
+}
+
+// 按Process的方式生成一个响应，返回响应头和文件内容；cache为true时先查整包缓存，生成后放回
+static std::string Respond(const std::string& dir, const std::string& path, const std::string& headers, bool cache = false){
+    Buffer buff;
+    buff.Append("GET " + path + " HTTP/1.1\r\nHost: x\r\n" + headers + "\r\n");
+    HttpRequest request;
+    assert(request.parse(buff) == HttpParser::PARSE_OK);
+    HttpResponse response;
+    response.Init(dir, request.path(), true, 200);
+    response.SetRequest(&request);
+    ResponseRef cached = cache ? response.CachedResponse() : nullptr;
+    if(cached) {
+        return *cached;
+    }
+    Buffer out;
+    response.MakeResponse(out);
+    if(cache) {
+        response.CacheResponse(out, 0, out.ReadableBytes());
+    }
+    std::string resp = out.RetrieveAllToStr();
+    if(response.File()) {
+        resp.append(response.File(), response.FileLen());
+    }
+    return resp;
+}
+
+// 预压缩文件只在原文件可读且预压缩文件不比原文件旧时发送
+void TestPrecompressed(){
+    const std::string dir = "/tmp/webserver_sidecar_test";
+    const std::string page = dir + "//a.html";
+    system(("rm -rf " + dir + " && mkdir -p " + dir).c_str());
+    FILE* fp = fopen(page.c_str(), "w");
+    fputs("<plain>", fp);
+    fclose(fp);
+    fp = fopen((page + ".gz").c_str(), "w");
+    fputs("<gzip>", fp);
+    fclose(fp);
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { 1000000000, 0 } };
+    assert(utimensat(AT_FDCWD, page.c_str(), times, 0) == 0);   //原文件比预压缩文件旧
+    FileCache::Instance()->Clear();
+    const std::string gzip = "Accept-Encoding: gzip\r\n";
+
+    std::string resp = Respond(dir + "/", "/a.html", gzip);
+    assert(resp.find("Content-Encoding: gzip\r\n") != std::string::npos && resp.find("<gzip>") != std::string::npos);
+    resp = Respond(dir + "/", "/a.html", "");
+    assert(resp.find("Content-Encoding") == std::string::npos && resp.find("<plain>") != std::string::npos);
+
+    // 预压缩文件的响应不进整包缓存，原文件的照常缓存
+    ResponseCache* cache = ResponseCache::Instance();
+    cache->Init(1 << 20, 1 << 16, 60000);
+    assert(Respond(dir + "/", "/a.html", gzip, true).find("<gzip>") != std::string::npos && cache->Count() == 0);
+    assert(Respond(dir + "/", "/a.html", "", true).find("<plain>") != std::string::npos && cache->Count() == 1);
+    uint64_t hits = cache->Hits();
+    assert(Respond(dir + "/", "/a.html", "", true).find("<plain>") != std::string::npos && cache->Hits() == hits + 1);
+    cache->Clear();
+    cache->Init(0, 0);
+
+    // 原文件修改后没有重新生成预压缩文件：发送原文件
+    times[1].tv_sec = 2000000000;
+    assert(utimensat(AT_FDCWD, page.c_str(), times, 0) == 0);
+    FileCache::Instance()->Invalidate(page);
+    resp = Respond(dir + "/", "/a.html", gzip);
+    assert(resp.find("Content-Encoding") == std::string::npos && resp.find("<plain>") != std::string::npos);
+
+    // 原文件不可读或已删除：按原文件返回403/404，不发送预压缩文件
+    utimensat(AT_FDCWD, (page + ".gz").c_str(), times, 0);
+    chmod(page.c_str(), 0600);
+    FileCache::Instance()->Invalidate(page);
+    assert(Respond(dir + "/", "/a.html", gzip).compare(0, 22, "HTTP/1.1 403 Forbidden") == 0);
+    unlink(page.c_str());
+    FileCache::Instance()->Invalidate(page);
+    assert(Respond(dir + "/", "/a.html", gzip).compare(0, 22, "HTTP/1.1 404 Not Found") == 0);
+
+    FileCache::Instance()->Clear();
+    system(("rm -rf " + dir).c_str());
+    printf("Precompressed sidecars verified\n");
+}
+
+template<typename Pred>
+static bool Eventually(Pred pred, int timeoutMS){
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
+    while(!pred())
+    {
+        if(std::chrono::steady_clock::now() > deadline)
+        {
+            return false;
+        }
+        usleep(5 * 1000);
+    }
+    return true;
+}
+
+// 复查间隔和整包缓存的有效期都设得很长：文件的变化只能经由inotify失效才能被看到
+void TestResourceWatcher(){
+    const std::string dir = "/tmp/webserver_watch_test";
+    const std::string root = dir + "/";
+    system(("rm -rf " + dir + " && mkdir -p " + dir + "/css").c_str());
+    auto write = [&dir](const std::string& name, const char* content) {
+        FILE* fp = fopen((dir + "/" + name).c_str(), "w");
+        fputs(content, fp);
+        fclose(fp);
+    };
+    write("a.html", "<v1>");
+    write("css/s.css", "s1");
+    write("b.html", "<b>");
+    write("b.html.gz", "<gz1>");
+    FileCache* files = FileCache::Instance();
+    ResponseCache* responses = ResponseCache::Instance();
+    files->Clear();
+    files->Init(64 * 1024 * 1024, 1024, 60000);
+    responses->Init(1 << 20, 1 << 16, 60000);
+    auto content = [files](const std::string& path) {
+        int err = 0;
+        FileRef file = files->Get(path, &err);
+        return file ? std::string(file->data ? file->data : "", file->Size()) : std::string("ENOENT");
+    };
+    const std::string gzip = "Accept-Encoding: gzip\r\n";
+    assert(content(root + "/a.html") == "<v1>" && content(root + "/css/s.css") == "s1");
+    assert(Respond(root, "/a.html", "", true).find("<v1>") != std::string::npos && responses->Count() == 1);
+    assert(Respond(root, "/b.html", gzip).find("<gz1>") != std::string::npos);
+
+    ResourceWatcher watcher(root);
+    assert(watcher.Start());
+    uint64_t fileInv = files->Invalidations(), respInv = responses->Invalidations();
+
+    // 原地改写
+    write("a.html", "<v2>");
+    assert(Eventually([&]() { return content(root + "/a.html") == "<v2>"; }, 2000));
+    assert(Eventually([&]() { return Respond(root, "/a.html", "", true).find("<v2>") != std::string::npos; }, 2000));
+    assert(files->Invalidations() > fileInv && responses->Invalidations() > respInv);
+
+    // 子目录中的文件被rename替换
+    write("css/s.css.tmp", "s2");
+    assert(rename((dir + "/css/s.css.tmp").c_str(), (dir + "/css/s.css").c_str()) == 0);
+    assert(Eventually([&]() { return content(root + "/css/s.css") == "s2"; }, 2000));
+
+    // 重新生成的预压缩文件
+    write("b.html.gz.tmp", "<gz2>");
+    assert(rename((dir + "/b.html.gz.tmp").c_str(), (dir + "/b.html.gz").c_str()) == 0);
+    assert(Eventually([&]() { return Respond(root, "/b.html", gzip).find("<gz2>") != std::string::npos; }, 2000));
+
+    // 删除
+    unlink((dir + "/a.html").c_str());
+    assert(Eventually([&]() { return content(root + "/a.html") == "ENOENT"; }, 2000));
+    assert(Eventually([&]() { return Respond(root, "/a.html", "", true).compare(0, 22, "HTTP/1.1 404 Not Found") == 0; }, 2000));
+
+    watcher.Stop();
+    assert(watcher.Events() > 0);
+    files->Clear();
+    files->Init(64 * 1024 * 1024, 1024, 1000);
+    responses->Clear();
+    responses->Init(0, 0);
+    system(("rm -rf " + dir).c_str());
+    printf("Resource watcher verified (%llu events)\n", (unsigned long long)watcher.Events());
+}
+
+void TestResponseCache(){
+    ResponseCache* cache = ResponseCache::Instance();
+    cache->Init(1024, 400, 50);
+    auto make = [](char ch, size_t n) { return std::make_shared<const std::string>(n, ch); };
+    cache->Put("a", make('a', 300), cache->Epoch());
+    cache->Put("b", make('b', 300), cache->Epoch());
+    cache->Put("big", make('x', 500), cache->Epoch());   //超过单个响应上限，不缓存
+    assert(cache->Count() == 2 && !cache->Get("big"));
+    assert(cache->Get("a") && (*cache->Get("a"))[0] == 'a');
+    cache->Put("c", make('c', 300), cache->Epoch());
+    cache->Put("d", make('d', 300), cache->Epoch());     //超出总容量，淘汰最久未使用的b
+    assert(!cache->Get("b") && cache->Get("a") && cache->Get("c") && cache->Get("d"));
+    assert(cache->Bytes() <= 1024);
+    usleep(60 * 1000);
+    assert(!cache->Get("a") && cache->Count() == 2);   //过期的条目在访问时删除
+    uint64_t epoch = cache->Epoch();
+    cache->Clear();
+    cache->Put("e", make('e', 300), epoch);   //生成期间有过Clear，不缓存
+    assert(!cache->Get("e") && cache->Count() == 0);
+    cache->Clear();
+    cache->Init(0, 0);
+    printf("Response cache verified\n");
+}
+
+// 读出socket中已到达的全部数据
+static std::string DrainSocket(int fd){
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    {
+        data.append(buf, n);
+    }
+    return data;
+}
+
+static int CountOf(const std::string& s, const std::string& sub){
+    int cnt = 0;
+    for(size_t pos = s.find(sub); pos != std::string::npos; pos = s.find(sub, pos + sub.size()))
+    {
+        cnt++;
+    }
+    return cnt;
+}
+
+// 流水线：一次Process处理读缓冲区中所有完整的请求，响应按请求顺序排成一批，一次Write发出
+void TestPipeline(){
+    const std::string dir = "/tmp/webserver_pipeline_test";
+    system(("rm -rf " + dir + " && mkdir -p " + dir).c_str());
+    const char* names[] = { "a", "b", "c" };
+    for(const char* name : names)
+    {
+        FILE* fp = fopen((dir + "/" + name + ".html").c_str(), "w");
+        fprintf(fp, "<%s>", name);
+        fclose(fp);
+    }
+    HttpConn::SrcDir = dir.c_str();
+    auto req = [](const char* name) { return std::string("GET /") + name + ".html HTTP/1.1\r\nHost: x\r\nConnection: keep-alive\r\n\r\n"; };
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    sockaddr_in addr = {};
+    HttpConn conn;
+    conn.Init(sv[0], addr);
+    int err = 0;
+
+    std::string data = req("a") + req("b") + req("c");
+    conn.Feed(data.data(), data.size());
+    assert(conn.Process() && conn.WriteIovCnt() >= 3);
+    assert(conn.Write(&err) > 0 && conn.ToWriteBytes() == 0 && conn.IsIdle());
+    std::string resp = DrainSocket(sv[1]);
+    size_t a = resp.find("<a>"), b = resp.find("<b>"), c = resp.find("<c>");
+    assert(CountOf(resp, "HTTP/1.1 200 OK") == 3 && a < b && b < c && c != std::string::npos);
+
+    // 末尾不完整的请求留在读缓冲区，收到剩余部分后再处理
+    data = req("a") + req("b");
+    size_t cut = data.size() - 10;
+    conn.Feed(data.data(), cut);
+    assert(conn.Process() && conn.Write(&err) > 0 && !conn.IsIdle());
+    resp = DrainSocket(sv[1]);
+    assert(CountOf(resp, "HTTP/1.1 200 OK") == 1 && resp.find("<a>") != std::string::npos);
+    assert(!conn.Process());
+    conn.Feed(data.data() + cut, data.size() - cut);
+    assert(conn.Process() && conn.Write(&err) > 0 && conn.IsIdle());
+    resp = DrainSocket(sv[1]);
+    assert(CountOf(resp, "HTTP/1.1 200 OK") == 1 && resp.find("<b>") != std::string::npos);
+
+    // 一次最多处理MAX_PIPELINE个请求，其余的在下一批
+    const int N = HttpConn::MAX_PIPELINE + 4;
+    data.clear();
+    for(int i = 0; i < N; i++)
+    {
+        data += req(names[i % 3]);
+    }
+    conn.Feed(data.data(), data.size());
+    assert(conn.Process() && conn.Write(&err) > 0 && !conn.IsIdle());
+    assert(CountOf(DrainSocket(sv[1]), "HTTP/1.1 200 OK") == HttpConn::MAX_PIPELINE);
+    assert(conn.Process() && conn.Write(&err) > 0 && conn.IsIdle());
+    assert(CountOf(DrainSocket(sv[1]), "HTTP/1.1 200 OK") == N - HttpConn::MAX_PIPELINE);
+    assert(!conn.Process());
+
+    conn.Close();
+    close(sv[1]);
+    system(("rm -rf " + dir).c_str());
+    printf("Pipelined requests verified\n");
+}
+
+static void WriteFile(const std::string& path, char ch, size_t n){
+    FILE* fp = fopen(path.c_str(), "w");
+    fputs(std::string(n, ch).c_str(), fp);
+    fclose(fp);
+}
+
+// 按条目数和字节数淘汰最久未使用的文件；被淘汰或替换的文件在最后一个引用释放前仍然可读
+void TestFileCache(){
+    const std::string dir = "/tmp/webserver_filecache_test";
+    system(("rm -rf " + dir + " && mkdir -p " + dir).c_str());
+    const std::string a = dir + "/a", b = dir + "/b", c = dir + "/c", big = dir + "/big";
+    WriteFile(a, 'a', 100);
+    WriteFile(b, 'b', 100);
+    WriteFile(c, 'c', 100);
+    WriteFile(big, 'x', 300);
+    FileCache* cache = FileCache::Instance();
+    cache->Clear();
+    cache->Init(250, 2, 50);
+    int err = 0;
+    uint64_t misses = cache->Misses();
+
+    FileRef fa = cache->Get(a, &err), fb = cache->Get(b, &err);
+    assert(fa && fb && cache->Count() == 2 && cache->Bytes() == 200 && cache->Misses() == misses + 2);
+    usleep(60 * 1000);
+    assert(cache->Get(a, &err) == fa && cache->Misses() == misses + 2);   //到了复查时间，文件未变，继续使用
+    std::weak_ptr<const CachedFile> wb = fb;
+    assert(cache->Get(c, &err) && cache->Count() == 2);   //超过条目上限，淘汰最久未使用的b
+    assert(fb->data[0] == 'b' && fb->data[99] == 'b');   //被淘汰的文件仍被引用，映射有效
+    fb.reset();
+    assert(wb.expired());   //最后一个引用释放
+    assert(cache->Get(big, &err) && cache->Count() == 2 && cache->Bytes() == 200);   //超过字节上限的文件不缓存
+    cache->Init(150, 2, 50);
+    assert(cache->Count() == 1 && cache->Bytes() == 100);
+
+    // 文件被替换：复查时发现inode变化，重新加载，旧映射仍属于持有它的响应
+    WriteFile(dir + "/a.tmp", 'A', 120);
+    assert(rename((dir + "/a.tmp").c_str(), a.c_str()) == 0);
+    usleep(60 * 1000);
+    FileRef fa2 = cache->Get(a, &err);
+    assert(fa2 && fa2 != fa && fa2->Size() == 120 && fa2->data[0] == 'A');
+    assert(fa->Size() == 100 && fa->data[0] == 'a' && fa->data[99] == 'a');
+
+    // Invalidate立即生效，不等复查时间
+    FileRef fc = cache->Get(c, &err);
+    cache->Invalidate(c);
+    FileRef fc2 = cache->Get(c, &err);
+    assert(fc2 && fc2 != fc && fc->data[0] == 'c');
+    assert(!cache->Get(dir + "/missing", &err) && err == ENOENT);
+
+    cache->Clear();
+    cache->Init(64 * 1024 * 1024, 1024, 1000);
+    system(("rm -rf " + dir).c_str());
+    printf("File cache verified\n");
+}
+
+// 不小于SendfileMin的文件用sendfile发送，响应头带MSG_MORE先发；更小的文件从映射writev
+// 发送前把文件截断：sendfile读到文件末尾返回0（EIO），writev访问映射中已不存在的页得到EFAULT，两条路径由此区分
+void TestSendfile(){
+    const std::string dir = "/tmp/webserver_sendfile_test";
+    system(("rm -rf " + dir + " && mkdir -p " + dir).c_str());
+    const size_t BIG = 1024 * 1024, SMALL = 32 * 1024;
+    std::string content(BIG, '\0');
+    for(size_t i = 0; i < BIG; i++)
+    {
+        content[i] = static_cast<char>('a' + i % 26);
+    }
+    FILE* fp = fopen((dir + "/big.bin").c_str(), "w");
+    fwrite(content.data(), 1, BIG, fp);
+    fclose(fp);
+    HttpConn::SrcDir = dir.c_str();
+    HttpConn::SendfileMin = 64 * 1024;
+    ResponseCache::Instance()->Init(0, 0);
+    auto req = [](const char* name) { return std::string("GET /") + name + " HTTP/1.1\r\nHost: x\r\nConnection: keep-alive\r\n\r\n"; };
+    sockaddr_in addr = {};
+    int err = 0;
+    int sv[2];
+
+    // 大文件完整发出，内容与文件一致
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    HttpConn conn;
+    conn.Init(sv[0], addr);
+    std::string data = req("big.bin");
+    conn.Feed(data.data(), data.size());
+    assert(conn.Process());
+    size_t total = conn.ToWriteBytes();
+    std::string resp;
+    std::thread reader([&resp, &sv, total]() {
+        char buf[65536];
+        ssize_t n;
+        while(resp.size() < total && (n = recv(sv[1], buf, sizeof(buf), 0)) > 0)
+        {
+            resp.append(buf, n);
+        }
+    });
+    assert(conn.Write(&err) > 0 && conn.ToWriteBytes() == 0);
+    reader.join();
+    assert(resp.size() == total && resp.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    assert(resp.compare(total - BIG, BIG, content) == 0);
+    conn.Close();
+    close(sv[1]);
+
+    // 超过阈值时响应头先单独发出，sendfile在截断处返回0；低于阈值时整批writev访问到失效的映射
+    auto truncated = [&](size_t size, int expectErr) {
+        const std::string path = dir + "/t.bin";
+        FILE* fp = fopen(path.c_str(), "w");
+        fwrite(content.data(), 1, size, fp);
+        fclose(fp);
+        FileCache::Instance()->Invalidate(path);
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        HttpConn conn;
+        conn.Init(sv[0], addr);
+        std::string data = req("t.bin");
+        conn.Feed(data.data(), data.size());
+        assert(conn.Process());
+        assert(truncate(path.c_str(), 0) == 0);
+        int err = 0;
+        assert(conn.Write(&err) < 0 && err == expectErr);
+        std::string head = DrainSocket(sv[1]);
+        if(expectErr == EIO) {
+            assert(conn.ToWriteBytes() == size && head.compare(0, 15, "HTTP/1.1 200 OK") == 0);   //响应头已单独发出
+        }
+        else {
+            assert(head.empty());   //响应头和文件在同一次writev中，一起失败
+        }
+        conn.Close();
+        close(sv[1]);
+    };
+    truncated(BIG, EIO);
+    truncated(SMALL, EFAULT);
+
+    HttpConn::SendfileMin = 0;
+    FileCache::Instance()->Clear();
+    system(("rm -rf " + dir).c_str());
+    printf("Sendfile path verified\n");
+}
+
+void TestResourcePack(){
+    const std::string dir = "/tmp/webserver_pack_test";
+    system(("rm -rf " + dir + " && mkdir -p " + dir + "/css").c_str());
+    FILE* fp = fopen((dir + "/index.html").c_str(), "w");
+    fputs("<html>hello</html>", fp);
+    fclose(fp);
+    fp = fopen((dir + "/css/style.css").c_str(), "w");
+    fclose(fp);
+    assert(ResourcePack::Build(dir + "/", dir + ".pack"));
+    std::shared_ptr<ResourcePack> pack = ResourcePack::Load(dir + ".pack", true);
+    assert(pack && pack->Count() == 2);
+
+    FileRef file = pack->Find("/index.html");
+    assert(file && file->Size() == 18 && memcmp(file->data, "<html>hello</html>", 18) == 0);
+    char head[7] = {};
+    assert(file->base % ResourcePack::PAGE == 0 && pread(file->fd, head, 6, file->base) == 6 && strcmp(head, "<html>") == 0);
+    assert(pack->Find("/css/style.css") && pack->Find("/css/style.css")->Size() == 0);
+    assert(!pack->Find("/css") && !pack->Find("index.html") && !pack->Find("/nope.html"));
+
+    // 通过FileCache访问：包内路径不再访问文件系统
+    FileCache::Instance()->SetPack(dir + "/", pack);
+    int err = 0;
+    assert(FileCache::Instance()->Get(dir + "//index.html", &err) == file);
+    system(("rm -rf " + dir).c_str());
+    assert(FileCache::Instance()->Get(dir + "//index.html", &err) == file);
+    assert(!FileCache::Instance()->Get(dir + "//missing.html", &err) && err == ENOENT);
+    FileCache::Instance()->SetPack("", nullptr);
+    unlink((dir + ".pack").c_str());
+    printf("Resource pack verified\n");
+}
+
+void TestDeferredVerify(){
+    const std::string body = "username=al%27ice&password=p+w";
+    Buffer buff;
+    buff.Append("POST /login.html HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " +
+                std::to_string(body.size()) + "\r\n\r\n" + body + "GET / HTTP/1.1\r\n\r\n");
+    HttpRequest request;
+    // 解析时不查询数据库，只记录待校验的表单
+    assert(request.parse(buff) == HttpParser::PARSE_OK);
+    assert(request.NeedsVerify() && request.IsLogin() && request.path() == "/login.html");
+    assert(request.GetPost("username") == "al'ice" && request.GetPost("password") == "p w");
+    request.SetVerified(true);
+    assert(!request.NeedsVerify() && request.path() == "/welcome.html");
+    assert(request.parse(buff) == HttpParser::PARSE_OK && !request.NeedsVerify() && request.path() == "/index.html");
+
+    SqlNotifier notifier;
+    assert(notifier.Init());
+    std::thread producer([&notifier]() {
+        for(uint64_t i = 0; i < 100; i++) {
+            notifier.Push(i, i % 2 == 0);
+        }
+    });
+    std::vector<SqlResult> results;
+    uint64_t expect = 0;
+    while(expect < 100) {
+        struct pollfd pfd = { notifier.Fd(), POLLIN, 0 };
+        assert(poll(&pfd, 1, 1000) == 1);
+        notifier.Pop(results);
+        for(const SqlResult& result : results) {
+            assert(result.key == expect && result.ok == (expect % 2 == 0));
+            expect++;
+        }
+    }
+    producer.join();
+    notifier.Pop(results);
+    assert(results.empty());
+    printf("Deferred verification verified\n");
+}
+
+void TestUserCache(){
+    UserCache* cache = UserCache::Instance();
+    cache->Init(UserCache::SHARDS * 1024, 50);
+    bool ok = true;
+    assert(!cache->Lookup("alice", "pw", true, &ok));   //未缓存，需要查询数据库
+    cache->Put("alice", "pw", 2);
+    assert(cache->Lookup("alice", "pw", true, &ok) && ok);
+    assert(cache->Lookup("alice", "bad", true, &ok) && !ok);
+    assert(cache->Lookup("alice", "pw", false, &ok) && !ok);   //注册：已存在
+    assert(cache->Hits() == 3 && cache->Misses() == 1);
+    cache->Erase("alice");
+    assert(!cache->Lookup("alice", "pw", true, &ok));
+    cache->Put("alice", "pw", 2);
+    usleep(60 * 1000);
+    assert(!cache->Lookup("alice", "pw", true, &ok) && cache->Count() == 0);   //过期的条目在访问时删除
+
+    // 每片容量有限，写入远超容量的条目后按LRU淘汰
+    for(int i = 0; i < 1000; i++) {
+        std::string name = "user" + std::to_string(i);
+        cache->Put(name, name.data(), name.size());
+    }
+    assert(cache->Bytes() <= UserCache::SHARDS * 1024 && cache->Count() > 0 && cache->Count() < 1000);
+
+    // Bloom过滤器：未加载时都可能存在；加载后已有用户名一定判为可能存在，注册成功的新用户随之加入
+    assert(cache->MayExist("nobody"));
+    std::vector<std::string> names;
+    for(int i = 0; i < 10000; i++) {
+        names.push_back("user" + std::to_string(i));
+    }
+    cache->SetNames(names);
+    for(const std::string& name : names) {
+        assert(cache->MayExist(name));
+    }
+    int skipped = 0;
+    for(int i = 0; i < 10000; i++) {
+        skipped += !cache->MayExist("new" + std::to_string(i));
+    }
+    assert(skipped > 9900 && cache->BloomSkips() == static_cast<uint64_t>(skipped));
+    cache->Put("carol", "pw", 2);
+    assert(cache->MayExist("carol"));
+    cache->Clear();
+    cache->Init(0, 0);
+    printf("User cache verified\n");
+}
+
+void TestBuffer(){
+    Buffer buff;
+    std::string data;
+    for(int i = 0; i < 20000; i++) {
+        data += static_cast<char>('a' + i % 26);
+    }
+    // 追加跨越多个块，已写入的数据不移动
+    buff.Append("x", 1);
+    const char* first = buff.Peek();
+    buff.Append(data.substr(0, 10000));
+    std::vector<struct iovec> iov;
+    buff.Slices(0, 1, iov);
+    assert(iov.size() == 1 && iov[0].iov_base == first);
+    iov.clear();
+    buff.Slices(0, buff.ReadableBytes(), iov);
+    assert(iov.size() > 1);
+    std::string copy;
+    buff.CopyTo(1, 10000, copy);
+    assert(copy == data.substr(0, 10000));
+
+    // Peek在数据跨块时合并为连续的一段
+    assert(buff.ReadableBytes() == 10001 && std::string(buff.Peek() + 1, 10000) == copy);
+    buff.Retrieve(1);
+    const char* view = buff.Peek();
+    buff.Retrieve(5000);
+    assert(view[0] == 'a' && buff.ReadableBytes() == 5000);   //取走之后、写入之前视图仍有效
+    assert(buff.RetrieveAllToStr() == data.substr(5000, 5000) && buff.ReadableBytes() == 0);
+
+    // 用完的块还回本线程的空闲链表
+    buff.Append("abc", 3);
+    buff.Release();
+    size_t pooled = Buffer::PooledBlocks();
+    assert(pooled > 0);
+    {
+        Buffer other;
+        other.Append(data.substr(0, 3000));
+        assert(Buffer::PooledBlocks() == pooled - 1);
+    }
+    assert(Buffer::PooledBlocks() == pooled);
+
+    // WriteFd一次writev发出各块，ReadFd读进多个块，经过管道往返后数据不变
+    int fds[2];
+    assert(pipe(fds) == 0);
+    int err = 0;
+    buff.Append(data);
+    assert(buff.WriteFd(fds[1], &err) == static_cast<ssize_t>(data.size()) && buff.ReadableBytes() == 0);
+    Buffer input;
+    while(input.ReadableBytes() < data.size()) {
+        assert(input.ReadFd(fds[0], &err) > 0);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    assert(input.RetrieveAllToStr() == data);
+    printf("Buffer verified\n");
+}
+
+// 进程当前的常驻内存（字节）
+static long RssBytes(){
+    long pages = 0, rss = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(!fp || fscanf(fp, "%ld %ld", &pages, &rss) != 2) {
+        rss = 0;
+    }
+    if(fp) {
+        fclose(fp);
+    }
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+void TestIdleMemory(){
+    const std::string dir = "/tmp/webserver_idle_test";
+    system(("rm -rf " + dir + " && mkdir -p " + dir).c_str());
+    FILE* fp = fopen((dir + "/index.html").c_str(), "w");
+    fputs(std::string(3000, 'x').c_str(), fp);
+    fclose(fp);
+    HttpConn::SrcDir = dir.c_str();
+    const std::string req =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: www.example.com:9006\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (Linux; Android 14; Pixel 8) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Mobile Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Cookie: session=9f8e7d6c5b4a39281706f5e4d3c2b1a0; theme=dark\r\n"
+        "\r\n";
+
+    // 每个连接占一个fd，按文件描述符上限决定连接数
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+    const int N = static_cast<int>(std::min<rlim_t>(10000, (rl.rlim_cur - 64) / 2));
+    int devnull = open("/dev/null", O_WRONLY);
+    assert(devnull >= 0 && N > 0);
+    sockaddr_in addr = {};
+
+    // 空闲：处理完一个请求、响应发完后，连接只剩常驻部分
+    HttpConn* idle = new HttpConn[N];
+    long before = RssBytes();
+    for(int i = 0; i < N; i++) {
+        idle[i].Init(dup(devnull), addr);
+        idle[i].Feed(req.data(), req.size());
+        assert(idle[i].Process() && idle[i].ToWriteBytes() > 3000);
+        idle[i].HasSent(idle[i].ToWriteBytes());
+        assert(idle[i].IsIdle());
+    }
+    long idleBytes = (RssBytes() - before) / N;
+    assert(HttpConn::PooledExchanges() == 1);
+
+    // 对照：响应都还没发出，每个连接都持有请求/响应状态和缓冲区
+    HttpConn* busy = new HttpConn[N];
+    before = RssBytes();
+    for(int i = 0; i < N; i++) {
+        busy[i].Init(dup(devnull), addr);
+        busy[i].Feed(req.data(), req.size());
+        assert(busy[i].Process() && !busy[i].IsIdle());
+    }
+    long busyBytes = (RssBytes() - before) / N;
+    for(int i = 0; i < N; i++) {
+        busy[i].HasSent(busy[i].ToWriteBytes());
+        assert(busy[i].IsIdle());
+    }
+    assert(HttpConn::PooledExchanges() == HttpConn::POOL_MAX_EXCHANGES);
+
+    printf("Idle connection memory (%d connections)\n", N);
+    printf("  resident core     : %6d bytes/conn\n", (int)sizeof(HttpConn));
+    printf("  idle keep-alive   : %6ld bytes/conn RSS\n", idleBytes);
+    printf("  request in flight : %6ld bytes/conn RSS\n", busyBytes);
+    delete[] busy;
+    delete[] idle;
+    close(devnull);
+    system(("rm -rf " + dir).c_str());
+}
+
+void TestArena(){
+    Arena arena(256);
+    assert(arena.Reserved() == 0 && arena.Used() == 0);   //第一次分配时才申请块
+    std::string_view a = arena.Copy("hello");
+    char* b = arena.Allocate(40);
+    assert(a == "hello" && b == a.data() + 5 && arena.Reserved() == 256);
+    void* aligned = arena.AllocateAligned(8, 16);
+    assert(reinterpret_cast<uintptr_t>(aligned) % 16 == 0);
+    for(int i = 0; i < 20; i++) {
+        arena.Allocate(60);   //超出第一块，接到链上的下一块
+    }
+    size_t reserved = arena.Reserved();
+    assert(reserved > 256 && arena.Used() >= 45 + 8 + 20 * 60);
+    char* large = arena.Allocate(1000);   //大于块的四分之一，单独分配
+    memset(large, 'x', 1000);
+    assert(arena.Reserved() == reserved + 1000);
+    arena.Reset();
+    assert(arena.Used() == 0 && arena.Reserved() == reserved);   //标准块保留，大块释放
+    assert(arena.Copy("again").data() == a.data());   //从第一块的开头重新分配
+    for(int i = 0; i < 20; i++) {
+        arena.Allocate(60);
+    }
+    assert(arena.Reserved() == reserved);   //复用链上已有的块
+
+    // 表单字段解码到请求的arena中，连接复用时不再分配
+    const std::string body = "username=bo%62&password=a+b%3D&flag&=skip&username=carol";
+    const std::string post = "POST /register HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " +
+                             std::to_string(body.size()) + "\r\n\r\n" + body;
+    HttpRequest request;
+    Buffer buff;
+    for(int i = 0; i < 3; i++) {
+        buff.Append(post);
+        assert(request.parse(buff) == HttpParser::PARSE_OK && request.NeedsVerify() && !request.IsLogin());
+        assert(request.path() == "/register.html");
+        assert(request.GetPost("username") == "carol" && request.GetPost("password") == "a b=");   //同名字段后者为准
+        assert(request.PostView("flag").empty() && request.GetPost(std::string("nothing")) == "");
+        request.SetVerified(false);
+        assert(request.path() == "/error.html");
+    }
+    printf("Arena verified\n");
+}
+
+// 服务器里典型的一行日志，分别用1个和4个线程写，统计调用方看到的吞吐量
+void TestLogBenchmark(){
+    const int N = 400000;
+    system("rm -rf ./testlog3");
+    Log::Instance()->init(1, "./testlog3", ".log", 1024);
+    printf("Log benchmark (async, %d lines)\n", N);
+    for(int threads : { 1, 4 }) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for(int t = 0; t < threads; t++) {
+            workers.emplace_back([t, threads, N]() {
+                for(int i = t; i < N; i += threads) {
+                    LOG_INFO("Client[%d](%s:%d) in, userCount:%d", i & 0xffff, "192.168.100.200", 50000 + t, i);
+                }
+            });
+        }
+        for(std::thread& worker : workers) {
+            worker.join();
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("  %d thread%s : %8.2f ms, %10.0f lines/s\n", threads, threads > 1 ? "s" : " ", ms, N / ms * 1000);
+    }
+    Log::Instance()->init(3, "./testlog3", ".log", 0);   //写线程退出前把积压的日志写完
+    FILE* fp = popen("cat ./testlog3/*.log | grep -c 'userCount'", "r");
+    int lines = 0;
+    assert(fp && fscanf(fp, "%d", &lines) == 1);
+    pclose(fp);
+    assert(lines == 2 * N);
+}
+
+// 目录下所有日志文件的内容
+static std::string ReadLogs(const char* dir){
+    std::string out;
+    FILE* fp = popen(("cat " + std::string(dir) + "/*.log 2>/dev/null").c_str(), "r");
+    char buf[4096];
+    size_t n;
+    while(fp && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
+    }
+    if(fp) {
+        pclose(fp);
+    }
+    return out;
+}
+
+// 调用方不逐行刷新，ERROR立即刷新；级别判断不加锁
+void TestLogFlush(){
+    Log* log = Log::Instance();
+    system("rm -rf ./testlog4");
+    log->init(1, "./testlog4", ".log", 0);
+    assert(log->GetLevel() == 1);
+    LOG_DEBUG("sync debug");
+    LOG_INFO("sync info");
+    LOG_ERROR("sync error");
+    std::string logs = ReadLogs("./testlog4");
+    assert(logs.find("sync debug") == std::string::npos);
+    assert(logs.find("sync info") != std::string::npos && logs.find("sync error") != std::string::npos);
+    LOG_INFO("sync tail");   //之后不再有日志，仍由刷新线程在FLUSH_INTERVAL_MS内写出
+    for(int i = 0; i < 200 && ReadLogs("./testlog4").find("sync tail") == std::string::npos; i++) {
+        usleep(10 * 1000);
+    }
+    assert(ReadLogs("./testlog4").find("sync tail") != std::string::npos);
+
+    log->init(1, "./testlog4", ".log", 1024);
+    LOG_INFO("async info");
+    LOG_ERROR("async error");
+    // 不等写线程的定时唤醒（FLUSH_INTERVAL_MS），ERROR把之前的日志一并写出
+    for(int i = 0; i < 50 && ReadLogs("./testlog4").find("async error") == std::string::npos; i++) {
+        usleep(10 * 1000);
+    }
+    logs = ReadLogs("./testlog4");
+    assert(logs.find("async info") != std::string::npos && logs.find("async error") != std::string::npos);
+    printf("Log flush verified\n");
+}
+
+// 提交远多于完成队列容量的请求：提交队列满时暂存完成事件再提交，完成队列溢出时不报错也不丢事件
+void TestUringOverflow(){
+    Uringer ring(4);
+    if(!ring.Init())
+    {
+        printf("io_uring unavailable, overflow test skipped\n");
+        return;
+    }
+    const int N = 256;
+    int efd = eventfd(1, EFD_NONBLOCK);   //始终可读，每个poll立即完成
+    assert(efd >= 0);
+    for(int i = 0; i < N; i++)
+    {
+        ring.PrepPollAdd(efd, POLLIN, i);
+    }
+    std::vector<bool> seen(N, false);
+    int done = 0;
+    for(int round = 0; done < N && round < 1000; round++)
+    {
+        assert(ring.SubmitAndWait(100) >= 0);
+        struct io_uring_cqe* cqe = nullptr;
+        while((cqe = ring.PeekCqe()) != nullptr)
+        {
+            assert(cqe->res > 0 && cqe->user_data < static_cast<uint64_t>(N) && !seen[cqe->user_data]);
+            seen[cqe->user_data] = true;
+            done++;
+            ring.SeenCqe();
+        }
+    }
+    assert(done == N);
+    close(efd);
+    printf("io_uring overflow handling verified\n");
+}
+
+static bool WaitUntil(const std::atomic<int>& cnt, int expect, int timeoutMS){
+    auto start = std::chrono::steady_clock::now();
+    while(cnt.load() < expect)
+    {
+        if(ElapsedMS(start) > timeoutMS)
+        {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+void TestThreadPool(){
+    // 多个外部线程同时提交，任务内再提交子任务（进入工作线程自己的队列），一个都不丢也不重复执行
+    const int PRODUCERS = 4;
+    const int PER_PRODUCER = 20000;
+    const int TOTAL = PRODUCERS * PER_PRODUCER * 2;
+    std::vector<std::atomic<int>> runs(TOTAL);
+    for(auto& r : runs)
+    {
+        r = 0;
+    }
+    std::atomic<int> done(0);
+    {
+        ThreadPool pool(4);
+        std::vector<std::thread> producers;
+        for(int p = 0; p < PRODUCERS; p++)
+        {
+            producers.emplace_back([&pool, &runs, &done, p](){
+                for(int i = 0; i < PER_PRODUCER; i++)
+                {
+                    int id = (p * PER_PRODUCER + i) * 2;
+                    pool.addTask([&pool, &runs, &done, id](){
+                        runs[id]++;
+                        pool.addTask([&runs, &done, id](){ runs[id + 1]++; done++; });
+                        done++;
+                    });
+                }
+            });
+        }
+        for(std::thread& t : producers)
+        {
+            t.join();
+        }
+        assert(WaitUntil(done, TOTAL, 10000));
+        for(auto& r : runs)
+        {
+            assert(r.load() == 1);
+        }
+
+        // 所有线程都休眠之后逐个提交，每个任务都要及时被唤醒的线程执行
+        std::atomic<int> woken(0);
+        for(int round = 0; round < 200; round++)
+        {
+            if(round % 20 == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));   //让工作线程都进入休眠
+            }
+            pool.addTask([&woken](){ woken++; });
+            assert(WaitUntil(woken, round + 1, 1000));
+        }
+
+        // 窃取：父任务把子任务放进自己的队列后一直等着，子任务只能被其他线程偷走执行
+        const int CHILDREN = 1000;
+        std::atomic<int> children(0);
+        std::atomic<int> parent(0);
+        pool.addTask([&pool, &children, &parent](){
+            for(int i = 0; i < CHILDREN; i++)
+            {
+                pool.addTask([&children](){ children++; });
+            }
+            WaitUntil(children, CHILDREN, 5000);
+            parent++;
+        });
+        assert(WaitUntil(children, CHILDREN, 5000) && WaitUntil(parent, 1, 6000));
+    }
+
+    // 析构时队列中还有任务：已提交的任务全部执行，线程池对象先于它们释放
+    std::atomic<int> late(0);
+    {
+        ThreadPool pool(2);
+        pool.addTask([](){ std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+        pool.addTask([](){ std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+        for(int i = 0; i < 10000; i++)
+        {
+            pool.addTask([&late](){ late++; });
+        }
+    }
+    assert(WaitUntil(late, 10000, 5000));
+    printf("ThreadPool verified\n");
+}
+
+// 读一个完整的响应（响应头加Content-Length字节），连接关闭或超时返回空串
+static std::string ReadResponse(int fd){
+    std::string resp;
+    char buf[4096];
+    while(true)
+    {
+        size_t head = resp.find("\r\n\r\n");
+        if(head != std::string::npos)
+        {
+            size_t pos = resp.find("Content-Length: ");
+            size_t len = pos < head ? strtoul(resp.c_str() + pos + 16, nullptr, 10) : 0;
+            if(resp.size() >= head + 4 + len)
+            {
+                return resp;
+            }
+        }
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0)
+        {
+            return std::string();
+        }
+        resp.append(buf, n);
+    }
+}
+
+static int ConnectLocal(int port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    assert(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    struct timeval tv = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+// 两个子Reactor通过SO_REUSEPORT监听同一端口：连接被内核分散到两边，都能得到响应；
+// Stop让各自的Loop返回，析构时关闭监听socket和全部连接
+static void CheckSubReactors(bool useUring){
+    const int PORT = 19106;
+    const int CLIENTS = 64;
+    const std::string dir = "/tmp/webserver_reactor_test";
+    system(("rm -rf " + dir + " && mkdir -p " + dir).c_str());
+    FILE* fp = fopen((dir + "/index.html").c_str(), "w");
+    fputs("<html>reactor</html>", fp);
+    fclose(fp);
+    HttpConn::SrcDir = dir.c_str();
+    HttpConn::isET = false;
+
+    std::vector<std::unique_ptr<SubReactor>> reactors;
+    for(int i = 0; i < 2; i++)
+    {
+        reactors.emplace_back(new SubReactor(i, PORT, EPOLLRDHUP, EPOLLONESHOT | EPOLLRDHUP, 60000, useUring));
+        assert(reactors.back()->Init());
+    }
+    std::atomic<int> stopped(0);
+    std::vector<std::thread> threads;
+    for(auto& reactor : reactors)
+    {
+        threads.emplace_back([&reactor, &stopped](){ reactor->Loop(); stopped++; });
+    }
+
+    const std::string req = "GET /index.html HTTP/1.1\r\nHost: x\r\nConnection: keep-alive\r\n\r\n";
+    std::vector<int> clients;
+    for(int i = 0; i < CLIENTS; i++)
+    {
+        int fd = ConnectLocal(PORT);
+        assert(send(fd, req.data(), req.size(), 0) == static_cast<ssize_t>(req.size()));
+        std::string resp = ReadResponse(fd);
+        assert(resp.compare(0, 15, "HTTP/1.1 200 OK") == 0 && resp.find("<html>reactor</html>") != std::string::npos);
+        clients.push_back(fd);
+    }
+    uint64_t a = reactors[0]->Accepted(), b = reactors[1]->Accepted();
+    assert(a + b == CLIENTS && a > 0 && b > 0);
+
+    for(auto& reactor : reactors)
+    {
+        reactor->Stop();
+    }
+    assert(WaitUntil(stopped, 2, 2000));
+    for(std::thread& t : threads)
+    {
+        t.join();
+    }
+    reactors.clear();
+    char ch;
+    for(int fd : clients)
+    {
+        assert(recv(fd, &ch, 1, 0) == 0);   //析构时关闭了仍保持着的连接
+        close(fd);
+    }
+    // 监听socket都已关闭，不带SO_REUSEPORT的socket可以重新监听这个端口
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(PORT);
+    assert(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 8) == 0);
+    close(fd);
+    system(("rm -rf " + dir).c_str());
+    printf("SubReactor sharding and shutdown verified (%s: %llu/%llu)\n", useUring ? "io_uring" : "epoll",
+           (unsigned long long)a, (unsigned long long)b);
+}
+
+// 连接关闭后fd被复用：槽的地址不变，旧连接的Key不再能找到它
+void TestConnSlab(){
+    ConnSlab slab(4096);
+    int devnull = open("/dev/null", O_WRONLY);
+    assert(devnull >= 0);
+    sockaddr_in addr = {};
+    int fd = dup(devnull);
+    HttpConn* client = slab.Get(fd);
+    assert(slab.Get(fd) == client && reinterpret_cast<uintptr_t>(client) % 64 == 0);
+    client->Init(fd, addr);
+    uint64_t oldKey = ConnSlab::Key(client);
+    assert(ConnSlab::KeyFd(oldKey) == fd && slab.Find(oldKey) == client);
+
+    client->Close();
+    assert(!slab.Find(oldKey));   //连接已关闭，之后到达的事件和定时器被丢弃
+    assert(dup2(devnull, fd) == fd);
+    client->Init(fd, addr);
+    uint64_t newKey = ConnSlab::Key(client);
+    assert(ConnSlab::KeyFd(newKey) == fd && newKey != oldKey);
+    assert(slab.Find(newKey) == client && !slab.Find(oldKey));   //fd复用后旧Key仍然失效
+
+    assert(!slab.Find(4000));   //所在块未分配
+    HttpConn* far = slab.Get(4000);
+    assert(far && slab.Get(fd) == client && slab.Find(newKey) == client);   //分配新块不移动已有的槽
+    assert(!slab.Find(4096) && !slab.Find(0xffffffffULL));   //超出范围
+    close(devnull);
+    printf("ConnSlab generation keys verified\n");
+}
+
+void TestSubReactor(){
+    CheckSubReactors(false);
+    CheckSubReactors(true);
+}
+
 int main(){
     TestLog();
+    TestTimer();
+    TestThreadPool();
+    TestScan();
+    TestParser();
+    TestRange();
+    TestConditional();
+    TestAcceptEncoding();
+    TestPrecompressed();
+    TestResourceWatcher();
+    TestResponseCache();
+    TestPipeline();
+    TestFileCache();
+    TestSendfile();
+    TestResourcePack();
+    TestDeferredVerify();
+    TestUserCache();
+    TestBuffer();
+    TestIdleMemory();
+    TestArena();
+    TestLogBenchmark();
+    TestLogFlush();
+    TestUringOverflow();
+    TestConnSlab();
+    TestSubReactor();
 }
\ No newline at end of file